@@ -1,249 +1,1970 @@
+#include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "cpu.h"
 #include "asm.h"
+#include "asm_hash.h"
 
-static CPU_Reg get_reg(char** src, bool* found) {
-    for (size_t i = 0; i < REG_LEN; i ++) {
-        if (cpu_reg_names[i] == NULL)
-            continue;
-        size_t len = strlen(cpu_reg_names[i]);
-        if (memcmp(*src, cpu_reg_names[i], len) == 0) {
-            *found = true;
-            *src += len;
+/* ============================================================
+ * lexing
+ * ============================================================ */
+
+// exact match of s[0, len) against the one name its hash slot points at
+static bool lookup(const u8* slot, u32 seed, u32 bits, const char** names,
+                   const char* s, size_t len, u8* out) {
+    u8 id = slot[asm_hash(seed, s, len) >> (32 - bits)];
+    if (id == 0xFF)
+        return false;
+    if (strncmp(names[id], s, len) != 0 || names[id][len] != '\0')
+        return false;
+    *out = id;
+    return true;
+}
+
+static bool is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// the rest of the line is a comment
+static bool is_end(char c) {
+    return c == '\0' || c == ';' || c == '\n' || c == '\r';
+}
+
+static const char* skip_ws(const char* src) {
+    while (*src == ' ' || *src == '\t')
+        src ++;
+    return src;
+}
+
+// `b 20` / `w 20`: the letter alone, then a blank. a symbol may start
+// with b or w too
+static bool is_width(const char* p) {
+    return (*p == 'b' || *p == 'w') && (p[1] == ' ' || p[1] == '\t');
+}
+
+static size_t token_len(const char* src) {
+    size_t len = 0;
+    while (is_alpha(src[len]) || is_digit(src[len]) || src[len] == '.')
+        len ++;
+    return len;
+}
+
+static CPU_Reg get_reg(const char** src, bool* found) {
+    size_t len = token_len(*src);
+    u8 id;
+
+    *found = lookup(asm_reg_slot, ASM_REG_SEED, ASM_REG_BITS, cpu_reg_names, *src, len, &id);
+    if (!*found)
+        return 0;
+    *src += len;
+    return id;
+}
+
+// decimal or 0x hex
+static int32_t get_const(const char** src) {
+    const char* p = *src;
+    u32 v = 0;
+
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        p += 2;
+        while (true) {
+            char c = *p | 0x20;
+            if (is_digit(*p))
+                v = v * 16 + (*p - '0');
+            else if (c >= 'a' && c <= 'f')
+                v = v * 16 + (c - 'a' + 10);
+            else
+                break;
+            p ++;
+        }
+    }
+    else {
+        while (is_digit(*p))
+            v = v * 10 + (*p++ - '0');
+    }
+
+    *src = p;
+    return v;
+}
+
+/* ============================================================
+ * threads
+ * ============================================================ */
+
+// a thread's worth of work, so small inputs stay on the calling thread
+#define ASM_CHUNK_MIN (256 * 1024)  // source bytes
+#define ASM_EMIT_MIN  (64 * 1024)   // instructions
+
+// no more than asked for, nor than there is work for
+static u32 job_count(u32 jobs, size_t work) {
+    if (jobs > work)
+        jobs = work;
+    return jobs > 1 ? jobs : 1;
+}
+
+// fn on each of n items, one thread each; the calling thread takes the
+// first, and any item that gets no thread
+static void run_jobs(void* (*fn)(void*), void* items, size_t stride, u32 n) {
+    pthread_t* threads = malloc(n * sizeof(pthread_t));
+    bool* started = calloc(n, sizeof(bool));
+
+    for (u32 i = 1; i < n; i ++)
+        started[i] = pthread_create(&threads[i], NULL, fn, (u8*) items + i * stride) == 0;
+    fn(items);
+    for (u32 i = 1; i < n; i ++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn((u8*) items + i * stride);
+    }
+
+    free(started);
+    free(threads);
+}
+
+/* ============================================================
+ * symbols
+ * ============================================================ */
+
+// names out of a mapped source are borrowed; anything else may be a
+// reused line buffer and is copied
+static bool in_src(const Asm* as, const char* name) {
+    return as->src != NULL && name >= as->src && name < as->src + as->src_len;
+}
+
+static void table_grow(Asm* as) {
+    as->table_bits ++;
+    free(as->table);
+    as->table = calloc(1u << as->table_bits, sizeof(u32));
+
+    u32 mask = (1u << as->table_bits) - 1;
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        u32 at = as->syms[i].hash & mask;
+        while (as->table[at] != 0)
+            at = (at + 1) & mask;
+        as->table[at] = i + 1;
+    }
+}
+
+// index of the symbol, created undefined on first sight
+static u32 sym_find(Asm* as, const char* name, u32 len, u32 hash) {
+    u32 mask = (1u << as->table_bits) - 1;
+
+    u32 at = hash & mask;
+    while (as->table[at] != 0) {
+        AsmSym* s = &as->syms[as->table[at] - 1];
+        if (s->hash == hash && s->len == len && memcmp(s->name, name, len) == 0)
+            return as->table[at] - 1;
+        at = (at + 1) & mask;
+    }
+
+    if (as->nsyms == as->sym_cap) {
+        as->sym_cap = as->sym_cap ? as->sym_cap * 2 : 64;
+        as->syms = realloc(as->syms, as->sym_cap * sizeof(AsmSym));
+    }
+
+    u32 id = as->nsyms ++;
+    as->syms[id] = (AsmSym) {
+        .name = in_src(as, name) ? name : strndup(name, len),
+        .len = len,
+        .hash = hash,
+        .kind = SYM_UNDEF,
+        .line = as->line,
+    };
+    as->table[at] = id + 1;
+
+    // keep the load under one half
+    if (as->nsyms * 2 > (1u << as->table_bits))
+        table_grow(as);
+
+    return id;
+}
+
+static u32 sym_get(Asm* as, const char* name, u32 len) {
+    return sym_find(as, name, len, asm_hash(0, name, len));
+}
+
+// a label waits in its section for the next instruction pushed there
+static AsmSym* sym_define(Asm* as, const char* name, u32 len, AsmSymKind kind) {
+    u32 id = sym_get(as, name, len);
+    AsmSym* s = &as->syms[id];
+    if (s->kind != SYM_UNDEF) {
+        as->error = "symbol defined twice";
+        return NULL;
+    }
+    s->kind = kind;
+    s->line = as->line;
+
+    if (kind == SYM_LABEL) {
+        AsmSect* sect = &as->sects[as->sect];
+        s->sect = as->sect;
+        s->instr = ASM_END;
+        s->next = sect->pending;
+        sect->pending = id + 1;
+    }
+    return s;
+}
+
+static AsmValue eval(const Asm* as, AsmExpr e);
+
+AsmValue asm_value(const Asm* as, const AsmSym* s) {
+    if (s->kind == SYM_LABEL) {
+        const AsmSect* sect = &as->sects[s->sect];
+        u32 addr = s->instr == ASM_END ? sect->size : as->instrs[s->instr].addr;
+        if (as->reloc)
+            return (AsmValue) { addr, ASM_SECT(s->sect) };
+        return (AsmValue) { sect->addr + addr, ASM_ABS };
+    }
+    if (s->kind == SYM_EQU)
+        return eval(as, s->expr);
+    return (AsmValue) { 0, ASM_IMPORT(s - as->syms) };
+}
+
+// only after asm_link has ruled out undefined symbols and cycles
+static AsmValue eval(const Asm* as, AsmExpr e) {
+    if (e.sym == 0)
+        return (AsmValue) { e.val, ASM_ABS };
+    AsmValue v = asm_value(as, &as->syms[e.sym - 1]);
+    v.val += e.val;
+    return v;
+}
+
+// an equ that reaches itself again within nsyms steps never resolves
+static bool sym_resolves(const Asm* as, const AsmSym* s) {
+    for (u32 depth = 0; depth <= as->nsyms; depth ++) {
+        if (s->kind == SYM_LABEL)
+            return true;
+        if (s->kind != SYM_EQU)
+            return as->reloc;
+        if (s->expr.sym == 0)
+            return true;
+        s = &as->syms[s->expr.sym - 1];
+    }
+    return false;
+}
+
+static u32 sect_get(Asm* as, const char* name, u32 len) {
+    for (u32 i = 0; i < as->nsects; i ++) {
+        if (as->sects[i].len == len && memcmp(as->sects[i].name, name, len) == 0)
             return i;
+    }
+
+    if (as->nsects == as->sect_cap) {
+        as->sect_cap = as->sect_cap ? as->sect_cap * 2 : 4;
+        as->sects = realloc(as->sects, as->sect_cap * sizeof(AsmSect));
+    }
+
+    as->sects[as->nsects] = (AsmSect) {
+        .name = in_src(as, name) ? name : strndup(name, len),
+        .len = len,
+    };
+    return as->nsects ++;
+}
+
+/* ============================================================
+ * parsing
+ * ============================================================ */
+
+// number or symbol terms joined by + and -; at most one symbol, added
+static int get_expr(Asm* as, const char** src, AsmExpr* out) {
+    const char* p = skip_ws(*src);
+    bool neg = false;
+    *out = (AsmExpr) {0};
+
+    if (*p == '-') {
+        neg = true;
+        p ++;
+    }
+
+    while (true) {
+        p = skip_ws(p);
+
+        if (is_digit(*p)) {
+            int32_t v = get_const(&p);
+            out->val += neg ? -v : v;
+        }
+        else if (is_alpha(*p)) {
+            size_t len = token_len(p);
+            if (neg || out->sym != 0) {
+                as->error = "only one added symbol per expression";
+                return 1;
+            }
+            out->sym = sym_get(as, p, len) + 1;
+            p += len;
+        }
+        else {
+            as->error = "expected a number or a symbol";
+            return 1;
         }
+
+        p = skip_ws(p);
+        if (*p == '+')
+            neg = false;
+        else if (*p == '-')
+            neg = true;
+        else
+            break;
+        p ++;
     }
-    *found = false;
+
+    *src = p;
     return 0;
 }
 
-static u32 get_const(char** src) {
-    return strtol(*src, src, 10);
-}
+// register or expression
+static int get_source(Asm* as, const char** src, AsmArg* arg) {
+    *src = skip_ws(*src);
 
-static CPU_Instr_Source_Type get_source(char** src, u8** dest) {
     bool is_reg;
     CPU_Reg reg = get_reg(src, &is_reg);
     if (is_reg) {
-        *(*dest)++ = reg;
-        return SRCTY_REGISTER;
+        arg->reg = reg;
+        arg->src_reg = true;
+        return 0;
+    }
+
+    // `w 8192` keeps the immediate; relaxing never swaps in a register
+    const char* p = *src;
+    if (*p == 'w' && is_width(p)) {
+        arg->word = true;
+        *src = p + 1;
+    }
+    return get_expr(as, src, &arg->expr);
+}
+
+// valid:
+// [123]
+// [00: 123]
+// [00: r0]
+// [r0]
+// [r0 + 123]
+// [r0 + r0]
+// [sp]
+// [pc + r0]
+// [pc - r0]
+// [sp + r0]
+// [sp - r0]
+// [pt + r0]
+// [it + r0]
+// [w 123]
+// [pc + 123]
+// [pc - 123]
+// [sp + 123]
+// [sp - 123]
+// [pt + 123]
+// [it + 123]
+//
+// anywhere a number goes, an expression goes
+static int get_addr(Asm* as, const char** src, AsmArg* arg) {
+    const char* p = skip_ws(*src + 1);
+
+    CPU_Instr_Addr_Header header;
+    header.byte = 0;
+    header.mode = ADDRMD_ABSOLUTE;
+
+    if (is_digit(*p)) {
+        const char* q = p;
+        int32_t bank = get_const(&q);
+        q = skip_ws(q);
+        if (*q == ':') {
+            header.bank = bank;
+            arg->bank = true;
+            p = skip_ws(q + 1);
+        }
+    }
+
+    size_t len = token_len(p);
+    bool rel = len == 2 && (memcmp(p, "pc", 2) == 0 || memcmp(p, "sp", 2) == 0 ||
+                            memcmp(p, "pt", 2) == 0 || memcmp(p, "it", 2) == 0);
+
+    // [sp] alone is the register as an absolute source
+    if (rel && p[0] == 's' && *skip_ws(p + 2) == ']')
+        rel = false;
+
+    if (rel) {
+        if (p[0] == 'p' && p[1] == 'c')
+            header.mode = ADDRMD_PC_REL;
+        else if (p[0] == 's')
+            header.mode = ADDRMD_SP_REL;
+        else if (p[0] == 'p')
+            header.mode = ADDRMD_PT_REL;
+        else
+            header.mode = ADDRMD_IT_REL;
+
+        p = skip_ws(p + 2);
+        char diff = *p ++;
+
+        // pc and sp carry the direction in the bank bits
+        bool signed_mode = header.mode == ADDRMD_PC_REL || header.mode == ADDRMD_SP_REL;
+        if (diff == '+')
+            header.bank = 0;
+        else if (diff == '-' && signed_mode)
+            header.bank = 1;
+        else {
+            as->error = "bad address offset";
+            return 1;
+        }
+
+        if (get_source(as, &p, arg) != 0)
+            return 1;
+    }
+    else {
+        const char* q = p;
+        bool is_reg;
+        CPU_Reg reg = get_reg(&q, &is_reg);
+        q = skip_ws(q);
+
+        if (is_reg && *q == '+' && reg >= REG_R0 && reg <= REG_R7) {
+            header.mode = ADDRMD_INDEXED;
+            header.bank = reg - REG_R0;
+            p = q + 1;
+        }
+
+        if (get_source(as, &p, arg) != 0)
+            return 1;
+    }
+
+    p = skip_ws(p);
+    if (*p != ']') {
+        as->error = "expected ]";
+        return 1;
     }
 
-    *((u16*)(*dest)) = get_const(src);
-    (*dest) += 2;
-    return SRCTY_IMMEDIATE;
+    arg->kind = ARG_ADDR;
+    arg->header = header.byte;
+    *src = p + 1;
+    return 0;
 }
 
-int assemble(char* src, u8** dest) {
-    src += strspn(src, " ");
-    char* semi = strchr(src, ';');
-    if (semi != NULL)
-        *semi = '\0';
+// mnemonics without a width; the assembler picks .b when the value fits.
+// addi is left out: addi.b does not wrap at 16 bits like addi.w does
+static const struct {
+    const char* name;
+    u8 op_b, op_w;
+} relaxable[] = {
+    { "imm",  INSTR_imm_b,  INSTR_imm_w  },
+    { "subi", INSTR_subi_b, INSTR_subi_w },
+    { "andi", INSTR_andi_b, INSTR_andi_w },
+};
 
-    semi = strchr(src, '\n');
-    if (semi != NULL)
-        *semi = '\0';
+#define RELAXABLE_LEN (sizeof(relaxable) / sizeof(*relaxable))
+
+static bool get_op(const char* src, size_t len, AsmInstr* in) {
+    u8 op;
+    if (lookup(asm_instr_slot, ASM_INSTR_SEED, ASM_INSTR_BITS, cpu_instr_names, src, len, &op)) {
+        in->op = op;
+        return true;
+    }
 
-    semi = strchr(src, '\r');
-    if (semi != NULL)
-        *semi = '\0';
+    for (size_t i = 0; i < RELAXABLE_LEN; i ++) {
+        if (strlen(relaxable[i].name) == len && memcmp(relaxable[i].name, src, len) == 0) {
+            in->op = relaxable[i].op_b;
+            in->op_w = relaxable[i].op_w;
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (*src == '\0')
+// width of a bare immediate where the op fixes it; 0 if it does not
+static u8 bare_kind(u8 op, u32 index) {
+    switch (cpu_instr_info[op].ops[index]) {
+    case OPND_BYTE:
+        return ARG_BYTE;
+    case OPND_WORD:
+        return ARG_WORD;
+    default:
         return 0;
+    }
+}
 
-    char* args = strchrnul(src, ' ');
-    if (*args != '\0') {
-        *args = '\0';
-        args ++;
+// what the op takes in place of each operand kind
+static bool arg_fits(const AsmArg* a, CPU_Operand_Kind want) {
+    switch (a->kind) {
+    case ARG_REG:
+        return want == OPND_REG;
+    case ARG_BYTE:
+    case ARG_IMM:
+        return want == OPND_BYTE;
+    case ARG_WORD:
+        return want == OPND_WORD;
+    default:
+        return want == OPND_ADDR;
     }
+}
 
-    CPU_Instr_Kind instr;
-    bool found = false;
-    for (size_t i = 0; i < INSTR_LEN; i ++) {
-        if (cpu_instr_names[i] == NULL)
-            continue;
-        if (strcmp(cpu_instr_names[i], src) == 0) {
-            found = true;
-            instr = i;
-            break;
+static const char* operand_errors[] = {
+    [OPND_REG]  = "expected a register",
+    [OPND_BYTE] = "expected an 8 bit immediate",
+    [OPND_WORD] = "expected a 16 bit immediate",
+    [OPND_ADDR] = "expected an address",
+};
+
+static int get_arg(Asm* as, const char** src, AsmInstr* in, AsmArg* arg) {
+    const char* p = *src;
+    *arg = (AsmArg) {0};
+
+    if (is_width(p)) {
+        arg->kind = *p == 'b' ? ARG_BYTE : ARG_WORD;
+        p ++;
+        if (get_expr(as, &p, &arg->expr) != 0)
+            return 1;
+    }
+    else if (*p == '[') {
+        if (get_addr(as, &p, arg) != 0)
+            return 1;
+    }
+    else {
+        bool found;
+        CPU_Reg reg = get_reg(&p, &found);
+        if (found) {
+            arg->kind = ARG_REG;
+            arg->reg = reg;
         }
+        else {
+            if (in->op_w != 0)
+                arg->kind = ARG_IMM;
+            else if ((arg->kind = bare_kind(in->op, arg - in->args)) == 0) {
+                as->error = "immediate needs a width (b or w)";
+                return 1;
+            }
+            if (get_expr(as, &p, &arg->expr) != 0)
+                return 1;
+        }
+    }
+
+    *src = p;
+    return 0;
+}
+
+// @bank:page, as asmlink takes it; a section may be placed again only
+// where it already is
+static int place(Asm* as, AsmSect* sect, const char** src) {
+    const char* p = skip_ws(*src + 1);
+    if (as->reloc) {
+        as->error = "placement in a relocatable module; asmlink places those";
+        return 1;
+    }
+
+    bool ok = is_digit(*p);
+    u32 bank = get_const(&p);
+    p = skip_ws(p);
+    ok = ok && *p == ':';
+    p = skip_ws(p + 1);
+    ok = ok && is_digit(*p);
+    u32 page = get_const(&p);
+    if (!ok || bank > 15 || page > 15) {
+        as->error = "placement is @bank:page, both 0 - 15";
+        return 1;
     }
-    if (!found)
+
+    if (sect->placed && (sect->bank != bank || sect->addr != PAGE(page))) {
+        as->error = "section placed twice";
         return 1;
+    }
+    if (!sect->placed)
+        sect->line = as->line;
+    sect->placed = true;
+    sect->bank = bank;
+    sect->addr = PAGE(page);
+    *src = p;
+    return 0;
+}
+
+// labels waiting in the section now point at instruction `at`; whether
+// there were any
+static bool sect_resolve(Asm* as, u32 id, u32 at) {
+    AsmSect* sect = &as->sects[id];
+    if (sect->pending == 0)
+        return false;
+    for (u32 i = sect->pending; i != 0; i = as->syms[i - 1].next)
+        as->syms[i - 1].instr = at;
+    sect->pending = 0;
+    return true;
+}
+
+static void instr_push(Asm* as, AsmInstr* in) {
+    if (as->count == as->cap) {
+        as->cap = as->cap ? as->cap * 2 : 256;
+        as->instrs = realloc(as->instrs, as->cap * sizeof(AsmInstr));
+    }
+
+    in->sect = as->sect;
+    in->block = sect_resolve(as, as->sect, as->count);
+    as->instrs[as->count ++] = *in;
+}
 
-    *(*dest)++ = instr;
+// comma or space separated names
+static int get_globals(Asm* as, const char* p, const char** end) {
+    while (true) {
+        p += strspn(p, ", \t");
+        if (is_end(*p))
+            break;
+        if (!is_alpha(*p)) {
+            as->error = "expected a name";
+            return 1;
+        }
+        size_t len = token_len(p);
+        u32 i = sym_get(as, p, len);
+        as->syms[i].global = true;
+        p += len;
+    }
+    *end = p;
+    return 0;
+}
 
-    while (*args != '\0') {
-        args += strspn(args, ", ");
-        if (*args == '\0')
+// comma or space separated values, an instruction sized byte each
+static int get_bytes(Asm* as, const char* p, const char** end) {
+    u32 n = 0;
+    while (true) {
+        p += strspn(p, ", \t");
+        if (is_end(*p))
             break;
+        AsmInstr in = {
+            .line = as->line,
+            .data = true,
+            .nargs = 1,
+        };
+        in.args[0].kind = ARG_BYTE;
+        if (get_expr(as, &p, &in.args[0].expr) != 0)
+            return 1;
+        instr_push(as, &in);
+        n ++;
+    }
+    if (n == 0) {
+        as->error = "expected a value";
+        return 1;
+    }
+    *end = p;
+    return 0;
+}
+
+int asm_line(Asm* as, const char* src) {
+    as->line ++;
+    as->error = NULL;
+    as->error_line = as->line;
+
+    const char* p = skip_ws(src);
+
+    // label
+    if (is_alpha(*p)) {
+        size_t len = token_len(p);
+        if (p[len] == ':') {
+            if (sym_define(as, p, len, SYM_LABEL) == NULL)
+                return 1;
+            p = skip_ws(p + len + 1);
+        }
+    }
+
+    if (is_end(*p))
+        return 0;
+
+    size_t len = token_len(p);
+
+    if (len == 4 && memcmp(p, ".equ", 4) == 0) {
+        p = skip_ws(p + 4);
+        size_t name_len = token_len(p);
+        if (!is_alpha(*p)) {
+            as->error = "expected a name";
+            return 1;
+        }
+        const char* name = p;
+        p = skip_ws(p + name_len);
+        if (*p == ',')
+            p ++;
+
+        AsmExpr expr;
+        if (get_expr(as, &p, &expr) != 0)
+            return 1;
+        AsmSym* s = sym_define(as, name, name_len, SYM_EQU);
+        if (s == NULL)
+            return 1;
+        s->expr = expr;
+    }
+    else if (len == 8 && memcmp(p, ".section", 8) == 0) {
+        p = skip_ws(p + 8);
+        size_t name_len = token_len(p);
+        if (name_len == 0) {
+            as->error = "expected a section name";
+            return 1;
+        }
+        as->sect = sect_get(as, p, name_len);
+        p = skip_ws(p + name_len);
+        if (*p == '@' && place(as, &as->sects[as->sect], &p) != 0)
+            return 1;
+    }
+    else if (len == 7 && memcmp(p, ".global", 7) == 0) {
+        if (get_globals(as, p + 7, &p) != 0)
+            return 1;
+    }
+    else if (len == 5 && memcmp(p, ".byte", 5) == 0) {
+        if (get_bytes(as, p + 5, &p) != 0)
+            return 1;
+    }
+    else {
+        AsmInstr in = {
+            .line = as->line,
+        };
+        if (!get_op(p, len, &in)) {
+            as->error = "unknown instruction";
+            return 1;
+        }
+        p += len;
+
+        // fewer operands than the op takes is allowed; the cpu reads the
+        // rest out of whatever follows
+        const CPU_Instr_Info* info = &cpu_instr_info[in.op];
+        while (true) {
+            p += strspn(p, ", \t");
+            if (is_end(*p))
+                break;
+            if (in.nargs == info->nops) {
+                as->error = "too many operands";
+                return 1;
+            }
+            AsmArg* arg = &in.args[in.nargs ++];
+            if (get_arg(as, &p, &in, arg) != 0)
+                return 1;
+            if (!arg_fits(arg, info->ops[arg - in.args])) {
+                as->error = operand_errors[info->ops[arg - in.args]];
+                return 1;
+            }
+        }
+
+        instr_push(as, &in);
+    }
+
+    p = skip_ws(p);
+    if (!is_end(*p)) {
+        as->error = "junk after statement";
+        return 1;
+    }
+    return 0;
+}
+
+// every line in [p, end), parsed straight out of the mapping: the \n at
+// the end of a line stops the parser. only the last line of a file may
+// run into end
+static int parse_lines(Asm* as, const char* p, const char* end) {
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            // the last line runs into the end of the mapping; it is the
+            // one line that gets copied
+            char* tail = strndup(p, end - p);
+            int status = asm_line(as, tail);
+            free(tail);
+            return status;
+        }
+
+        if (asm_line(as, p) != 0)
+            return 1;
+        p = nl + 1;
+    }
+    return 0;
+}
+
+static int parse_chunks(Asm* as, u32 jobs);
+
+int asm_file(Asm* as, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        as->error = "cannot open source";
+        as->error_line = 0;
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        as->error = "cannot stat source";
+        as->error_line = 0;
+        return 1;
+    }
+
+    // nothing to map
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        as->error = "cannot map source";
+        as->error_line = 0;
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    as->src = map;
+    as->src_len = st.st_size;
+
+    u32 jobs = job_count(as->jobs, as->src_len / ASM_CHUNK_MIN);
+    if (jobs > 1)
+        return parse_chunks(as, jobs);
+    return parse_lines(as, as->src, as->src + as->src_len);
+}
+
+/* ============================================================
+ * parallel parsing
+ * ============================================================ */
+
+// each chunk of whole lines is parsed into an Asm of its own. chunk
+// section 0 stands for whatever section the previous chunk ended in.
+// merging in chunk order hands out symbol and section numbers in order
+// of first sight, as a serial parse would; only then are the chunks'
+// instructions copied over, renumbered, on the same threads
+
+typedef struct {
+    Asm as;
+    Asm* whole;
+    const char* start;
+    const char* end;
+    int status;
+
+    u32* first;     // first instruction of each chunk section; ASM_END for none
+    u32 line;       // lines before the chunk
+    u32 count;      // instructions before the chunk
+    u32* syms;      // chunk symbol -> symbol
+    u32* sects;     // chunk section -> section
+} Chunk;
+
+static void* chunk_parse(void* arg) {
+    Chunk* c = arg;
+    Asm* ca = &c->as;
+    c->status = parse_lines(ca, c->start, c->end);
+
+    c->first = malloc(ca->nsects * sizeof(u32));
+    for (u32 i = 0; i < ca->nsects; i ++)
+        c->first[i] = ASM_END;
+    for (u32 i = ca->count; i -- > 0;)
+        c->first[ca->instrs[i].sect] = i;
+    return NULL;
+}
+
+// the chunk's symbols and sections in terms of the whole; the first error
+// by line wins, as it would parsing serially
+static int chunk_merge(Asm* as, Chunk* c, u32 count) {
+    const Asm* ca = &c->as;
+    c->line = as->line;
+    c->count = count;
 
-        if (*args == 'w') {
-            args ++;
-            args += strspn(args, " ");
-            u16 v = get_const(&args);
-            *((u16*)(*dest)) = v;
-            (*dest) += 2;
-        }
-        else if (*args == 'b') {
-            args ++;
-            args += strspn(args, " ");
-            u8 v = get_const(&args);
-            *(*dest)++ = v;
-        }
-        else if (*args == '[') {
-            args ++;
-            // valid:
-            // [123]
-            // [00: 123]
-            // [00: r0]
-            // [r0]
-            // [r0 + 123]
-            // [r0 + r0]
-            // [pc + r0]
-            // [pc - r0]
-            // [sp + r0]
-            // [sp - r0]
-            // [pt + r0]
-            // [it + r0]
-            // [pc + 123]
-            // [pc - 123]
-            // [sp + 123]
-            // [sp - 123]
-            // [pt + 123]
-            // [it + 123]
-            
-            u8 bank = 0;
-            char* sep = strchr(args, ':');
-            if (sep) {
-                *sep = '\0';
-                char* ign = args;
-                bank = get_const(&ign);
-                args = sep + 1;
+    const char* error = c->status != 0 ? ca->error : NULL;
+    u32 error_line = ca->error_line + c->line;
+
+    c->sects = malloc(ca->nsects * sizeof(u32));
+    c->sects[0] = as->sect;
+    for (u32 i = 1; i < ca->nsects; i ++) {
+        const AsmSect* l = &ca->sects[i];
+        c->sects[i] = sect_get(as, l->name, l->len);
+        AsmSect* sect = &as->sects[c->sects[i]];
+        if (!l->placed)
+            continue;
+
+        if (sect->placed && (sect->bank != l->bank || sect->addr != l->addr)) {
+            if (error == NULL || l->line + c->line < error_line) {
+                error = "section placed twice";
+                error_line = l->line + c->line;
             }
+            continue;
+        }
+        if (!sect->placed)
+            sect->line = l->line + c->line;
+        sect->placed = true;
+        sect->bank = l->bank;
+        sect->addr = l->addr;
+    }
+
+    c->syms = malloc((ca->nsyms + 1) * sizeof(u32));
+    for (u32 i = 0; i < ca->nsyms; i ++) {
+        const AsmSym* l = &ca->syms[i];
+        u32 nsyms = as->nsyms;
+        u32 id = c->syms[i] = sym_find(as, l->name, l->len, l->hash);
+        AsmSym* s = &as->syms[id];
+        s->global |= l->global;
+
+        if (as->nsyms != nsyms)
+            s->line = l->line + c->line;
+        if (l->kind == SYM_UNDEF)
+            continue;
 
-            if (memcmp(args, "pc", 2) == 0) {
-                args += 2;
-                args += strspn(args, " ");
-
-                char diff = *args++;
-                
-                args += strspn(args, " ");
-                u8* pheader = (*dest)++;
-                    
-                CPU_Instr_Addr_Header header;
-                header.mode = ADDRMD_PC_REL;
-                header.type = get_source(&args, dest); 
-
-                if (diff == '+') 
-                    header.bank = 0;
-                else if (diff == '-')
-                    header.bank = 1;
-                else
-                    return 1;
-
-                *pheader = header.byte;
+        if (s->kind != SYM_UNDEF) {
+            if (error == NULL || l->line + c->line < error_line) {
+                error = "symbol defined twice";
+                error_line = l->line + c->line;
             }
-            else if (memcmp(args, "sp", 2) == 0) {
-                args += 2;
-                args += strspn(args, " ");
-
-                char diff = *args++;
-                
-                args += strspn(args, " ");
-                u8* pheader = (*dest)++;
-                    
-                CPU_Instr_Addr_Header header;
-                header.mode = ADDRMD_SP_REL;
-                header.type = get_source(&args, dest); 
-
-                if (diff == '+') 
-                    header.bank = 0;
-                else if (diff == '-')
-                    header.bank = 1;
-                else
-                    return 1;
-
-                *pheader = header.byte;
+            continue;
+        }
+
+        s->kind = l->kind;
+        s->line = l->line + c->line;
+        if (l->kind == SYM_LABEL) {
+            s->sect = c->sects[l->sect];
+            s->instr = l->instr == ASM_END ? ASM_END : count + l->instr;
+        }
+    }
+
+    if (error != NULL) {
+        as->error = error;
+        as->error_line = error_line;
+        return 1;
+    }
+
+    for (u32 i = 0; i < ca->nsyms; i ++) {
+        const AsmSym* l = &ca->syms[i];
+        if (l->kind != SYM_EQU)
+            continue;
+        AsmSym* s = &as->syms[c->syms[i]];
+        s->expr = l->expr;
+        if (l->expr.sym != 0)
+            s->expr.sym = c->syms[l->expr.sym - 1] + 1;
+    }
+
+    // labels left waiting by earlier chunks land on this one's first
+    // instruction in their section; then this chunk's waiting labels queue
+    for (u32 i = 0; i < ca->nsects; i ++) {
+        if (c->first[i] != ASM_END && sect_resolve(as, c->sects[i], count + c->first[i]))
+            ca->instrs[c->first[i]].block = true;
+    }
+    for (u32 i = 0; i < ca->nsyms; i ++) {
+        const AsmSym* l = &ca->syms[i];
+        if (l->kind == SYM_LABEL && l->instr == ASM_END) {
+            AsmSym* s = &as->syms[c->syms[i]];
+            AsmSect* sect = &as->sects[s->sect];
+            s->next = sect->pending;
+            sect->pending = c->syms[i] + 1;
+        }
+    }
+
+    as->line += ca->line;
+    as->sect = c->sects[ca->sect];
+    return 0;
+}
+
+static void* chunk_copy(void* arg) {
+    Chunk* c = arg;
+    const Asm* ca = &c->as;
+    AsmInstr* dest = c->whole->instrs + c->count;
+
+    for (u32 i = 0; i < ca->count; i ++) {
+        AsmInstr in = ca->instrs[i];
+        in.line += c->line;
+        in.sect = c->sects[in.sect];
+        for (u32 j = 0; j < in.nargs; j ++) {
+            AsmExpr* e = &in.args[j].expr;
+            if (e->sym != 0)
+                e->sym = c->syms[e->sym - 1] + 1;
+        }
+        dest[i] = in;
+    }
+    return NULL;
+}
+
+static void free_tables(Asm* as);
+
+static int parse_chunks(Asm* as, u32 jobs) {
+    Chunk* chunks = calloc(jobs, sizeof(Chunk));
+    const char* end = as->src + as->src_len;
+    const char* p = as->src;
+
+    // split at the first line break past each even share
+    for (u32 i = 0; i < jobs; i ++) {
+        Chunk* c = &chunks[i];
+        const char* split = i + 1 == jobs ? end : as->src + as->src_len * (i + 1) / jobs;
+        if (split < p)
+            split = p;
+        const char* nl = split < end ? memchr(split, '\n', end - split) : NULL;
+        c->start = p;
+        c->end = p = i + 1 == jobs || nl == NULL ? end : nl + 1;
+        c->whole = as;
+
+        c->as = (Asm) {
+            .org = as->org,
+            .reloc = as->reloc,
+            .table_bits = 6,
+            .src = as->src,
+            .src_len = as->src_len,
+        };
+        c->as.table = calloc(1u << c->as.table_bits, sizeof(u32));
+        sect_get(&c->as, "", 0);
+    }
+
+    run_jobs(chunk_parse, chunks, sizeof(Chunk), jobs);
+
+    int status = 0;
+    u32 count = as->count;
+    for (u32 i = 0; i < jobs && status == 0; i ++) {
+        status = chunk_merge(as, &chunks[i], count);
+        count += chunks[i].as.count;
+    }
+
+    if (status == 0) {
+        if (count > as->cap) {
+            as->cap = count;
+            as->instrs = realloc(as->instrs, as->cap * sizeof(AsmInstr));
+        }
+        run_jobs(chunk_copy, chunks, sizeof(Chunk), jobs);
+        as->count = count;
+        as->error_line = as->line;
+    }
+
+    for (u32 i = 0; i < jobs; i ++) {
+        Chunk* c = &chunks[i];
+        free_tables(&c->as);
+        free(c->first);
+        free(c->syms);
+        free(c->sects);
+    }
+    free(chunks);
+    return status;
+}
+
+/* ============================================================
+ * linking
+ * ============================================================ */
+
+static u32 arg_size(const AsmInstr* in, const AsmArg* a) {
+    switch (a->kind) {
+    case ARG_REG:
+    case ARG_BYTE:
+        return 1;
+    case ARG_WORD:
+        return 2;
+    case ARG_IMM:
+        return in->wide ? 2 : 1;
+    default:
+        return a->src_reg || !a->fixed ? 2 : 3;
+    }
+}
+
+// sections from 0 each. the image has them back to back; in a flat one
+// each runs where it was placed or right after the previous one, from org
+// in bank 0 on
+static void layout(Asm* as) {
+    for (u32 i = 0; i < as->nsects; i ++) {
+        as->sects[i].size = 0;
+        as->sects[i].from = as->sects[i].to = 0;
+    }
+
+    for (u32 i = 0; i < as->count; i ++) {
+        AsmInstr* in = &as->instrs[i];
+        AsmSect* sect = &as->sects[in->sect];
+        u32 size = in->data ? 0 : 1;
+        for (u32 j = 0; j < in->nargs; j ++)
+            size += arg_size(in, &in->args[j]);
+        in->addr = sect->size;
+        in->size = size;
+        sect->size += size;
+
+        if (sect->from == sect->to)
+            sect->from = i;
+        sect->to = i + 1;
+    }
+
+    as->size = 0;
+    su4 bank = 0;
+    u32 addr = as->org;
+    for (u32 i = 0; i < as->nsects; i ++) {
+        AsmSect* sect = &as->sects[i];
+        sect->base = as->size;
+        as->size += sect->size;
+
+        if (as->reloc) {
+            sect->bank = 0;
+            sect->addr = 0;
+            continue;
+        }
+        if (sect->placed) {
+            bank = sect->bank;
+            addr = sect->addr;
+        }
+        sect->bank = bank;
+        sect->addr = addr;
+        addr += sect->size;
+    }
+}
+
+// ops whose first register operand is only read
+static bool reads_first(u8 op) {
+    return cpu_instr_info[op].first == USE_IN;
+}
+
+// two relocatable values are only known equal if they share a base
+typedef struct {
+    u16 val[8];
+    u32 base[8];
+    u8 valid;       // bit per r0 - r7
+} Known;
+
+static bool is_gpr(u8 reg) {
+    return reg >= REG_R0 && reg <= REG_R7;
+}
+
+// what the instruction leaves in r0 - r7
+static void known_step(const Asm* as, const AsmInstr* in, Known* k) {
+    u8 op = in->wide ? in->op_w : in->op;
+
+    // the callee or handler may clobber anything
+    if (cpu_instr_info[op].flow == FLOW_CALL) {
+        k->valid = 0;
+        return;
+    }
+
+    if (in->nargs == 0 || in->args[0].kind != ARG_REG || reads_first(op))
+        return;
+
+    u8 dest = in->args[0].reg;
+    if (!is_gpr(dest))
+        return;
+    u8 bit = 1 << (dest - REG_R0);
+    k->valid &= ~bit;
+
+    if (op == INSTR_clr) {
+        k->val[dest - REG_R0] = 0;
+        k->base[dest - REG_R0] = ASM_ABS;
+        k->valid |= bit;
+        return;
+    }
+
+    if (in->nargs < 2)
+        return;
+    const AsmArg* src = &in->args[1];
+
+    if ((op == INSTR_imm_b || op == INSTR_imm_w) && src->kind != ARG_REG && src->kind != ARG_ADDR) {
+        AsmValue v = eval(as, src->expr);
+        // a relocated imm.b keeps the low byte only
+        if (op == INSTR_imm_b && v.base != ASM_ABS)
+            return;
+        k->val[dest - REG_R0] = op == INSTR_imm_b ? (u8) v.val : (u16) v.val;
+        k->base[dest - REG_R0] = v.base;
+        k->valid |= bit;
+    }
+    else if (op == INSTR_mov && src->kind == ARG_REG && is_gpr(src->reg) &&
+             (k->valid & (1 << (src->reg - REG_R0)))) {
+        k->val[dest - REG_R0] = k->val[src->reg - REG_R0];
+        k->base[dest - REG_R0] = k->base[src->reg - REG_R0];
+        k->valid |= bit;
+    }
+}
+
+// one pass over the current layout; grows every short form that no longer
+// holds and returns whether anything grew
+static bool relax(Asm* as) {
+    bool grew = false;
+    Known k = {0};
+
+    for (u32 i = 0; i < as->count; i ++) {
+        AsmInstr* in = &as->instrs[i];
+
+        // code from another section is not what ran before, and data
+        // may run as anything
+        const AsmInstr* prev = i > 0 ? &as->instrs[i - 1] : NULL;
+        if (in->block || in->data || (prev != NULL && (in->sect != prev->sect || prev->data)))
+            k.valid = 0;
+
+        for (u32 j = 0; j < in->nargs; j ++) {
+            AsmArg* a = &in->args[j];
+
+            if (a->kind == ARG_IMM && !in->wide) {
+                AsmValue v = eval(as, a->expr);
+                if (v.base != ASM_ABS || (u16) v.val > 0xFF) {
+                    in->wide = true;
+                    grew = true;
+                }
             }
-            else if (memcmp(args, "pt", 2) == 0) {
-                args += 2;
-                args += strspn(args, " ");
-            
-                char diff = *args++;
-                if (diff != '+')
-                    return 1;
-                
-                args += strspn(args, " ");
-                u8* pheader = (*dest)++;
-                    
-                CPU_Instr_Addr_Header header;
-                header.mode = ADDRMD_PT_REL;
-                header.type = get_source(&args, dest); 
-
-                *pheader = header.byte;
+            else if (a->kind == ARG_ADDR && !a->src_reg && !a->fixed) {
+                AsmValue v = eval(as, a->expr);
+                u32 r = 0;
+                while (r < 8 && !((k.valid & (1 << r)) && k.val[r] == (u16) v.val && k.base[r] == v.base))
+                    r ++;
+
+                // a relocated absolute address may still need its bank
+                // patched, which a register source can not carry; and a
+                // pc offset counts from the end of the operand, which the
+                // shorter form would move
+                CPU_Instr_Addr_Header header = { .byte = a->header };
+                if (r < 8 && !a->word && header.mode != ADDRMD_PC_REL &&
+                    !(v.base != ASM_ABS && !a->bank)) {
+                    a->reg = REG_R0 + r;
+                }
+                else {
+                    a->fixed = true;
+                    grew = true;
+                }
             }
-            else if (memcmp(args, "it", 2) == 0) {
-                args += 2;
-                args += strspn(args, " ");
-
-                char diff = *args++;
-                if (diff != '+')
-                    return 1;
-                
-                args += strspn(args, " ");
-                u8* pheader = (*dest)++;
-                    
-                CPU_Instr_Addr_Header header;
-                header.mode = ADDRMD_IT_REL;
-                header.type = get_source(&args, dest); 
-
-                *pheader = header.byte;
+        }
+
+        known_step(as, in, &k);
+    }
+
+    return grew;
+}
+
+/* ============================================================
+ * optimizing
+ * ============================================================ */
+
+// no memory, no flags; dropping one that nobody reads changes nothing
+static bool is_pure(u8 op) {
+    switch (op) {
+    case INSTR_mov: case INSTR_imm_b: case INSTR_imm_w: case INSTR_clr:
+    case INSTR_addi_b: case INSTR_addi_w: case INSTR_subi_b: case INSTR_subi_w:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the value of e when no label or import goes into it; those move with
+// the layout the optimizer is about to change
+static bool const_value(const Asm* as, AsmExpr e, u32* out) {
+    u32 val = e.val;
+    for (u32 depth = 0; e.sym != 0; depth ++) {
+        const AsmSym* s = &as->syms[e.sym - 1];
+        if (s->kind != SYM_EQU || depth > as->nsyms)
+            return false;
+        e = s->expr;
+        val += e.val;
+    }
+    *out = val;
+    return true;
+}
+
+#define OPT_NONE 0xFFFFFFFFu
+
+typedef struct {
+    u32 val[8];     // full register width; addi.b does not wrap
+    u8 valid;       // bit per r0 - r7
+    u32 write[8];   // pure instruction whose result nobody has read yet
+    u32 addi[8];    // addi.b that a later one can fold into
+} Opt;
+
+static void opt_reset(Opt* o, bool known) {
+    if (!known)
+        o->valid = 0;
+    for (u32 r = 0; r < 8; r ++)
+        o->write[r] = o->addi[r] = OPT_NONE;
+}
+
+typedef struct {
+    u8 reads;       // bit per r0 - r7
+    int dest;       // r0 - r7 index written, or -1
+    bool flush;     // may hand control elsewhere; every register counts as read
+    bool clobber;   // leaves nothing known
+} Effect;
+
+static Effect effect(const AsmInstr* in) {
+    u8 op = in->wide ? in->op_w : in->op;
+    Effect e = { .dest = -1 };
+
+    switch (cpu_instr_info[op].flow) {
+    case FLOW_CALL:
+    case FLOW_JUMP:
+        e.clobber = true;
+        // fall through
+    case FLOW_BRANCH:
+        e.flush = true;
+        break;
+    default:
+        break;
+    }
+
+    for (u32 j = 0; j < in->nargs; j ++) {
+        const AsmArg* a = &in->args[j];
+        if (a->kind == ARG_ADDR) {
+            CPU_Instr_Addr_Header header = { .byte = a->header };
+            // a relaxed address reads the register relax found for it
+            if (header.mode == ADDRMD_INDEXED)
+                e.reads = 0xFF;
+            else if ((a->src_reg || !a->fixed) && is_gpr(a->reg))
+                e.reads |= 1 << (a->reg - REG_R0);
+            continue;
+        }
+        if (a->kind != ARG_REG)
+            continue;
+
+        bool dest = j == 0 && !reads_first(op);
+        if (dest && !is_gpr(a->reg)) {
+            // pc, sp and the like
+            e.flush = e.clobber = true;
+            continue;
+        }
+        if (dest)
+            e.dest = a->reg - REG_R0;
+        if (is_gpr(a->reg) && !(dest && cpu_instr_info[op].first == USE_OUT))
+            e.reads |= 1 << (a->reg - REG_R0);
+    }
+
+    if (e.flush)
+        e.reads = 0xFF;
+    return e;
+}
+
+// the constant the instruction leaves in its destination, if any
+static bool result(const Asm* as, const AsmInstr* in, const Opt* o, u8 r, u32* out) {
+    u8 op = in->wide ? in->op_w : in->op;
+    bool known = o->valid & (1 << r);
+    u32 v = 0;
+
+    if (op == INSTR_clr) {
+        *out = 0;
+        return true;
+    }
+    if (in->nargs < 2)
+        return false;
+
+    const AsmArg* src = &in->args[1];
+    if (op == INSTR_mov) {
+        if (src->kind != ARG_REG || !is_gpr(src->reg) || !(o->valid & (1 << (src->reg - REG_R0))))
+            return false;
+        *out = o->val[src->reg - REG_R0];
+        return true;
+    }
+    if (src->kind == ARG_REG || src->kind == ARG_ADDR || !const_value(as, src->expr, &v))
+        return false;
+
+    switch (op) {
+    case INSTR_imm_b:
+        *out = (u8) v;
+        return true;
+    case INSTR_imm_w:
+        *out = (u16) v;
+        return true;
+    case INSTR_addi_b:
+        *out = o->val[r] + (u8) v;
+        return known;
+    case INSTR_addi_w:
+        *out = (u16) (o->val[r] + (u16) v);
+        return known;
+    case INSTR_subi_b:
+        *out = (u16) (o->val[r] - (u8) v);
+        return known;
+    case INSTR_subi_w:
+        *out = (u16) (o->val[r] - (u16) v);
+        return known;
+    default:
+        return false;
+    }
+}
+
+static u32 instr_size(const AsmInstr* in) {
+    u32 size = 1;
+    for (u32 j = 0; j < in->nargs; j ++)
+        size += arg_size(in, &in->args[j]);
+    return size;
+}
+
+// rewrites a load of v into r as the shortest instruction that does the
+// same, given what the registers hold; whether it got shorter
+static bool load_shortest(AsmInstr* in, u8 r, u32 v, const Opt* o) {
+    u32 size = in->args[1].kind == ARG_IMM ? (v > 0xFF ? 4 : 3) : instr_size(in);
+    bool known = o->valid & (1 << r);
+    AsmInstr best = *in;
+    u32 best_size = size;
+
+    best.wide = false;
+    best.op_w = 0;
+
+    u32 y = 0;
+    while (y < 8 && !(y != r && (o->valid & (1 << y)) && o->val[y] == v))
+        y ++;
+
+    if (v == 0) {
+        best.op = INSTR_clr;
+        best.nargs = 1;
+        best_size = 2;
+    }
+    else if (v <= 0xFF && size > 3) {
+        best.op = INSTR_imm_b;
+        best.args[1] = (AsmArg) { .kind = ARG_BYTE, .expr = { 0, v } };
+        best_size = 3;
+    }
+    else if (known && v > o->val[r] && v - o->val[r] <= 0xFF && size > 3) {
+        best.op = INSTR_addi_b;
+        best.args[1] = (AsmArg) { .kind = ARG_BYTE, .expr = { 0, v - o->val[r] } };
+        best_size = 3;
+    }
+    else if (known && v <= 0xFFFF && (u16) (o->val[r] - v) <= 0xFF && size > 3) {
+        best.op = INSTR_subi_b;
+        best.args[1] = (AsmArg) { .kind = ARG_BYTE, .expr = { 0, (u16) (o->val[r] - v) } };
+        best_size = 3;
+    }
+    else if (y < 8 && size > 3) {
+        best.op = INSTR_mov;
+        best.args[1] = (AsmArg) { .kind = ARG_REG, .reg = REG_R0 + y };
+        best_size = 3;
+    }
+
+    if (best_size >= size)
+        return false;
+    *in = best;
+    return true;
+}
+
+// labels on a dropped instruction move to the next one kept, which is in
+// the same block: only instructions overwritten later in it are dropped
+static void drop_dead(Asm* as, const bool* dead) {
+    u32* index = malloc((as->count + 1) * sizeof(u32));
+    u32 kept = 0;
+    bool block = false;
+
+    for (u32 i = 0; i < as->count; i ++) {
+        index[i] = kept;
+        if (dead[i]) {
+            block |= as->instrs[i].block;
+            continue;
+        }
+        as->instrs[kept] = as->instrs[i];
+        as->instrs[kept ++].block |= block;
+        block = false;
+    }
+
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        AsmSym* s = &as->syms[i];
+        if (s->kind == SYM_LABEL && s->instr != ASM_END)
+            s->instr = index[s->instr];
+    }
+
+    as->count = kept;
+    free(index);
+}
+
+// one forward pass per basic block: loads of what a register already
+// holds go, so do pure writes overwritten before anyone reads them, and
+// runs of addi.b on one register fold into the first
+static void optimize(Asm* as) {
+    bool* dead = calloc(as->count + 1, sizeof(bool));
+    // code after an instruction short of operands is what the cpu reads
+    // them from, and data may be read or run; either stays byte for byte
+    bool* frozen = calloc(as->nsects, sizeof(bool));
+    Opt o;
+    opt_reset(&o, false);
+
+    for (u32 i = 0; i < as->count; i ++) {
+        AsmInstr* in = &as->instrs[i];
+        u8 op = in->wide ? in->op_w : in->op;
+
+        if (in->block || (i > 0 && in->sect != as->instrs[i - 1].sect))
+            opt_reset(&o, false);
+        if (frozen[in->sect])
+            continue;
+        if (in->data || in->nargs != cpu_instr_info[op].nops) {
+            frozen[in->sect] = true;
+            opt_reset(&o, false);
+            continue;
+        }
+
+        Effect e = effect(in);
+        u8 r = e.dest;
+        u32 v = 0;
+        u32 d = 0;
+        bool add = op == INSTR_addi_b && e.dest >= 0 && const_value(as, in->args[1].expr, &d);
+        bool has = e.dest >= 0 && !e.clobber && result(as, in, &o, r, &v);
+
+        // adds nothing, or loads what is already there
+        if ((add && (u8) d == 0) || (has && (o.valid & (1 << r)) && o.val[r] == v)) {
+            dead[i] = true;
+            as->opt.removed ++;
+            continue;
+        }
+
+        if (add && o.addi[r] != OPT_NONE) {
+            AsmArg* into = &as->instrs[o.addi[r]].args[1];
+            u32 sum = (u32) into->expr.val + (u8) d;
+            if (sum <= 0xFF) {
+                into->expr = (AsmExpr) { 0, sum };
+                o.val[r] = v;
+                dead[i] = true;
+                as->opt.removed ++;
+                as->opt.folded ++;
+                continue;
             }
-            else if (*args == 'r') {
-                args++;
-                int id = (*args ++) - '0';
-                args += strspn(args, " ");
-
-                char diff = *args++;
-                if (diff != '+')
-                    return 1;
-                
-                args += strspn(args, " ");
-                u8* pheader = (*dest)++;
-                    
-                CPU_Instr_Addr_Header header;
-                header.mode = ADDRMD_INDEXED;
-                header.type = get_source(&args, dest); 
-                header.bank = id;
-
-                *pheader = header.byte;
+        }
+
+        if (has && (op == INSTR_imm_b || op == INSTR_imm_w) && load_shortest(in, r, v, &o)) {
+            as->opt.rewritten ++;
+            op = in->op;
+            e = effect(in);
+            add = false;
+        }
+
+        for (u32 r = 0; r < 8; r ++) {
+            if (e.reads & (1 << r))
+                o.write[r] = o.addi[r] = OPT_NONE;
+        }
+        if (e.clobber) {
+            opt_reset(&o, false);
+            continue;
+        }
+        if (e.dest < 0)
+            continue;
+
+        if (o.write[r] != OPT_NONE && !(e.reads & (1 << r))) {
+            dead[o.write[r]] = true;
+            as->opt.removed ++;
+        }
+
+        o.write[r] = is_pure(op) ? i : OPT_NONE;
+        o.addi[r] = OPT_NONE;
+        if (add) {
+            // folding adds up in the literal
+            in->args[1].expr = (AsmExpr) { 0, (u8) d };
+            o.addi[r] = i;
+        }
+
+        if (has) {
+            o.val[r] = v;
+            o.valid |= 1 << r;
+        }
+        else {
+            o.valid &= ~(1 << r);
+        }
+    }
+
+    drop_dead(as, dead);
+    free(frozen);
+    free(dead);
+}
+
+// where a section lands in its bank
+typedef struct {
+    su4 bank;
+    u32 addr, size;
+    u32 sect;
+} Span;
+
+static int span_cmp(const void* a, const void* b) {
+    const Span* x = a;
+    const Span* y = b;
+    if (x->bank != y->bank)
+        return x->bank < y->bank ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// a flat image: every section inside its bank and none on top of another;
+// then the runs of sections back to back in both the image and a bank
+static int segments(Asm* as) {
+    Span* spans = malloc(as->nsects * sizeof(Span));
+    u32 n = 0;
+
+    for (u32 i = 0; i < as->nsects && as->error == NULL; i ++) {
+        const AsmSect* sect = &as->sects[i];
+        if (sect->size == 0)
+            continue;
+        if (sect->addr + sect->size > 0x10000) {
+            as->error = "section runs past the end of its bank";
+            as->error_line = sect->placed ? sect->line : as->line;
+        }
+        spans[n ++] = (Span) { sect->bank, sect->addr, sect->size, i };
+    }
+
+    qsort(spans, n, sizeof(Span), span_cmp);
+    for (u32 i = 1; i < n && as->error == NULL; i ++) {
+        const Span* a = &spans[i - 1];
+        const Span* b = &spans[i];
+        if (a->bank == b->bank && a->addr + a->size > b->addr) {
+            const AsmSect* sect = &as->sects[a->sect > b->sect ? a->sect : b->sect];
+            as->error = "section overlaps another";
+            as->error_line = sect->placed ? sect->line : as->line;
+        }
+    }
+    free(spans);
+    if (as->error != NULL)
+        return 1;
+
+    as->segs = realloc(as->segs, as->nsects * sizeof(AsmSeg));
+    as->nsegs = 0;
+    for (u32 i = 0; i < as->nsects; i ++) {
+        const AsmSect* sect = &as->sects[i];
+        AsmSeg* last = as->nsegs > 0 ? &as->segs[as->nsegs - 1] : NULL;
+        if (sect->size == 0)
+            continue;
+        if (last != NULL && last->bank == sect->bank && last->addr + last->size == sect->addr)
+            last->size += sect->size;
+        else
+            as->segs[as->nsegs ++] = (AsmSeg) { sect->bank, sect->addr, sect->size, sect->base };
+    }
+    return 0;
+}
+
+// back to the shortest forms before relaxing again
+static void relax_reset(Asm* as) {
+    for (u32 i = 0; i < as->count; i ++) {
+        AsmInstr* in = &as->instrs[i];
+        in->wide = false;
+        for (u32 j = 0; j < in->nargs; j ++)
+            in->args[j].fixed = false;
+    }
+}
+
+int asm_link(Asm* as) {
+    as->error = NULL;
+
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        const AsmSym* s = &as->syms[i];
+        if (s->kind == SYM_UNDEF && (!as->reloc || s->global)) {
+            as->error = s->global ? "global symbol never defined" : "undefined symbol";
+            as->error_line = s->line;
+            return 1;
+        }
+    }
+
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        if (!sym_resolves(as, &as->syms[i])) {
+            as->error_line = as->syms[i].line;
+            as->error = "symbol defined in terms of itself";
+            return 1;
+        }
+    }
+
+    // start from the shortest forms and grow until every choice holds
+    do {
+        layout(as);
+    } while (relax(as));
+
+    if (as->optimize) {
+        // a load the optimizer drops or shortens may have been what relax
+        // swapped in for several addresses, which then grow back; keep a
+        // copy to return to when the code did not get smaller
+        u32 size = as->size;
+        u32 count = as->count;
+        AsmInstr* instrs = malloc(count * sizeof(AsmInstr) + 1);
+        u32* at = malloc(as->nsyms * sizeof(u32) + 1);
+        memcpy(instrs, as->instrs, count * sizeof(AsmInstr));
+        for (u32 i = 0; i < as->nsyms; i ++)
+            at[i] = as->syms[i].instr;
+
+        optimize(as);
+        relax_reset(as);
+        do {
+            layout(as);
+        } while (relax(as));
+
+        if (as->size >= size) {
+            memcpy(as->instrs, instrs, count * sizeof(AsmInstr));
+            as->count = count;
+            for (u32 i = 0; i < as->nsyms; i ++)
+                as->syms[i].instr = at[i];
+            as->opt = (AsmOptStats) {0};
+            relax_reset(as);
+            do {
+                layout(as);
+            } while (relax(as));
+        }
+        as->opt.saved = (int32_t) size - (int32_t) as->size;
+        free(instrs);
+        free(at);
+    }
+
+    as->error_line = as->line;
+    for (u32 i = 0; i < as->nsects; i ++) {
+        if (as->sects[i].size > 0x10000) {
+            as->error = "section larger than a bank";
+            return 1;
+        }
+    }
+    return as->reloc ? 0 : segments(as);
+}
+
+static void reloc_push(AsmRelocs* relocs, u32 offset, u8 kind, AsmValue v) {
+    if (relocs->len == relocs->cap) {
+        relocs->cap = relocs->cap ? relocs->cap * 2 : 64;
+        relocs->data = realloc(relocs->data, relocs->cap * sizeof(AsmReloc));
+    }
+    relocs->data[relocs->len ++] = (AsmReloc) {
+        .offset = offset,
+        .kind = kind,
+        .base = v.base,
+        .addend = v.val,
+    };
+}
+
+// the bank of the label a flat image value comes from; 0 for a number
+static su4 value_bank(const Asm* as, AsmExpr e) {
+    while (e.sym != 0) {
+        const AsmSym* s = &as->syms[e.sym - 1];
+        if (s->kind == SYM_LABEL)
+            return as->sects[s->sect].bank;
+        e = s->expr;
+    }
+    return 0;
+}
+
+// values that are not absolute go to relocs with a zero in their place;
+// relocs is NULL for a flat image, where every value is absolute
+static void emit_instr(const Asm* as, const AsmInstr* in, u8* dest, AsmRelocs* relocs) {
+    u8* start = dest;
+    if (!in->data)
+        *dest++ = in->wide ? in->op_w : in->op;
+
+    for (u32 j = 0; j < in->nargs; j ++) {
+        const AsmArg* a = &in->args[j];
+        AsmValue v = { a->reg, ASM_ABS };
+        if (a->kind != ARG_REG)
+            v = eval(as, a->expr);
+        bool word = a->kind == ARG_WORD || (a->kind == ARG_IMM && in->wide);
+
+        if (a->kind == ARG_ADDR) {
+            CPU_Instr_Addr_Header header;
+            header.byte = a->header;
+            header.type = a->src_reg || !a->fixed ? SRCTY_REGISTER : SRCTY_IMMEDIATE;
+            if (relocs == NULL && header.mode == ADDRMD_ABSOLUTE && !a->bank)
+                header.bank = value_bank(as, a->expr);
+
+            if (header.type == SRCTY_REGISTER) {
+                v = (AsmValue) { a->reg, ASM_ABS };
             }
             else {
-                u8* pheader = (*dest)++;
-                    
-                CPU_Instr_Addr_Header header;
-                header.mode = ADDRMD_ABSOLUTE;
-                header.type = get_source(&args, dest); 
-                header.bank = bank;
-
-                *pheader = header.byte;
+                word = true;
+                // [label] lands in whatever bank the label does
+                if (v.base != ASM_ABS && header.mode == ADDRMD_ABSOLUTE && !a->bank)
+                    reloc_push(relocs, in->addr + (dest - start), RELOC_BANK, v);
             }
+            *dest++ = header.byte;
+        }
 
-            if (*args != ']')
-                return 1;
-            args ++;
+        if (v.base != ASM_ABS) {
+            reloc_push(relocs, in->addr + (dest - start), word ? RELOC_16 : RELOC_LO8, v);
+            v.val = 0;
         }
-        else {
-            CPU_Reg reg = get_reg(&args, &found);
-            if (!found)
-                return 1;
-            *(*dest)++ = reg;
+
+        *dest++ = v.val & 0xFF;
+        if (word)
+            *dest++ = (v.val >> 8) & 0xFF;
+    }
+}
+
+// a share of the instructions; sect is ASM_END for a flat image
+typedef struct {
+    const Asm* as;
+    u32 from, to;
+    u32 sect;
+    u8* dest;
+    AsmRelocs* relocs;
+    AsmRelocs own;
+} EmitJob;
+
+static void* emit_range(void* arg) {
+    EmitJob* job = arg;
+    const Asm* as = job->as;
+
+    for (u32 i = job->from; i < job->to; i ++) {
+        const AsmInstr* in = &as->instrs[i];
+        if (job->sect == ASM_END)
+            emit_instr(as, in, job->dest + as->sects[in->sect].base + in->addr, NULL);
+        else if (in->sect == job->sect)
+            emit_instr(as, in, job->dest + in->addr, job->relocs);
+    }
+    return NULL;
+}
+
+// every instruction lands at an address fixed by asm_link, so the shares
+// write apart; their relocations are joined back in instruction order
+static void emit_split(const Asm* as, u32 sect, u8* dest, AsmRelocs* relocs) {
+    u32 from = 0;
+    u32 to = as->count;
+    if (sect != ASM_END) {
+        from = as->sects[sect].from;
+        to = as->sects[sect].to;
+    }
+
+    u32 n = job_count(as->jobs, (to - from) / ASM_EMIT_MIN);
+    EmitJob* jobs = calloc(n, sizeof(EmitJob));
+
+    for (u32 i = 0; i < n; i ++) {
+        jobs[i] = (EmitJob) {
+            .as = as,
+            .from = from + (u64) (to - from) * i / n,
+            .to = from + (u64) (to - from) * (i + 1) / n,
+            .sect = sect,
+            .dest = dest,
+        };
+        jobs[i].relocs = i == 0 ? relocs : &jobs[i].own;
+    }
+
+    run_jobs(emit_range, jobs, sizeof(EmitJob), n);
+
+    for (u32 i = 1; i < n && relocs != NULL; i ++) {
+        const AsmRelocs* own = &jobs[i].own;
+        if (own->len == 0)
+            continue;
+        if (relocs->len + own->len > relocs->cap) {
+            relocs->cap = relocs->len + own->len;
+            relocs->data = realloc(relocs->data, relocs->cap * sizeof(AsmReloc));
         }
+        memcpy(relocs->data + relocs->len, own->data, own->len * sizeof(AsmReloc));
+        relocs->len += own->len;
+        free(own->data);
+    }
+    free(jobs);
+}
+
+void asm_emit(const Asm* as, u8* dest) {
+    emit_split(as, ASM_END, dest, NULL);
+}
+
+void asm_emit_sect(const Asm* as, u32 id, u8* dest, AsmRelocs* relocs) {
+    emit_split(as, id, dest, relocs);
+}
+
+int asm_emit_to(const Asm* as, AsmSink* sink) {
+    if (sink->limit != 0 && sink->len + as->size > sink->limit)
+        return 1;
+
+    // a section never outgrows its bank
+    u8* window = malloc(0x10000);
+    int status = 0;
+    for (u32 i = 0; i < as->nsects && status == 0; i ++) {
+        const AsmSect* sect = &as->sects[i];
+        if (sect->size == 0)
+            continue;
+        emit_split(as, i, window, NULL);
+        status = sink->write(sink, sect->bank, sect->addr, window, sect->size);
+        sink->len += sect->size;
+    }
+    free(window);
+    return status;
+}
+
+static void buf_reserve(AsmBuf* buf, size_t len) {
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len)
+            cap *= 2;
+        buf->data = realloc(buf->data, cap);
+        buf->cap = cap;
     }
+}
 
+static int buf_write(AsmSink* sink, su4 bank, u16 addr, const u8* data, u32 len) {
+    AsmBuf* buf = sink->ctx;
+    buf_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
     return 0;
 }
 
+static int file_write(AsmSink* sink, su4 bank, u16 addr, const u8* data, u32 len) {
+    return fwrite(data, 1, len, sink->ctx) == len ? 0 : 1;
+}
+
+AsmSink asm_sink_buf(AsmBuf* buf, size_t limit) {
+    return (AsmSink) { .write = buf_write, .ctx = buf, .limit = limit };
+}
+
+AsmSink asm_sink_file(FILE* f, size_t limit) {
+    return (AsmSink) { .write = file_write, .ctx = f, .limit = limit };
+}
+
+size_t asm_emit_buf(const Asm* as, AsmBuf* buf) {
+    buf_reserve(buf, as->size);
+    size_t at = buf->len;
+    asm_emit(as, buf->data + at);
+    buf->len += as->size;
+    return at;
+}
+
+void asm_buf_free(AsmBuf* buf) {
+    free(buf->data);
+    *buf = (AsmBuf) {0};
+}
+
+static const char bit_rep[16][4] = {
+    "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+    "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111",
+};
+
+void asm_list(const Asm* as, const u8* image, FILE* out) {
+    const char* p = as->src;
+    const char* end = as->src + as->src_len;
+    u32 at = 0;
+
+    for (u32 line = 1; p < end; line ++) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* next = nl != NULL ? nl + 1 : end;
+        fwrite(p, 1, next - p, out);
+        fputs("   ", out);
+
+        for (; at < as->count && as->instrs[at].line == line; at ++) {
+            const AsmInstr* in = &as->instrs[at];
+            for (u32 b = 0; b < in->size; b ++) {
+                u8 byte = image[as->sects[in->sect].base + in->addr + b];
+                char text[9];
+                memcpy(text, bit_rep[byte >> 4], 4);
+                memcpy(text + 4, bit_rep[byte & 0x0F], 4);
+                text[8] = ' ';
+                fwrite(text, 1, 9, out);
+            }
+        }
+        fputc('\n', out);
+        p = next;
+    }
+}
+
+void asm_map(const Asm* as, FILE* out) {
+    fprintf(out, "bank  start   end       size  section\n");
+    for (u32 i = 0; i < as->nsects; i ++) {
+        const AsmSect* s = &as->sects[i];
+        if (s->size != 0)
+            fprintf(out, "%4u  0x%04X  0x%04X  %6u  %.*s\n",
+                    s->bank, s->addr, s->addr + s->size - 1, s->size, (int) s->len, s->name);
+    }
+
+    // what is left above each bank's highest byte in use
+    u32 top[16] = {0};
+    bool used[16] = {0};
+    fprintf(out, "\n%u bytes in %u segment%s\n", as->size, as->nsegs, as->nsegs == 1 ? "" : "s");
+    for (u32 i = 0; i < as->nsegs; i ++) {
+        const AsmSeg* g = &as->segs[i];
+        fprintf(out, "  bank %u 0x%04X - 0x%04X  at %u in the image\n",
+                g->bank, g->addr, g->addr + g->size - 1, g->offset);
+        used[g->bank] = true;
+        if (g->addr + g->size > top[g->bank])
+            top[g->bank] = g->addr + g->size;
+    }
+    for (u32 b = 0; b < 16; b ++) {
+        if (used[b])
+            fprintf(out, "bank %u: %u bytes free above 0x%04X\n", b, 0x10000 - top[b], top[b] - 1);
+    }
+}
+
+void asm_init(Asm* as, u32 org) {
+    *as = (Asm) {
+        .org = org,
+        .table_bits = 6,
+    };
+    as->table = calloc(1u << as->table_bits, sizeof(u32));
+    sect_get(as, ".text", 5);
+}
+
+// everything but the mapping
+static void free_tables(Asm* as) {
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        if (!in_src(as, as->syms[i].name))
+            free((char*) as->syms[i].name);
+    }
+    for (u32 i = 0; i < as->nsects; i ++) {
+        if (!in_src(as, as->sects[i].name))
+            free((char*) as->sects[i].name);
+    }
+    free(as->syms);
+    free(as->table);
+    free(as->sects);
+    free(as->segs);
+    free(as->instrs);
+}
 
+void asm_free(Asm* as) {
+    free_tables(as);
+    if (as->src != NULL)
+        munmap((void*) as->src, as->src_len);
+}
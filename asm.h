@@ -1,3 +1,309 @@
+#ifndef ASM_H
+#define ASM_H
+
 #include "emu.h"
+#include "cpu.h"
+
+// two pass assembler
+//
+//   Asm as;
+//   asm_init(&as, PAGE(1));
+//   asm_line(&as, line);           // once per source line; parses, defines symbols
+//   asm_link(&as);                 // resolves symbols, picks encodings, lays out
+//   asm_emit_to(&as, &sink);       // streams the image, section by section
+//   asm_free(&as);
+//
+// or, for a whole file, asm_file instead of asm_line: it maps the source
+// and parses it where it lies. symbol names point into the mapping, which
+// stays until asm_free, and asm_list can print a listing from it
+//
+// a flat image runs from org in bank 0 unless its sections are placed;
+// as.segs says where each run of sections lands, and a sink bounds what
+// the image may take (see OUTPUT)
+//
+// with as.reloc set before the first line the result is relocatable
+// (see obj.h): labels stay section relative and undefined symbols become
+// imports, and asm_emit_sect hands out the relocations
+//
+// with as.jobs set, asm_file parses a large source in chunks and the
+// emitters split the instructions, on up to that many threads; the
+// output does not depend on it
+//
+// every call returns 0 on success; on failure as.error and as.error_line
+// say what and where
+//
+// SYNTAX
+// =====================================
+//
+// loop:                   label; the address of the next instruction
+// .equ VOICE1, 8224       constant; any expression, labels included
+// .section data           code from here on goes to section `data`;
+//                         the first section is .text
+// .section gfx @1:2       placed at bank 1, page 2 of a flat image; an
+//                         unplaced section follows the previous one
+// .global main, VOICE1    exported to other modules
+// .byte 0x80, 2, VOICE1   raw bytes, the low byte of each expression
+//
+// imm.b r0, b 20          explicit width; b / w, a blank, then an expression
+// addi.b r1, 20           the op fixes the width; b / w may be left out
+// imm r0, 20              shortest of imm.b / imm.w; also subi, andi
+// sto.b [VOICE1 + 2], r0  addresses take an expression or a register
+// lod.b r0, [w 8192]      w keeps the immediate form (see RELAXATION)
+//
+// operands are checked against the op's formats in cpu.h. fewer than it
+// takes is allowed: the cpu reads the rest from the bytes that follow
+// jmp [loop]
+//
+// expressions are numbers (decimal or 0x hex) and at most one symbol,
+// joined by + and -
+//
+// RELAXATION
+// =====================================
+//
+// imm, subi and andi get the 8 bit form when the value fits. an address
+// immediate without w becomes a register source when r0 - r7 is known
+// to hold the value: set by imm, mov or clr earlier in the same basic
+// block (a label starts a new one). forms only ever grow while relaxing,
+// so it terminates. relocatable values always take the 16 bit form
+//
+// [label] takes the bank of the label's section unless one is written
+// out, so code may jump and load across banks
+//
+// OPTIMIZER
+// =====================================
+//
+// with as.optimize set, asm_link first follows the constants in r0 - r7
+// through each basic block and
+//
+//   drops a load of what the register already holds
+//   drops a pure write (imm, mov, clr, addi, subi) overwritten unread
+//   folds addi.b on one register into the first while the sum fits
+//   loads with clr, imm.b, addi.b / subi.b from the old value or a mov
+//   from a register holding the value when that is shorter than imm
+//
+// then relaxes again, and goes back to the code as it was unless that
+// made it smaller. only values without labels or imports are
+// followed, since the layout moves those. code after an instruction
+// short of operands is left alone, since the cpu reads them out of it,
+// and so is code after a .byte. as.opt says what it did
+
+#define ASM_MAX_ARGS CPU_MAX_OPS
+
+typedef enum {
+    ARG_REG,
+    ARG_BYTE,
+    ARG_WORD,
+    ARG_IMM,    // sized by the instruction; relaxable ops only
+    ARG_ADDR,
+} AsmArgKind;
+
+typedef struct {
+    u32 sym;    // symbol index + 1; 0 for none
+    int32_t val;
+} AsmExpr;
+
+// what a value is relative to: nothing, a section start, or an import
+#define ASM_ABS         0
+#define ASM_SECT(id)    (0x80000000u | (id))
+#define ASM_IMPORT(sym) (1 + (sym))
+
+typedef struct {
+    int32_t val;
+    u32 base;
+} AsmValue;
+
+typedef enum {
+    RELOC_LO8,      // low byte of the value
+    RELOC_16,       // little endian word
+    RELOC_BANK,     // low nibble of an address header
+} AsmRelocKind;
+
+typedef struct {
+    u32 offset;     // in the section
+    u8 kind;
+    u32 base;       // ASM_SECT or ASM_IMPORT
+    int32_t addend;
+} AsmReloc;
+
+typedef struct {
+    AsmReloc* data;
+    u32 len, cap;
+} AsmRelocs;
+
+typedef struct {
+    u8 kind;
+    u8 reg;         // ARG_REG; ARG_ADDR register source
+    u8 header;      // ARG_ADDR bank and mode; the source type is set on emit
+    bool src_reg;   // ARG_ADDR source register written out in the source
+    bool fixed;     // ARG_ADDR no register holds the value; keep the immediate
+    bool bank;      // ARG_ADDR bank written out in the source
+    bool word;      // ARG_ADDR immediate written out with w; stays one
+    AsmExpr expr;
+} AsmArg;
+
+typedef struct {
+    u32 line;       // 1 based
+    u32 addr;       // offset in the section; set by asm_link
+    u8 size;        // set by asm_link
+    u8 op;
+    u8 op_w;        // 16 bit form of a relaxable op
+    bool wide;
+    bool block;     // a label points here
+    bool data;      // a .byte; args[0] is the value and there is no op
+    u8 nargs;
+    u16 sect;
+    AsmArg args[ASM_MAX_ARGS];
+} AsmInstr;
+
+typedef enum {
+    SYM_UNDEF,
+    SYM_LABEL,
+    SYM_EQU,
+} AsmSymKind;
+
+typedef struct {
+    const char* name; // into the mapped source, or owned
+    u32 len;
+    u32 hash;
+    u8 kind;
+    bool global;
+    u32 line;       // definition, or first use while undefined
+    u32 sect;       // SYM_LABEL
+    u32 instr;      // SYM_LABEL; ASM_END for the end of the section
+    u32 next;       // SYM_LABEL waiting for an instruction; index + 1
+    AsmExpr expr;   // SYM_EQU
+} AsmSym;
+
+#define ASM_END 0xFFFFFFFFu
+
+typedef struct {
+    const char* name;
+    u32 len;
+    u32 size;       // set by asm_link
+    u32 base;       // offset in the emitted image; sections are back to back
+    u32 from, to;   // its instructions lie in [from, to); set by asm_link
+    u32 pending;    // labels waiting for the next instruction; index + 1
+    bool placed;    // by .section name @bank:page
+    u32 line;       // of the placement
+    su4 bank;       // where it runs in a flat image; set by asm_link
+    u32 addr;
+} AsmSect;
+
+// a run of sections back to back in both the image and a bank
+typedef struct {
+    su4 bank;
+    u32 addr;
+    u32 size;
+    u32 offset;     // in the emitted image
+} AsmSeg;
+
+typedef struct {
+    u32 removed;    // instructions, folded ones included
+    u32 folded;     // addi.b merged into an earlier one
+    u32 rewritten;  // loads given a shorter form
+    int32_t saved;  // bytes; never below 0, -O falls back to the code as it was
+} AsmOptStats;
+
+typedef struct {
+    u32 org;
+
+    AsmInstr* instrs;
+    u32 count, cap;
+
+    AsmSym* syms;
+    u32 nsyms, sym_cap;
+    u32* table;     // open addressing; symbol index + 1
+    u32 table_bits;
+
+    AsmSect* sects;
+    u32 nsects, sect_cap;
+    u32 sect;       // current
+
+    bool reloc;
+    u32 jobs;       // threads for asm_file and the emitters; 0 or 1 for none
+    bool optimize;
+    AsmOptStats opt;
+    u32 line;
+    u32 size;       // of the emitted image
+    AsmSeg* segs;   // flat images; set by asm_link
+    u32 nsegs;
+
+    const char* src;  // mapped by asm_file
+    size_t src_len;
+
+    const char* error;
+    u32 error_line;
+} Asm;
+
+// growable output
+typedef struct {
+    u8* data;
+    size_t len, cap;
+} AsmBuf;
+
+// OUTPUT
+// =====================================
+//
+// asm_emit_to hands the image of a flat module to a sink one section at a
+// time, through a buffer no larger than a bank, so only the sink decides
+// how much of it is ever held. a sink with a limit refuses an image larger
+// than that before anything is written
+//
+//   AsmBuf buf = {0};
+//   AsmSink sink = asm_sink_buf(&buf, PAGE(4));
+//   if (asm_emit_to(&as, &sink) != 0)
+//       ...                        // too large, or the sink failed
+
+typedef struct AsmSink AsmSink;
+struct AsmSink {
+    // len bytes that run at bank:addr, in image order; nonzero stops
+    int (*write)(AsmSink* sink, su4 bank, u16 addr, const u8* data, u32 len);
+    void* ctx;
+    size_t limit;   // bytes it takes at most; 0 for no limit
+    size_t len;     // taken so far
+};
+
+void asm_init(Asm* as, u32 org);
+void asm_free(Asm* as);
+int asm_line(Asm* as, const char* src);
+int asm_file(Asm* as, const char* path);
+int asm_link(Asm* as);
+int asm_emit_to(const Asm* as, AsmSink* sink);
+
+// appends to buf, or writes to f
+AsmSink asm_sink_buf(AsmBuf* buf, size_t limit);
+AsmSink asm_sink_file(FILE* f, size_t limit);
+
+// the whole image in one go; dest takes as.size bytes
+void asm_emit(const Asm* as, u8* dest);
+
+// one section of a relocatable module; dest takes sects[id].size bytes
+void asm_emit_sect(const Asm* as, u32 id, u8* dest, AsmRelocs* relocs);
+AsmValue asm_value(const Asm* as, const AsmSym* s);
+
+// appends the image; returns its offset in buf
+size_t asm_emit_buf(const Asm* as, AsmBuf* buf);
+void asm_buf_free(AsmBuf* buf);
+
+// each source line followed by its bytes; asm_file sources only
+void asm_list(const Asm* as, const u8* image, FILE* out);
+
+// where every section and segment of a flat image lands, and what is
+// left of each bank it uses
+void asm_map(const Asm* as, FILE* out);
+
+// seeded fnv-1a with a final mix, so the top bits depend on every
+// character; shared with asm_hash_gen.c, which picks the seeds
+static inline u32 asm_hash(u32 seed, const char* s, size_t len) {
+    u32 h = 0x811C9DC5u ^ seed;
+    for (size_t i = 0; i < len; i ++) {
+        h ^= (u8) s[i];
+        h *= 0x01000193u;
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
 
-int assemble(char* src, u8** dest);
+#endif
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "asm.h"
+
+// assembler throughput on a generated source
+//
+//   asm_bench [lines] [jobs]
+//
+// writes a relocatable source of `lines` lines (default 1M) to a temporary
+// file and assembles it with 1, 2, 4 .. `jobs` threads (default the
+// online cores, at least 2). every run has to match the serial one byte
+// for byte: section contents, relocations and symbols
+
+// cpu.c wants a bus; the assembler never runs the cpu
+u8 mread(CPU* cpu, u16 addr, su4 bank) { return 0; }
+void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {}
+
+// a new section before a section could outgrow its bank
+#define SECT_LINES 16384
+
+static double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static u32 rng = 1;
+
+static u32 next(u32 n) {
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 8) % n;
+}
+
+// labels, constants, back and forward references, imports and comments
+static void generate(FILE* f, u32 lines) {
+    u32 label = 0;
+    u32 equ = 0;
+
+    fprintf(f, ".equ SOUND, 8192\n");
+    for (u32 n = 1; n < lines; n ++) {
+        if (n % SECT_LINES == 1) {
+            fprintf(f, ".section s%u\n", n / SECT_LINES);
+            continue;
+        }
+
+        u32 r = next(100);
+        if (r < 8)
+            fprintf(f, "l%u:\n", label = n);
+        else if (r < 9 && label != 0)
+            fprintf(f, ".global l%u\n", label);
+        else if (r < 10)
+            fprintf(f, ".equ E%u, SOUND + %u\n", equ = n, next(64));
+        else if (r < 28)
+            fprintf(f, "imm r%u, %u\n", next(8), next(r < 20 ? 256 : 4096));
+        else if (r < 40)
+            fprintf(f, "sto.b [SOUND + %u], r0 ; store\n", next(96));
+        else if (r < 45)
+            fprintf(f, "; comment line\n");
+        else if (r < 50)
+            fprintf(f, "jmp [l%u]\n", n > 64 ? n - next(64) : 1);
+        else if (r < 52)
+            fprintf(f, "jmp [l%u]\n", n + next(4096));
+        else if (r < 53)
+            fprintf(f, "cal [ext%u]\n", next(16));
+        else if (r < 55 && equ != 0)
+            fprintf(f, "lod.b r2, [E%u]\n", equ);
+        else
+            fprintf(f, "addi.b r1, b %u\n", n % 256);
+    }
+}
+
+// everything asm_link decided, flattened for comparison
+static void snapshot(const Asm* as, AsmBuf* out) {
+    AsmRelocs relocs = {0};
+    size_t len = 0;
+
+    for (u32 i = 0; i < as->nsects; i ++) {
+        len += as->sects[i].size;
+        out->data = realloc(out->data, len);
+        relocs.len = 0;
+        asm_emit_sect(as, i, out->data + len - as->sects[i].size, &relocs);
+
+        // field by field; AsmReloc has padding
+        out->data = realloc(out->data, len + relocs.len * 4 * sizeof(u32));
+        for (u32 j = 0; j < relocs.len; j ++) {
+            const AsmReloc* r = &relocs.data[j];
+            u32 rec[4] = { r->offset, r->kind, r->base, r->addend };
+            memcpy(out->data + len, rec, sizeof(rec));
+            len += sizeof(rec);
+        }
+    }
+
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        const AsmSym* s = &as->syms[i];
+        AsmValue v = asm_value(as, s);
+        u32 rec[5] = { s->kind, s->global, s->line, v.val, v.base };
+        out->data = realloc(out->data, len + sizeof(rec) + s->len);
+        memcpy(out->data + len, rec, sizeof(rec));
+        memcpy(out->data + len + sizeof(rec), s->name, s->len);
+        len += sizeof(rec) + s->len;
+    }
+
+    out->len = len;
+    free(relocs.data);
+}
+
+typedef struct {
+    double parse, link, emit;
+} Times;
+
+static bool run(const char* path, u32 jobs, AsmBuf* out, Times* t) {
+    Asm as;
+    asm_init(&as, 0);
+    as.reloc = true;
+    as.jobs = jobs;
+
+    double t0 = now_ns();
+    bool ok = asm_file(&as, path) == 0;
+    double t1 = now_ns();
+    ok = ok && asm_link(&as) == 0;
+    double t2 = now_ns();
+
+    if (!ok) {
+        fprintf(stderr, "%s:%u: %s\n", path, as.error_line, as.error);
+        asm_free(&as);
+        return false;
+    }
+
+    u8* dest = malloc(0x10000);
+    AsmRelocs relocs = {0};
+    for (u32 i = 0; i < as.nsects; i ++) {
+        relocs.len = 0;
+        asm_emit_sect(&as, i, dest, &relocs);
+    }
+    double t3 = now_ns();
+    free(dest);
+    free(relocs.data);
+
+    *t = (Times) { (t1 - t0) / 1e6, (t2 - t1) / 1e6, (t3 - t2) / 1e6 };
+    if (out != NULL)
+        snapshot(&as, out);
+    asm_free(&as);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    u32 lines = 1000000;
+    if (argc > 1)
+        lines = strtoul(argv[1], NULL, 10);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_jobs = cores > 2 ? cores : 2;
+    if (argc > 2)
+        max_jobs = strtoul(argv[2], NULL, 10);
+
+    char path[] = "/tmp/asm_bench_XXXXXX";
+    int fd = mkstemp(path);
+    FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (f == NULL) {
+        perror("asm_bench");
+        return 1;
+    }
+    generate(f, lines);
+    long size = ftell(f);
+    fclose(f);
+
+    printf("source: %u lines, %.1f MB; %ld cores online\n\n", lines, size / 1e6, cores);
+    printf("  jobs    parse ms    link ms    emit ms   total ms  speedup\n");
+
+    AsmBuf serial = {0};
+    double base = 0;
+    int status = 0;
+
+    for (u32 jobs = 1; jobs <= max_jobs && status == 0; jobs *= 2) {
+        AsmBuf out = {0};
+        Times t;
+        if (!run(path, jobs, &out, &t)) {
+            status = 1;
+            break;
+        }
+
+        // best of three; the snapshot run warmed the page cache
+        for (u32 i = 0; i < 3; i ++) {
+            Times again;
+            run(path, jobs, NULL, &again);
+            if (again.parse + again.link + again.emit < t.parse + t.link + t.emit)
+                t = again;
+        }
+
+        double total = t.parse + t.link + t.emit;
+        if (jobs == 1)
+            base = total;
+        bool same = jobs == 1 || (out.len == serial.len && memcmp(out.data, serial.data, out.len) == 0);
+
+        printf("  %4u  %10.1f %10.1f %10.1f %10.1f  %6.2fx%s\n",
+               jobs, t.parse, t.link, t.emit, total, base / total, same ? "" : "  OUTPUT DIFFERS");
+        if (!same)
+            status = 1;
+
+        if (jobs == 1)
+            serial = out;
+        else
+            asm_buf_free(&out);
+    }
+
+    asm_buf_free(&serial);
+    unlink(path);
+    return status;
+}
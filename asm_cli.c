@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "asm.h"
+#include "obj.h"
+
+// command line assembler
+//
+//   asm [-c] [-l] [-m] [-O] [-j jobs] [-o out] file.asm
+//
+// writes an image that starts at bank 0, PAGE(1), where the cpu starts
+// (default file.img), with its source map next to it (file.smap);
+// sections placed elsewhere become segments of their own, and -m prints
+// where everything went. with -c it writes a relocatable object for asmlink instead
+// (default file.o) and leaves it alone while file.asm and -O are unchanged.
+// -j spreads a large source over threads; the output is the same.
+// -O runs the optimizer (see asm.h) and reports what it saved
+
+// cpu.c wants a bus; the assembler never runs the cpu
+u8 mread(CPU* cpu, u16 addr, su4 bank) { return 0; }
+void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-c] [-l] [-m] [-O] [-j jobs] [-o out] file.asm\n", name);
+    fprintf(stderr, "  -c       relocatable object; skipped while the source and -O are unchanged\n");
+    fprintf(stderr, "  -l       print the listing\n");
+    fprintf(stderr, "  -m       print the image layout\n");
+    fprintf(stderr, "  -O       optimize\n");
+    fprintf(stderr, "  -j jobs  threads for large sources\n");
+    fprintf(stderr, "  -o out   output path\n");
+}
+
+// file.asm -> file.ext
+static char* out_path(const char* src, const char* ext) {
+    size_t len = strlen(src);
+    const char* dot = strrchr(src, '.');
+    if (dot != NULL && strchr(dot, '/') == NULL)
+        len = dot - src;
+
+    char* out = malloc(len + strlen(ext) + 1);
+    memcpy(out, src, len);
+    strcpy(out + len, ext);
+    return out;
+}
+
+int main(int argc, char** argv) {
+    bool object = false;
+    bool list = false;
+    bool map = false;
+    bool optimize = false;
+    u32 jobs = 1;
+    char* out = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "cj:lmOo:")) != -1) {
+        switch (opt) {
+        case 'c':
+            object = true;
+            break;
+        case 'j':
+            jobs = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'm':
+            map = true;
+            break;
+        case 'O':
+            optimize = true;
+            break;
+        case 'o':
+            out = strdup(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* src = argv[optind];
+    if (out == NULL)
+        out = out_path(src, object ? ".o" : ".img");
+
+    if (object && !list && obj_fresh(out, src, optimize ? OBJ_OPT_OPTIMIZE : 0)) {
+        free(out);
+        return 0;
+    }
+
+    Asm as;
+    asm_init(&as, object ? 0 : PAGE(1));
+    as.reloc = object;
+    as.jobs = jobs;
+    as.optimize = optimize;
+
+    int status = asm_file(&as, src) || asm_link(&as);
+    if (status == 0 && optimize) {
+        fprintf(stderr, "%s: %u instructions removed (%u folded), %u loads shortened, %d bytes saved\n",
+                src, as.opt.removed, as.opt.folded, as.opt.rewritten, as.opt.saved);
+    }
+    if (status != 0) {
+        fprintf(stderr, "%s:%u: %s\n", src, as.error_line, as.error);
+    }
+    else if (object) {
+        status = obj_write(&as, src, out);
+    }
+    else {
+        if (list) {
+            AsmBuf buf = {0};
+            asm_emit_buf(&as, &buf);
+            asm_list(&as, buf.data, stdout);
+            asm_buf_free(&buf);
+        }
+        if (map)
+            asm_map(&as, stdout);
+        char* map = obj_map_path(out);
+        status = obj_write_image(&as, out) || obj_write_map(&as, src, map);
+        free(map);
+    }
+
+    asm_free(&as);
+    free(out);
+    return status;
+}
@@ -0,0 +1,33 @@
+// generated by asm_hash_gen.c from the name tables in cpu.c; do not edit
+//
+// slot[asm_hash(SEED, name, len) >> (32 - BITS)] is the only candidate
+// for a name; 0xFF is empty
+
+// mnemonics: 55 names in 128 slots
+#define ASM_INSTR_SEED 0x00053BEDu
+#define ASM_INSTR_BITS 7
+
+static const u8 asm_instr_slot[1 << ASM_INSTR_BITS] = {
+    0xFF, 0x50, 0x47, 0xFF, 0x08, 0xFF, 0xFF, 0x15, 0x30, 0xFF, 0x41, 0xFF,
+    0x33, 0xFF, 0xFF, 0x63, 0xFF, 0x02, 0xFF, 0x04, 0xFF, 0x2D, 0x55, 0xFF,
+    0xFF, 0xFF, 0xFF, 0x2A, 0xFF, 0x07, 0x42, 0xFF, 0x28, 0x0D, 0x64, 0x60,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x65, 0xFF, 0xFF, 0xFF, 0xFF, 0x05, 0xFF,
+    0x45, 0x03, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x43, 0x66, 0xFF, 0xFF,
+    0x52, 0xFF, 0x11, 0xFF, 0xFF, 0xFF, 0x62, 0xFF, 0xFF, 0x54, 0xFF, 0xFF,
+    0x06, 0x31, 0xFF, 0x12, 0xFF, 0x00, 0xFF, 0x09, 0xFF, 0x0E, 0xFF, 0x0A,
+    0xFF, 0x0C, 0x10, 0xFF, 0xFF, 0x40, 0xFF, 0xFF, 0x13, 0xFF, 0xFF, 0xFF,
+    0x24, 0xFF, 0xFF, 0x29, 0x20, 0xFF, 0xFF, 0xFF, 0x53, 0x51, 0x22, 0xFF,
+    0x01, 0xFF, 0x61, 0x23, 0xFF, 0x27, 0xFF, 0xFF, 0xFF, 0x67, 0xFF, 0x21,
+    0xFF, 0x2B, 0xFF, 0x14, 0xFF, 0xFF, 0x32, 0xFF,
+};
+
+// registers: 22 names in 32 slots
+#define ASM_REG_SEED 0x00000C0Eu
+#define ASM_REG_BITS 5
+
+static const u8 asm_reg_slot[1 << ASM_REG_BITS] = {
+    0xFF, 0x09, 0xFF, 0x07, 0xFF, 0x04, 0x10, 0x11, 0x0A, 0xFF, 0xFF, 0x08,
+    0x17, 0x02, 0xFF, 0x14, 0x05, 0x06, 0x16, 0xFF, 0x01, 0x12, 0x00, 0x13,
+    0x03, 0x15, 0xFF, 0xFF, 0xFF, 0x0D, 0x0C, 0x0B,
+};
+
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "asm.h"
+
+// writes asm_hash.h: perfect hash tables for the mnemonics and register
+// names in cpu.c
+//
+//   asm_hash_gen > asm_hash.h
+//
+// for each table it looks for the smallest power of two and a seed that
+// put every name in its own slot
+
+#define MAX_BITS  10
+#define MAX_SEEDS (1 << 22)
+
+// cpu.c wants a bus; the generator never runs the cpu
+u8 mread(CPU* cpu, u16 addr, su4 bank) { return 0; }
+void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {}
+
+static bool try_seed(const char** names, size_t count, u32 seed, u32 bits, u8* slot) {
+    memset(slot, 0xFF, 1u << bits);
+
+    for (size_t i = 0; i < count; i ++) {
+        if (names[i] == NULL)
+            continue;
+        u32 h = asm_hash(seed, names[i], strlen(names[i])) >> (32 - bits);
+        if (slot[h] != 0xFF)
+            return false;
+        slot[h] = i;
+    }
+    return true;
+}
+
+static int emit(const char* prefix, const char* table, const char* what, const char** names, size_t count) {
+    static u8 slot[1 << MAX_BITS];
+
+    size_t used = 0;
+    for (size_t i = 0; i < count; i ++)
+        used += names[i] != NULL;
+
+    for (u32 bits = 1; bits <= MAX_BITS; bits ++) {
+        if ((1u << bits) < used)
+            continue;
+
+        for (u32 seed = 1; seed < MAX_SEEDS; seed ++) {
+            if (!try_seed(names, count, seed, bits, slot))
+                continue;
+
+            printf("// %s: %zu names in %u slots\n", what, used, 1u << bits);
+            printf("#define %s_SEED 0x%08Xu\n", prefix, seed);
+            printf("#define %s_BITS %u\n\n", prefix, bits);
+            printf("static const u8 %s[1 << %s_BITS] = {", table, prefix);
+            for (u32 i = 0; i < (1u << bits); i ++)
+                printf("%s0x%02X,", i % 12 == 0 ? "\n    " : " ", slot[i]);
+            printf("\n};\n\n");
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "no perfect hash for %s\n", what);
+    return 1;
+}
+
+int main() {
+    printf("// generated by asm_hash_gen.c from the name tables in cpu.c; do not edit\n");
+    printf("//\n");
+    printf("// slot[asm_hash(SEED, name, len) >> (32 - BITS)] is the only candidate\n");
+    printf("// for a name; 0xFF is empty\n\n");
+
+    int status = 0;
+    status |= emit("ASM_INSTR", "asm_instr_slot", "mnemonics", cpu_instr_names, INSTR_LEN);
+    status |= emit("ASM_REG", "asm_reg_slot", "registers", cpu_reg_names, REG_LEN);
+    return status;
+}
@@ -0,0 +1,511 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "asm.h"
+#include "dis.h"
+#include "obj.h"
+
+// assembler checks; each case assembles two sources that must come out as
+// the same bytes, each optimizer case a source under -O and what it must
+// come out as without, each link case two modules that asmlink must put
+// together as the one flat source would come out, each error case a
+// source the assembler must refuse, and each round trip a source that
+// must still be the same bytes after dis and asm again. placement, the
+// sink limit and the source map lookups are checked on their own. exits
+// 1 if any fails
+
+// cpu.c wants a bus; the assembler never runs the cpu
+u8 mread(CPU* cpu, u16 addr, su4 bank) { return 0; }
+void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {}
+
+typedef struct {
+    const char* name;
+    const char* src;
+    const char* same;   // spelled out
+} AsmCase;
+
+static const AsmCase cases[] = {
+    { "width prefix",
+      "imm.b r0, b 20\nimm.w r1, w 20",
+      "imm.b r0, 20\nimm.w r1, 20" },
+    { "symbols named like a width",
+      "b1:\nimm.w r1, b1\nw_x:\nimm.w r2, w_x\nimm.w r3, b1 + 2",
+      "imm.w r1, 0x1000\nimm.w r2, 0x1004\nimm.w r3, 0x1002" },
+    { "address symbols named like a width",
+      "nop\nw1:\njmp [w1]\nw_x:\nlod.b r0, [w_x + 1]\njmp [w 0x2000]",
+      "nop\njmp [w 0x1001]\nlod.b r0, [w 0x1006]\njmp [0x2000]" },
+    { ".byte",
+      ".equ R0, 0x10\nstart:\n.byte 2, R0 + 0x100\n.byte start - 0x1000 + 5",
+      "imm.b r0, 5" },
+    { "pc offsets keep the immediate",
+      "imm.b r0, 5\njmp [pc + 5]\nimm.b r1, 2\nlod.b r2, [pc - 2]",
+      "imm.b r0, 5\njmp [pc + w 5]\nimm.b r1, 2\nlod.b r2, [pc - w 2]" },
+};
+
+static const AsmCase opt_cases[] = {
+    { "load of what is there",
+      "imm.w r1, 0x1234\nsto.w [0x3000], r1\nimm.w r1, 0x1234\nsto.w [0x3002], r1",
+      "imm.w r1, 0x1234\nsto.w [0x3000], r1\nsto.w [0x3002], r1" },
+    { "write nobody reads",
+      "imm.w r1, 0x1234\nimm.w r1, 0x4321\nsto.w [0x3000], r1",
+      "imm.w r1, 0x4321\nsto.w [0x3000], r1" },
+    { "addi.b folding",
+      "lod.w r2, [0x3000]\naddi.b r2, 1\naddi.b r2, 2\naddi.b r2, 0\nsto.w [0x3000], r2",
+      "lod.w r2, [0x3000]\naddi.b r2, 3\nsto.w [0x3000], r2" },
+    { "clr",
+      "imm.w r3, 0\nsto.w [0x3000], r3",
+      "clr r3\nsto.w [0x3000], r3" },
+    { "imm.b",
+      "imm.w r3, 0x12\nsto.w [0x3000], r3",
+      "imm.b r3, 0x12\nsto.w [0x3000], r3" },
+    { "addi.b and subi.b from the old value",
+      "imm.w r3, 0x1234\nsto.w [0x3000], r3\nimm.w r3, 0x1240\nsto.w [0x3000], r3\n"
+      "imm.w r3, 0x1238\nsto.w [0x3000], r3",
+      "imm.w r3, 0x1234\nsto.w [0x3000], r3\naddi.b r3, 0x0C\nsto.w [0x3000], r3\n"
+      "subi.b r3, 8\nsto.w [0x3000], r3" },
+    { "mov",
+      "imm.w r4, 0x1234\nimm.w r5, 0x1234\nsto.w [0x3000], r4\nsto.w [0x3000], r5",
+      "imm.w r4, 0x1234\nmov r5, r4\nsto.w [0x3000], r4\nsto.w [0x3000], r5" },
+    { "relaxed address reads its register",
+      "imm.w r0, 0x2000\nlod.b r1, [0x2000]\nimm.b r0, 5\nsto.b [0x3000], r0\nsto.b [0x3001], r1",
+      "imm.w r0, 0x2000\nlod.b r1, [0x2000]\nimm.b r0, 5\nsto.b [0x3000], r0\nsto.b [0x3001], r1" },
+    // dropping the second load would cost each address its register
+    { "never grows",
+      "imm.w r0, 0x1FFF\naddi.b r0, 1\nimm.w r0, 0x2000\nlod.b r1, [0x2000]\nlod.b r2, [0x2000]\n"
+      "lod.b r3, [0x2000]\nlod.b r4, [0x2000]\nlod.b r5, [0x2000]",
+      "imm.w r0, 0x1FFF\naddi.b r0, 1\nimm.w r0, 0x2000\nlod.b r1, [0x2000]\nlod.b r2, [0x2000]\n"
+      "lod.b r3, [0x2000]\nlod.b r4, [0x2000]\nlod.b r5, [0x2000]" },
+};
+
+// the second module goes to bank 1, page 2; same is NULL when the link
+// must fail
+typedef struct {
+    const char* name;
+    const char* mods[2];
+    const char* same;
+} LinkCase;
+
+static const LinkCase link_cases[] = {
+    { "relocations",
+      { ".global start\nstart:\nimm.b r0, data\nimm.w r1, data\nimm r2, data + 1\njmp [next]\n",
+        ".global next, data\nnext:\nlod.b r3, [data]\njmp [start]\ndata:\n.byte 7, data\n" },
+      "start:\nimm.b r0, data\nimm.w r1, data\nimm r2, data + 1\njmp [next]\n"
+      ".section b @1:2\nnext:\nlod.b r3, [data]\njmp [start]\ndata:\n.byte 7, data\n" },
+    { "duplicate global",
+      { ".global x\nx:\nnop\n", ".global x\nx:\nnop\n" },
+      NULL },
+    { "undefined symbol",
+      { "jmp [nowhere]\n", "nop\n" },
+      NULL },
+};
+
+// sources asm_link must refuse, with the error and the line it names
+typedef struct {
+    const char* name;
+    const char* src;
+    const char* error;
+    u32 line;
+} AsmError;
+
+static const AsmError errors[] = {
+    { "sections on top of each other",
+      ".section a @0:2\nnop\nnop\n.section b @0:2\nnop",
+      "section overlaps another", 4 },
+    { "placed on the unplaced one",
+      ".section a\nnop\nnop\n.section b @0:1\nnop",
+      "section overlaps another", 4 },
+    { "placed twice",
+      ".section a @0:2\nnop\n.section a @0:3",
+      "section placed twice", 3 },
+    { "no such bank",
+      ".section a @16:2",
+      "placement is @bank:page, both 0 - 15", 1 },
+};
+
+// data among the code, and an instruction cut off at the end
+static const char* round_trips[] = {
+    "imm.b r0, 1\n.byte 0x80\nlod.b r1, [w 0x2000]\n.byte 0xFF, 0, 2",
+    "imm.w r2, 0x1234\n.byte 3",
+};
+
+// lines of src, one by one, then asm_link
+static int parse(Asm* as, const char* src, bool optimize) {
+    asm_init(as, PAGE(1));
+    as->optimize = optimize;
+
+    char line[256];
+    int status = 0;
+    for (const char* p = src; status == 0 && *p != 0; ) {
+        size_t n = strcspn(p, "\n");
+        memcpy(line, p, n);
+        line[n] = 0;
+        status = asm_line(as, line);
+        p += n + (p[n] == '\n');
+    }
+    if (status == 0)
+        status = asm_link(as);
+    return status;
+}
+
+// NULL on an error
+static u8* assemble(const char* src, size_t* len, bool optimize) {
+    Asm as;
+    int status = parse(&as, src, optimize);
+
+    AsmBuf buf = {0};
+    AsmSink sink = asm_sink_buf(&buf, 0);
+    if (status == 0)
+        status = asm_emit_to(&as, &sink);
+    if (status != 0) {
+        fprintf(stderr, "  line %u: %s\n", as.error_line, as.error);
+        asm_buf_free(&buf);
+        asm_free(&as);
+        return NULL;
+    }
+
+    asm_free(&as);
+    *len = buf.len;
+    return buf.data;
+}
+
+static bool same(const u8* a, size_t a_len, const u8* b, size_t b_len) {
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+// what a sink was handed, section by section
+typedef struct {
+    su4 bank;
+    u16 addr;
+    u32 len;
+} Landed;
+
+static Landed landed[8];
+static u32 nlanded;
+
+static int record(AsmSink* sink, su4 bank, u16 addr, const u8* data, u32 len) {
+    if (nlanded == 8)
+        return 1;
+    landed[nlanded ++] = (Landed) { bank, addr, len };
+    return 0;
+}
+
+// unplaced sections follow the previous one, placed ones go where they
+// say, and back to back ones in a bank make one segment
+static bool placement(void) {
+    static const Landed want[] = {
+        { 0, PAGE(1), 1 }, { 1, PAGE(2), 2 }, { 1, PAGE(2) + 2, 1 }, { 0, PAGE(3), 1 },
+    };
+    Asm as;
+    int status = parse(&as, "nop\n.section b @1:2\nnop\nnop\n.section c\nnop\n"
+                            ".section d @0:3\nnop", false);
+    AsmSink sink = { record };
+    nlanded = 0;
+    if (status == 0)
+        status = asm_emit_to(&as, &sink);
+
+    bool ok = status == 0 && as.nsegs == 3 && nlanded == 4;
+    for (u32 i = 0; ok && i < nlanded; i ++)
+        ok = landed[i].bank == want[i].bank && landed[i].addr == want[i].addr && landed[i].len == want[i].len;
+    asm_free(&as);
+    return ok;
+}
+
+// a bank's worth and then some, from page 15
+static bool past_the_bank(void) {
+    size_t cap = 64 * 1024;
+    char* src = malloc(cap);
+    size_t len = snprintf(src, cap, ".section a @0:15\n");
+    for (u32 i = 0; i < 65; i ++) {
+        len += snprintf(src + len, cap - len, ".byte 0");
+        for (u32 j = 1; j < 64; j ++)
+            len += snprintf(src + len, cap - len, ", 0");
+        len += snprintf(src + len, cap - len, "\n");
+    }
+
+    Asm as;
+    bool ok = parse(&as, src, false) != 0 && as.error != NULL &&
+              strcmp(as.error, "section runs past the end of its bank") == 0 && as.error_line == 1;
+    asm_free(&as);
+    free(src);
+    return ok;
+}
+
+// a sink with a limit takes an image that fits it and refuses a larger
+// one before anything is written
+static bool sink_limit(void) {
+    Asm as;
+    bool ok = parse(&as, "nop\nnop\n.section b @1:2\nnop", false) == 0;
+
+    AsmBuf small = {0}, exact = {0};
+    AsmSink refuses = asm_sink_buf(&small, 2);
+    AsmSink takes = asm_sink_buf(&exact, 3);
+    ok = ok && asm_emit_to(&as, &refuses) != 0 && small.len == 0 && refuses.len == 0 &&
+         asm_emit_to(&as, &takes) == 0 && exact.len == 3;
+
+    asm_buf_free(&small);
+    asm_buf_free(&exact);
+    asm_free(&as);
+    return ok;
+}
+
+// what the source map says about one address; line 0 and NULL for none
+typedef struct {
+    su20 addr;
+    u32 line;
+    const char* label;
+    const char* where;
+} MapCase;
+
+static const char* map_src =
+    "start:\n"
+    "nop\n"                    // 0:1000
+    "loop:\n"
+    "imm.w r0, 0x1234\n"       // 0:1001 - 1004
+    "jmp [loop]\n"             // 0:1005 - 1008
+    ".section hi @1:2\n"
+    "nop\n"                    // 1:2000
+    "far:\n"
+    "nop";                     // 1:2001
+
+static const MapCase map_cases[] = {
+    { MK20(0, 0x0FFF), 0, NULL,    "0:0FFF" },
+    { MK20(0, 0x1000), 2, "start", "t.asm:2 start" },
+    { MK20(0, 0x1001), 4, "loop",  "t.asm:4 loop" },
+    { MK20(0, 0x1003), 4, "loop",  "t.asm:4 loop+2" },
+    { MK20(0, 0x1008), 5, "loop",  "t.asm:5 loop+7" },
+    { MK20(0, 0x1009), 0, "loop",  "0:1009 loop+8" },
+    // the label before is in bank 0
+    { MK20(1, 0x1FFF), 0, NULL,    "1:1FFF" },
+    { MK20(1, 0x2000), 7, NULL,    "t.asm:7" },
+    { MK20(1, 0x2001), 9, "far",   "t.asm:9 far" },
+    { MK20(1, 0x2002), 0, "far",   "1:2002 far+1" },
+    { MK20(2, 0x0000), 0, NULL,    "2:0000" },
+};
+
+static bool map_lookups(void) {
+    Asm as;
+    if (parse(&as, map_src, false) != 0)
+        return false;
+    ObjMap map;
+    obj_map_build(&map, &as, "t.asm");
+    asm_free(&as);
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(map_cases) / sizeof(*map_cases); i ++) {
+        const MapCase* c = &map_cases[i];
+        const ObjMapLine* line = obj_map_line(&map, c->addr);
+        const ObjMapLabel* label = obj_map_label(&map, c->addr);
+        char where[64];
+        obj_map_where(&map, c->addr, where, sizeof(where));
+
+        bool hit = (line != NULL ? line->line : 0) == c->line &&
+                   (label == NULL ? c->label == NULL :
+                    c->label != NULL && label->name_len == strlen(c->label) &&
+                    memcmp(obj_map_name(&map, label->name), c->label, label->name_len) == 0) &&
+                   strcmp(where, c->where) == 0;
+        if (!hit) {
+            printf("  %X:%04X: %s\n", c->addr >> 16, c->addr & 0xFFFF, where);
+            ok = false;
+        }
+    }
+
+    // cut to the buffer, and the length says so
+    char where[6];
+    ok = ok && obj_map_where(&map, MK20(0, 0x1003), where, sizeof(where)) == 5 && strcmp(where, "t.asm") == 0;
+
+    obj_map_close(&map);
+    return ok;
+}
+
+// modules go through files, the way asm -c and asmlink see them
+static char dir[] = "/tmp/asm_test.XXXXXX";
+static const char* files[] = { "a.asm", "a.o", "b.asm", "b.o", "same.asm", "same.img", "linked.img", "linked.smap" };
+
+// dir/name.asm to dir/name.o, or to dir/name.img without reloc
+static int build(const char* name, const char* src, bool reloc) {
+    char path[64], out[64];
+    snprintf(path, sizeof(path), "%s/%s.asm", dir, name);
+    snprintf(out, sizeof(out), "%s/%s%s", dir, name, reloc ? ".o" : ".img");
+
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return 1;
+    fputs(src, f);
+    fclose(f);
+
+    Asm as;
+    asm_init(&as, reloc ? 0 : PAGE(1));
+    as.reloc = reloc;
+    int status = asm_file(&as, path) || asm_link(&as);
+    if (status != 0)
+        fprintf(stderr, "  %s line %u: %s\n", name, as.error_line, as.error);
+    else
+        status = reloc ? obj_write(&as, path, out) : obj_write_image(&as, out);
+    asm_free(&as);
+    return status;
+}
+
+// a.o at bank 0, PAGE(1), b.o at bank 1, page 2; a failure expected
+// keeps the linker's message off stderr
+static int link_pair(bool quiet) {
+    char a[64], b[64], img[64];
+    snprintf(a, sizeof(a), "%s/a.o", dir);
+    snprintf(b, sizeof(b), "%s/b.o", dir);
+    snprintf(img, sizeof(img), "%s/linked.img", dir);
+    ObjInput in[2] = { { a }, { b, true, 1, PAGE(2) } };
+
+    int err = dup(2);
+    if (quiet) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 2);
+        close(null);
+    }
+    int status = obj_link(in, 2, img);
+    fflush(stderr);
+    dup2(err, 2);
+    close(err);
+    return status;
+}
+
+static bool same_image(void) {
+    char a[64], b[64];
+    snprintf(a, sizeof(a), "%s/linked.img", dir);
+    snprintf(b, sizeof(b), "%s/same.img", dir);
+
+    ObjImage x, y;
+    if (obj_image_open(&x, a) != 0)
+        return false;
+    if (obj_image_open(&y, b) != 0) {
+        obj_image_close(&x);
+        return false;
+    }
+
+    bool ok = x.nsegs == y.nsegs;
+    for (u32 i = 0; ok && i < x.nsegs; i ++) {
+        const ObjSegment* s = &x.segs[i];
+        const ObjSegment* t = &y.segs[i];
+        ok = s->bank == t->bank && s->addr == t->addr && s->size == t->size &&
+             memcmp(obj_image_data(&x, i), obj_image_data(&y, i), s->size) == 0;
+    }
+    obj_image_close(&x);
+    obj_image_close(&y);
+    return ok;
+}
+
+int main() {
+    int status = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i ++) {
+        const AsmCase* c = &cases[i];
+        size_t len, want_len;
+        u8* got = assemble(c->src, &len, false);
+        u8* want = assemble(c->same, &want_len, false);
+
+        if (got == NULL || want == NULL || !same(got, len, want, want_len)) {
+            printf("%s: failed\n", c->name);
+            status = 1;
+        }
+        free(got);
+        free(want);
+    }
+
+    for (size_t i = 0; i < sizeof(opt_cases) / sizeof(*opt_cases); i ++) {
+        const AsmCase* c = &opt_cases[i];
+        size_t len, want_len, plain_len;
+        u8* got = assemble(c->src, &len, true);
+        u8* want = assemble(c->same, &want_len, false);
+        u8* plain = assemble(c->src, &plain_len, false);
+
+        if (got == NULL || want == NULL || plain == NULL || !same(got, len, want, want_len) ||
+            len > plain_len) {
+            printf("-O %s: failed\n", c->name);
+            status = 1;
+        }
+        free(got);
+        free(want);
+        free(plain);
+    }
+
+    for (size_t i = 0; i < sizeof(errors) / sizeof(*errors); i ++) {
+        const AsmError* c = &errors[i];
+        Asm as;
+        int err = parse(&as, c->src, false);
+
+        if (err == 0 || as.error == NULL || strcmp(as.error, c->error) != 0 || as.error_line != c->line) {
+            printf("error %s: failed\n", c->name);
+            status = 1;
+        }
+        asm_free(&as);
+    }
+
+    if (!placement()) {
+        printf("placement: failed\n");
+        status = 1;
+    }
+    if (!past_the_bank()) {
+        printf("past the bank: failed\n");
+        status = 1;
+    }
+    if (!sink_limit()) {
+        printf("sink limit: failed\n");
+        status = 1;
+    }
+    if (!map_lookups()) {
+        printf("map lookups: failed\n");
+        status = 1;
+    }
+
+    bool have_dir = mkdtemp(dir) != NULL;
+    if (!have_dir) {
+        printf("link: no temporary directory\n");
+        status = 1;
+    }
+    for (size_t i = 0; have_dir && i < sizeof(link_cases) / sizeof(*link_cases); i ++) {
+        const LinkCase* c = &link_cases[i];
+        bool ok = build("a", c->mods[0], true) == 0 && build("b", c->mods[1], true) == 0;
+
+        if (ok && c->same != NULL)
+            ok = build("same", c->same, false) == 0 && link_pair(false) == 0 && same_image();
+        else if (ok)
+            ok = link_pair(true) != 0;
+
+        if (!ok) {
+            printf("link %s: failed\n", c->name);
+            status = 1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(files) / sizeof(*files); i ++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+
+    for (size_t i = 0; i < sizeof(round_trips) / sizeof(*round_trips); i ++) {
+        size_t len, again_len;
+        u8* code = assemble(round_trips[i], &len, false);
+        u8* again = NULL;
+
+        if (code != NULL) {
+            AsmBuf text = {0};
+            dis_region(code, len, MK20(0, PAGE(1)), NULL, 0, 1, &text);
+            text.data = realloc(text.data, text.len + 1);
+            text.data[text.len] = 0;
+            again = assemble((const char*) text.data, &again_len, false);
+            asm_buf_free(&text);
+        }
+
+        if (code == NULL || again == NULL || !same(code, len, again, again_len)) {
+            printf("round trip %zu: failed\n", i);
+            status = 1;
+        }
+        free(code);
+        free(again);
+    }
+
+    if (status == 0)
+        printf("asm: ok\n");
+    return status;
+}
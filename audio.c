@@ -1,115 +1,122 @@
-#include <complex.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "audio.h"
+#include "resample.h"
+#include "tap.h"
 
 #define MA_NO_DECODING
 #define MA_NO_ENCODING
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
-#define DEVICE_SAMPLE_RATE  8000
+typedef float    v4f __attribute__((vector_size(16)));
+typedef int32_t  v4i __attribute__((vector_size(16)));
+typedef uint32_t v4u __attribute__((vector_size(16)));
 
-/* ========================================================================= */
-
-void whitenoise_init() {
-    srand(time(NULL));
+static inline v4f v4f_splat(float f) {
+    return (v4f) { f, f, f, f };
 }
 
-void whitenoise_frame(ma_uint32 frameCount, float* data) {
-    for (int i = 0; i < frameCount; i ++) {
-        float accf = (((float) (uint8_t) rand()) / 127) - 1;
-        data[i] = accf;
-    }
+static inline v4f v4f_sel(v4i mask, v4f a, v4f b) {
+    return (v4f) (((v4i) a & mask) | ((v4i) b & ~mask));
 }
 
-/* ========================================================================= */
-
-typedef struct {
-    complex double state;
-    float complex ph;
-} SineChannel;
-
-void sine_init(SineChannel* sd) {}
-
-void sine_change_freq(SineChannel* sd, float fq) {
-    sd->state = 1 + 0 * I;
-    sd->ph = cexpf(-I * 2.0f * M_PI * fq / DEVICE_SAMPLE_RATE);
+static inline v4f v4f_min(v4f a, v4f b) {
+    return v4f_sel(a < b, a, b);
 }
 
-void sine_frame(SineChannel* sd, ma_uint32 frameCount, float* data) {
-    for (int i = 0; i < frameCount; ++i) {
-        // Phasor multiply
-        sd->state *= sd->ph;
-        // Take real part for cosine, or imaginary for sine
-        data[i] = crealf(sd->state);
-    }
-    // Amplitude corrections through a taylor expansion around
-    // abs(state) very close to 1
-    float g = 0.5f * (3.0f - crealf(sd->state) * crealf(sd->state) - cimagf(sd->state) * cimagf(sd->state));
-    sd->state *= g;
+static inline v4f v4f_max(v4f a, v4f b) {
+    return v4f_sel(a > b, a, b);
 }
 
-/* ========================================================================= */
-
-typedef struct {
-    float freq;
-} TriChannel;
-
-void tri_init(TriChannel* tri) {}
+static inline v4f v4f_abs(v4f a) {
+    return (v4f) ((v4i) a & 0x7FFFFFFF);
+}
 
-void tri_change_freq(TriChannel* tri, float fq) {
-    tri->freq = fq;
+// loads / stores the first `count` (1-4) lanes
+static inline v4f v4f_load(const float* p, uint32_t count) {
+    v4f v = {0};
+    if (count == 4)
+        memcpy(&v, p, sizeof(v));
+    else
+        for (uint32_t i = 0; i < count; i ++)
+            v[i] = p[i];
+    return v;
 }
 
-void tri_frame(TriChannel* tr, ma_uint32 frameCount, float* data) {
-    float period = DEVICE_SAMPLE_RATE / tr->freq;
-    for (int i = 0; i < frameCount; ++i) {
-        float t = (float)i / period;
-        data[i] = 2.0f * fabsf(2.0f * (t - floorf(t + 0.5f))) - 1.0f;
-    }
+static inline void v4f_store(float* p, v4f v, uint32_t count) {
+    if (count == 4)
+        memcpy(p, &v, sizeof(v));
+    else
+        for (uint32_t i = 0; i < count; i ++)
+            p[i] = v[i];
 }
 
 /* ========================================================================= */
 
-typedef struct {
-    float freq;
-    float active;
-} SqrChannel;
-
-void sqr_init(SqrChannel* tri) {
-    tri->active = 0;
-}
-
-void sqr_change_freq(SqrChannel* tri, float fq) {
-    tri->freq = fq;
-}
+// fixed mode reads the sine from a Q15 table: 256 points per period
+// plus a guard point, linearly interpolated
+
+#define SINE_BITS 8
+#define SINE_LEN  (1 << SINE_BITS)
+
+// round(32767 * sin(i * pi / 128)), one quarter period
+static const int16_t sine_quarter[SINE_LEN / 4 + 1] = {
+        0,   804,  1608,  2410,  3212,  4011,  4808,  5602,
+     6393,  7179,  7962,  8739,  9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767,
+};
 
-void sqar_change_wavelength(SqrChannel* sqr, float wl) {
-    sqr->active = (1 - wl) * 2 - 1;
+static int16_t sine_table_q[SINE_LEN + 1];
+static pthread_once_t sine_once = PTHREAD_ONCE_INIT;
+
+// once per process; other chips' audio threads may already be reading it
+static void sine_fill(void) {
+    const int q = SINE_LEN / 4;
+    for (int i = 0; i <= SINE_LEN; i ++) {
+        int k = i % SINE_LEN;
+        int16_t v;
+
+        if (k <= q)
+            v = sine_quarter[k];
+        else if (k <= 2 * q)
+            v = sine_quarter[2 * q - k];
+        else if (k <= 3 * q)
+            v = -sine_quarter[k - 2 * q];
+        else
+            v = -sine_quarter[4 * q - k];
+
+        sine_table_q[i] = v;
+    }
 }
 
-void sqr_frame(SqrChannel* tr, ma_uint32 frameCount, float* data) {
-    float period = DEVICE_SAMPLE_RATE / tr->freq;
-    for (int i = 0; i < frameCount; ++i) {
-        float t = (float)i / period;
-        float v = 2.0f * fabsf(2.0f * (t - floorf(t + 0.5f))) - 1.0f;
-        if (v < tr->active)
-            v = -1;
-        if (v > tr->active)
-            v = 1;
-        data[i] = v;
-    }
+void sine_init(void) {
+    pthread_once(&sine_once, sine_fill);
 }
 
 /* ========================================================================= */
 
+// envelope times are counted in samples; one register unit is one engine
+// block (1 / 53.33 s)
+#define RF_UNIT ENGINE_BLOCK
+
 typedef struct {
-    uint8_t rise;
-    float vol;
-    uint8_t fall;
-    uint8_t len;
+    uint32_t rise;
+    float    vol;
+    int32_t  vol_q;     // Q24
+    uint32_t fall;
+    uint32_t len;
 
     enum {
         STAGE_READY,
@@ -118,79 +125,150 @@ typedef struct {
         STAGE_FALL,
     } stage;
 
-    uint8_t curr_time;
-    float curr_vol;
+    uint32_t curr_time;
+    float    curr_vol;
+    int32_t  curr_q;    // Q24
 } RiseFall;
 
-// returns current volume
-float risefall_tick(RiseFall* rf) {
-    switch (rf->stage) {
-    case STAGE_READY:
-        return 0.0f;
+bool risefall_active(const RiseFall* rf) {
+    return rf->stage != STAGE_READY;
+}
 
-    case STAGE_RISE:
-        {
-            if (rf->curr_time == rf->rise) {
-                rf->curr_time = 0;
-                rf->stage = STAGE_HOLD;
-                return rf->vol;
-            }
-            float increase = rf->vol / rf->rise;
-            rf->curr_vol += increase;
-            rf->curr_time ++;
-            return rf->curr_vol;
+// moves through finished stages; returns the length of the piece of the
+// current stage that starts now (at most `left` samples)
+static uint32_t risefall_piece(RiseFall* rf, uint32_t left) {
+    for (;;) {
+        uint32_t end = 0;
+        switch (rf->stage) {
+        case STAGE_READY:
+            return left;
+        case STAGE_RISE:
+            end = rf->rise;
+            break;
+        case STAGE_HOLD:
+            end = rf->len;
+            break;
+        case STAGE_FALL:
+            end = rf->fall;
+            break;
         }
 
-    case STAGE_HOLD:
-        {
-            if (rf->curr_time == rf->len) {
-                rf->curr_time = 0;
-                rf->curr_vol = rf->vol;
-                rf->stage = STAGE_FALL;
-                return rf->vol;
-            }
-            rf->curr_time ++;
-            return rf->vol;
+        if (rf->curr_time < end) {
+            uint32_t n = end - rf->curr_time;
+            return n < left ? n : left;
         }
 
-    case STAGE_FALL:
-        {
-            if (rf->curr_time == rf->fall) {
-                rf->curr_time = 0;
-                rf->curr_vol = 0;
-                rf->stage = STAGE_READY;
-                return 0;
-            }
-            float decrease = rf->vol / rf->fall;
-            rf->curr_vol -= decrease;
-            rf->curr_time ++;
-            return rf->curr_vol;
+        rf->curr_time = 0;
+        if (rf->stage == STAGE_FALL) {
+            rf->curr_vol = 0;
+            rf->curr_q = 0;
+            rf->stage = STAGE_READY;
+        } else {
+            rf->curr_vol = rf->vol;
+            rf->curr_q = rf->vol_q;
+            rf->stage = rf->stage == STAGE_RISE ? STAGE_HOLD : STAGE_FALL;
         }
     }
 }
 
+// returns the length of the next linear piece of the envelope (at most
+// `left` samples); its gain is g + i * dg. the envelope is advanced past it
+uint32_t risefall_segment(RiseFall* rf, uint32_t left, float* g, float* dg) {
+    uint32_t n = risefall_piece(rf, left);
+
+    switch (rf->stage) {
+    case STAGE_READY:
+        *g = 0;
+        *dg = 0;
+        return n;
+    case STAGE_RISE:
+        *g = rf->curr_vol;
+        *dg = rf->vol / rf->rise;
+        break;
+    case STAGE_HOLD:
+        *g = rf->vol;
+        *dg = 0;
+        break;
+    case STAGE_FALL:
+        *g = rf->curr_vol;
+        *dg = -rf->vol / rf->fall;
+        break;
+    }
+
+    rf->curr_vol += *dg * n;
+    rf->curr_time += n;
+    return n;
+}
+
+// same as risefall_segment, in Q24
+uint32_t risefall_segment_q(RiseFall* rf, uint32_t left, int32_t* g, int32_t* dg) {
+    uint32_t n = risefall_piece(rf, left);
+
+    switch (rf->stage) {
+    case STAGE_READY:
+        *g = 0;
+        *dg = 0;
+        return n;
+    case STAGE_RISE:
+        *g = rf->curr_q;
+        *dg = rf->vol_q / (int32_t) rf->rise;
+        break;
+    case STAGE_HOLD:
+        *g = rf->vol_q;
+        *dg = 0;
+        break;
+    case STAGE_FALL:
+        *g = rf->curr_q;
+        *dg = -(rf->vol_q / (int32_t) rf->fall);
+        break;
+    }
+
+    rf->curr_q += *dg * (int32_t) n;
+    rf->curr_time += n;
+    return n;
+}
+
 void risefall_reset(RiseFall* rf) {
+    rf->rise = 0;
+    rf->vol = 0;
+    rf->vol_q = 0;
+    rf->fall = 0;
+    rf->len = 0;
+    rf->stage = STAGE_READY;
+}
+
+void risefall_reset_stage(RiseFall* rf) {
+    rf->stage = STAGE_READY;
+}
+
+// ends the beat but keeps the programmed envelope
+void risefall_stop(RiseFall* rf) {
+    rf->curr_time = 0;
+    rf->curr_vol = 0;
+    rf->curr_q = 0;
     rf->stage = STAGE_READY;
 }
 
 void risefall_trigger(RiseFall* rf) {
     rf->curr_time = 0;
     rf->curr_vol = 0;
+    rf->curr_q = 0;
     rf->stage = STAGE_RISE;
 }
 
 void risefall_write(RiseFall* rf, u8 addr, u8 val) {
     if (addr == 0) {
-        rf->rise = ((float) val) / 255;
+        rf->rise = val * RF_UNIT;
     }
     else if (addr == 1) {
         rf->vol = ((float) val) / 255;
+        rf->vol_q = (((u64) val) << 24) / 255;
     }
     else if (addr == 2) {
-        rf->len = val;
+        rf->len = val * RF_UNIT;
     }
     else if (addr == 3) {
-        rf->fall = ((float) val) / 255;
+        rf->fall = val * RF_UNIT;
     }
     else {
         assert(false);
@@ -199,57 +277,68 @@ void risefall_write(RiseFall* rf, u8 addr, u8 val) {
 
 /* ========================================================================= */
 
+// one delay line per voice, allocated with the voice
+#define ECHO_UNIT ENGINE_BLOCK
+#define ECHO_MAX  (16 * ECHO_UNIT)
+
 typedef struct {
-    RiseFall rf;
-    float    fmin;
-    float    fmax;
-} CWhiteNoiseChannel;
-
-void chwhitenoise_init(CWhiteNoiseChannel* ch) {
-    whitenoise_init();
-    risefall_reset(&ch->rf);
-    ch->fmin = -1;
-    ch->fmax = 1;
-}
-
-void chwhitenoise_frame(CWhiteNoiseChannel* ch, ma_uint32 frameCount, float* data) {
-    float level = risefall_tick(&ch->rf);
-
-    if (level > 0) {
-        whitenoise_frame(frameCount, data);
-        for (int i = 0; i < frameCount; i ++) {
-            if (data[i] < ch->fmin) {
-                data[i] = ch->fmin;
-            }
-            else if (data[i] > ch->fmax) {
-                data[i] = ch->fmax;
-            }
-        }
-    }
+    uint32_t delay;   // samples; 0 = off
+    float    level;   // wet level, also the feedback
+    int32_t  level_q; // Q4
+    uint32_t pos;
+    uint32_t tail;    // samples until the line has decayed to silence
+    uint32_t tail_len;
+
+    union {
+        float   buf[ECHO_MAX];
+        int32_t buf_q[ECHO_MAX];
+    };
+} Echo;
+
+void echo_init(Echo* e) {
+    e->delay = 0;
+    e->level = 0;
+    e->level_q = 0;
+    e->pos = 0;
+    e->tail = 0;
+    e->tail_len = 0;
+}
 
-    for (int i = 0; i < frameCount; i ++)
-        data[i] *= level;
+// silences the first `delay` samples of the line
+void echo_clear(Echo* e, uint32_t delay) {
+    memset(e->buf, 0, delay * sizeof(float));
+    e->pos = 0;
+    e->tail = 0;
 }
 
-void chwhitenoise_write(CWhiteNoiseChannel* ch, u8 addr, u8 val) {
-    if (addr == 0) {
-        risefall_trigger(&ch->rf);
-    }
-    else if (addr >= 1 && addr <= 4) {
-        risefall_write(&ch->rf, addr - 1, val);
-    }
-    else if (addr == 5) {
-        ch->fmin = ((float) val) / 127 - 1;
-    }
-    else if (addr == 6) {
-        ch->fmax = ((float) val) / 127 - 1;
-    }
-    else if (addr == 7) {
-        // reserved
-    }
-    else {
-        assert(false);
+// repeats until the echo is below -60dB, ceil(log(1e-3) / log(n / 16));
+// a table so fixed mode does not depend on libm
+static const uint8_t echo_repeats[16] = {
+    0, 3, 4, 5, 5, 6, 8, 9, 10, 13, 15, 19, 25, 34, 52, 108,
+};
+
+// hi nibble: delay in (n + 1) / 53.33 s; lo nibble: intensity in 1/16
+void echo_write(Echo* e, u8 val) {
+    uint32_t delay = ((val >> 4) + 1) * ECHO_UNIT;
+    float level = ((float) (val & 0xF)) / 16;
+
+    if (level == 0) {
+        e->delay = 0;
+        e->level = 0;
+        e->level_q = 0;
+        e->tail = 0;
+        return;
     }
+
+    // a line that was off or had another length holds nothing to repeat
+    if (e->delay == 0 || delay != e->delay)
+        echo_clear(e, delay);
+
+    e->delay = delay;
+    e->level = level;
+    e->level_q = val & 0xF;
+
+    e->tail_len = echo_repeats[val & 0xF] * delay;
 }
 
 /* ========================================================================= */
@@ -259,239 +348,1488 @@ static float frequencies[NUM_FREQ] = {
 9.166667, 9.711745, 10.289235, 10.901066, 11.549275, 12.236032, 12.963624, 13.734482, 13.750000, 14.551177, 14.567617, 15.416434, 15.433853, 16.333143, 16.351599, 17.304361, 17.323914, 18.333334, 18.354048, 19.423491, 19.445436, 20.578470, 20.601723, 21.802132, 21.826765, 23.098551, 23.124651, 24.472063, 24.499714, 25.927248, 25.956543, 27.468964,27.500000, 27.500000, 29.102354, 29.135235, 29.135235, 30.832869, 30.867706, 30.867706, 32.666286, 32.703197, 32.703197, 34.608723, 34.647827, 34.647827, 36.666668, 36.708096, 36.708096, 38.846981, 38.890873, 38.890873, 41.156940, 41.203445, 41.203445, 43.604263, 43.653530, 43.653530, 46.197102, 46.249302, 46.249302, 48.944126, 48.999428, 48.999428, 51.854496, 51.913086, 51.913086, 54.937927, 55.000000, 55.000000, 58.204708, 58.270470, 58.270470, 61.665737, 61.735413, 61.735413, 65.332573, 65.406395, 65.406395, 69.217445, 69.295654, 69.295654, 73.333336, 73.416191, 73.416191, 77.693962, 77.781746, 77.781746, 82.313881, 82.406891, 82.406891, 87.208527, 87.307060, 87.307060, 92.394203, 92.498604, 92.498604, 97.888252, 97.998856, 97.998856, 103.708992, 103.826172, 103.826172, 109.875854, 110.000000, 110.000000, 116.409416, 116.540939, 116.540939, 123.331474, 123.470825, 123.470825, 130.665146, 130.812790, 130.812790, 138.434891, 138.591309, 138.591309, 146.666672, 146.832382, 146.832382, 155.387924, 155.563492, 155.563492, 164.627762, 164.813782, 164.813782, 174.417053, 174.614120, 174.614120, 184.788406, 184.997208, 184.997208, 195.776505, 195.997711, 195.997711, 207.417984, 207.652344, 207.652344, 219.751709, 220.000000, 220.000000, 232.818832, 233.081879, 233.081879, 246.662949, 246.941650, 246.941650, 261.330292, 261.625580, 261.625580, 276.869781, 277.182617, 277.182617, 293.333344, 293.664764, 293.664764, 310.775848, 311.126984, 311.126984, 329.255524, 329.627563, 329.627563, 348.834106, 349.228241, 349.228241, 369.576813, 369.994415, 369.994415, 391.553009, 391.995422, 391.995422, 414.835968, 415.304688, 415.304688, 439.503418, 440.000000, 440.000000, 465.637665, 466.163757, 466.163757, 493.325897, 493.883301, 493.883301, 523.251160, 523.251160, 554.365234, 554.365234, 587.329529, 587.329529, 622.253967, 622.253967, 659.255127, 659.255127, 698.456482, 698.456482, 739.988831, 739.988831, 783.990845, 830.609375, 880.000000, 932.327515, 987.766602, 1046.502319, 1108.730469, 1174.659058, 1244.507935, 1318.510254, 1396.912964, 1479.977661
 };
 
+// f * 2^24 is an exact integer for every entry, so the phase increments
+// come out the same on every build
+static uint32_t freq_step(u8 val) {
+    u64 f24 = (u64) ((double) frequencies[val] * 16777216.0);
+    return (f24 << 8) / ENGINE_SAMPLE_RATE;
+}
+
 /* ========================================================================= */
 
+// host view of guest memory, per bank; sample voices read from it in place
 typedef struct {
-    SqrChannel data;
-    RiseFall   rf;
-    float      fmin;
-    float      fmax;
-} CSqrChannel;
-
-void chsqar_init(CSqrChannel* ch) {
-    sqr_init(&ch->data);
-    risefall_reset(&ch->rf);
-    ch->fmin = -1;
-    ch->fmax = 1;
-}
-
-void chsqr_frame(CSqrChannel* ch, ma_uint32 frameCount, float* data) {
-    float level = risefall_tick(&ch->rf);
-
-    if (level > 0) {
-        sqr_frame(&ch->data, frameCount, data);
-        for (int i = 0; i < frameCount; i ++) {
-            if (data[i] < ch->fmin) {
-                data[i] = ch->fmin;
-            }
-            else if (data[i] > ch->fmax) {
-                data[i] = ch->fmax;
-            }
-        }
+    const u8* host[16];
+    uint32_t  size[16];
+} GuestMem;
+
+/* ========================================================================= */
+
+// every voice has the same register block and can be any of these types
+
+typedef enum {
+    VOICE_OFF      = 0,
+    VOICE_NOISE    = 1,
+    VOICE_SQUARE   = 2,
+    VOICE_TRIANGLE = 3,
+    VOICE_SAMPLE   = 4,
+    VOICE_SINE     = 5,
+
+    VOICE_TYPE_LEN,
+} VoiceType;
+
+// a sample at rate 32 plays 128 bytes per engine block
+#define SAMPLE_RATE_UNIT 32
+#define SAMPLE_STEP(rate) ((uint32_t) (((u64) 128 * 65536 * (rate)) / (ENGINE_BLOCK * SAMPLE_RATE_UNIT)))
+
+typedef struct {
+    // registers
+    u16 base;
+    su4 bank;
+    u16 len;
+    u16 loop;
+    u8  rate;
+
+    // playing
+    const int8_t* pcm;    // NULL when not playing
+    uint32_t      count;  // playable bytes
+    uint64_t      pos;    // 16.16
+    uint32_t      step;   // 16.16
+} SampleState;
+
+// the fixed point path works on Q15 samples and Q24 gains
+
+typedef struct {
+    VoiceType type;
+    RiseFall  rf;
+    float     fmin;
+    float     fmax;
+    int32_t   fmin_q;
+    int32_t   fmax_q;
+
+    uint32_t  phase;    // 0.32 fraction of the period
+    uint32_t  step;     // phase increment per sample
+    float     active;   // square: threshold on the triangle
+    int32_t   active_q;
+    v4u       noise;    // xorshift state, one per lane
+    SampleState smp;
+
+    Echo      echo;
+
+    float     pan_l;    // stereo gains, constant power
+    float     pan_r;
+    int32_t   pan_lq;   // Q15
+    int32_t   pan_rq;
+} Voice;
+
+// 0 left, 128 center, 255 right; gains follow a quarter sine period
+static void voice_pan(Voice* v, u8 val) {
+    const int32_t end = (SINE_LEN / 4) << 8;
+    // 128 lands exactly on the middle; 255 snaps to the right edge
+    int32_t pos = val == 255 ? end : val * end / 256;
+
+    int32_t gain[2];
+    for (int c = 0; c < 2; c ++) {
+        int32_t p = c ? pos : end - pos;
+        int32_t i = p >> 8;
+        int32_t f = p & 0xFF;
+        gain[c] = sine_quarter[i];
+        if (f != 0)
+            gain[c] += ((sine_quarter[i + 1] - sine_quarter[i]) * f) >> 8;
     }
 
-    for (int i = 0; i < frameCount; i ++)
-        data[i] *= level;
+    v->pan_lq = gain[0];
+    v->pan_rq = gain[1];
+    v->pan_l = gain[0] * (1.0f / 32768);
+    v->pan_r = gain[1] * (1.0f / 32768);
 }
 
-void chsqr_write(CSqrChannel* ch, u8 addr, u8 val) {
-    if (addr == 0) {
-        risefall_trigger(&ch->rf);
+void voice_init(Voice* v, VoiceType type, uint32_t seed) {
+    v->type = type;
+    risefall_reset(&v->rf);
+    v->fmin = -1;
+    v->fmax = 1;
+    v->fmin_q = -32768;
+    v->fmax_q = 32767;
+    v->phase = 0;
+    v->step = 0;
+    v->active = 0;
+    v->active_q = 0;
+    for (int i = 0; i < 4; i ++)
+        v->noise[i] = 0x9E3779B9u * (seed * 4 + i + 1);
+    memset(&v->smp, 0, sizeof(v->smp));
+    v->smp.rate = SAMPLE_RATE_UNIT;
+    v->smp.loop = 0xFFFF;
+    echo_init(&v->echo);
+    voice_pan(v, 128);
+}
+
+bool voice_sounding(const Voice* v) {
+    return v->type != VOICE_OFF && (risefall_active(&v->rf) || v->echo.tail != 0);
+}
+
+// resolves the sample registers to a host pointer into guest memory
+static void sample_start(SampleState* s, const GuestMem* mem) {
+    s->pcm = NULL;
+    s->pos = 0;
+    s->step = SAMPLE_STEP(s->rate);
+
+    const u8* host = mem->host[s->bank];
+    uint32_t size = mem->size[s->bank];
+    if (host == NULL || s->base >= size)
+        return;
+
+    s->count = s->len;
+    if (s->count > size - s->base)
+        s->count = size - s->base;
+    if (s->count == 0)
+        return;
+
+    s->pcm = (const int8_t*) host + s->base;
+}
+
+// fetches the two bytes around the play position and advances it;
+// false after the end
+static inline bool sample_fetch(SampleState* s, int32_t* s0, int32_t* s1, uint32_t* frac) {
+    if (s->pcm == NULL)
+        return false;
+
+    uint32_t i = s->pos >> 16;
+    bool looping = s->loop < s->count;
+
+    *frac = s->pos & 0xFFFF;
+    *s0 = s->pcm[i];
+    *s1 = 0;
+    if (i + 1 < s->count)
+        *s1 = s->pcm[i + 1];
+    else if (looping)
+        *s1 = s->pcm[s->loop];
+
+    s->pos += s->step;
+    if ((s->pos >> 16) >= s->count) {
+        while (looping && (s->pos >> 16) >= s->count)
+            s->pos -= ((uint64_t) (s->count - s->loop)) << 16;
+        if (!looping)
+            s->pcm = NULL;
     }
-    else if (addr == 1) {
+
+    return true;
+}
+
+// next sample with linear interpolation; 0 after the end
+static inline float sample_next(SampleState* s) {
+    int32_t s0, s1;
+    uint32_t f;
+    if (!sample_fetch(s, &s0, &s1, &f))
+        return 0;
+    return (s0 + (s1 - s0) * (f * (1.0f / 65536))) * (1.0f / 128);
+}
+
+// same in Q15
+static inline int32_t sample_next_q(SampleState* s) {
+    int32_t s0, s1;
+    uint32_t f;
+    if (!sample_fetch(s, &s0, &s1, &f))
+        return 0;
+    return s0 * 256 + (((s1 - s0) * (int32_t) f) >> 8);
+}
+
+void voice_write(Voice* v, const GuestMem* mem, u8 addr, u8 val) {
+    if (addr == 0x00) {
+        v->phase = 0;
+        if (v->type == VOICE_SAMPLE)
+            sample_start(&v->smp, mem);
+        risefall_trigger(&v->rf);
+    }
+    else if (addr == 0x01) {
         if (val >= NUM_FREQ)
             val = NUM_FREQ - 1;
-        sqr_change_freq(&ch->data, frequencies[val]);
+        v->step = freq_step(val);
     }
-    else if (addr >= 2 && addr <= 5) {
-        risefall_write(&ch->rf, addr - 2, val);
+    else if (addr >= 0x02 && addr <= 0x05) {
+        risefall_write(&v->rf, addr - 0x02, val);
     }
-    else if (addr == 6) {
-        ch->fmin = ((float) val) / 127 - 1;
+    else if (addr == 0x06) {
+        v->fmin = ((float) val) / 127 - 1;
+        v->fmin_q = val * 32768 / 127 - 32768;
     }
-    else if (addr == 7) {
-        ch->fmax = ((float) val) / 127 - 1;
+    else if (addr == 0x07) {
+        v->fmax = ((float) val) / 127 - 1;
+        v->fmax_q = val * 32768 / 127 - 32768;
     }
-    else if (addr == 8) {
-        // echo
+    else if (addr == 0x08) {
+        echo_write(&v->echo, val);
     }
-    else if (addr == 9) {
-        sqar_change_wavelength(&ch->data, ((float) val) / 255);
+    else if (addr == 0x09) {
+        v->active = (1 - ((float) val) / 255) * 2 - 1;
+        v->active_q = (255 - val) * 65536 / 255 - 32768;
     }
-    else {
-        assert(false);
+    else if (addr == 0x0A) {
+        v->smp.base = (v->smp.base & 0xFF00) | val;
+    }
+    else if (addr == 0x0B) {
+        v->smp.base = (v->smp.base & 0x00FF) | (val << 8);
+    }
+    else if (addr == 0x0C) {
+        v->smp.bank = val & 0xF;
+    }
+    else if (addr == 0x0D) {
+        v->smp.len = (v->smp.len & 0xFF00) | val;
+    }
+    else if (addr == 0x0E) {
+        v->smp.len = (v->smp.len & 0x00FF) | (val << 8);
+    }
+    else if (addr == 0x0F) {
+        v->smp.loop = (v->smp.loop & 0xFF00) | val;
+    }
+    else if (addr == 0x10) {
+        v->smp.loop = (v->smp.loop & 0x00FF) | (val << 8);
+    }
+    else if (addr == 0x11) {
+        v->smp.rate = val;
+        v->smp.step = SAMPLE_STEP(val);
+    }
+    else if (addr == 0x12) {
+        voice_pan(v, val);
+    }
+    else if (addr == VOICE_REG_TYPE) {
+        // stops what plays; the other registers stay as written
+        v->type = val < VOICE_TYPE_LEN ? val : VOICE_OFF;
+        risefall_stop(&v->rf);
+        v->smp.pcm = NULL;
+        echo_clear(&v->echo, v->echo.delay);
     }
 }
 
-/* ========================================================================= */
+// next 4 oscillator samples; the phase moves by `count` samples
+static inline __attribute__((always_inline))
+v4f voice_osc(Voice* v, VoiceType type, uint32_t count) {
+    v4u ph = v->phase + (v4u) { 0, 1, 2, 3 } * v->step;
+    v->phase += count * v->step;
+
+    if (type == VOICE_NOISE) {
+        v4u x = v->noise;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        v->noise = x;
+        return __builtin_convertvector((v4i) x, v4f) * 0x1p-31f;
+    }
 
-typedef struct {
-    TriChannel data;
-    RiseFall   rf;
-    float      fmin;
-    float      fmax;
-} CTriChannel;
-
-void chtri_init(CTriChannel* ch) {
-    tri_init(&ch->data);
-    risefall_reset(&ch->rf);
-    ch->fmin = -1;
-    ch->fmax = 1;
-}
-
-void chtri_frame(CTriChannel* ch, ma_uint32 frameCount, float* data) {
-    float level = risefall_tick(&ch->rf);
-
-    if (level > 0) {
-        tri_frame(&ch->data, frameCount, data);
-        for (int i = 0; i < frameCount; i ++) {
-            if (data[i] < ch->fmin) {
-                data[i] = ch->fmin;
-            }
-            else if (data[i] > ch->fmax) {
-                data[i] = ch->fmax;
-            }
-        }
+    if (type == VOICE_SAMPLE) {
+        // positions depend on loop wrap-around, so fetch lane by lane
+        v4f out = {0};
+        for (uint32_t i = 0; i < count; i ++)
+            out[i] = sample_next(&v->smp);
+        return out;
     }
 
-    for (int i = 0; i < frameCount; i ++)
-        data[i] *= level;
+    // phase as [-0.5, 0.5)
+    v4f t = __builtin_convertvector((v4i) ph, v4f) * 0x1p-32f;
+
+    if (type == VOICE_SINE) {
+        // fold into [-0.25, 0.25] and evaluate the odd taylor series of
+        // sin(2 pi u); error stays below 4e-6
+        v4f h = v4f_sel((v4i) ph < 0, v4f_splat(-0.5f), v4f_splat(0.5f));
+        v4f u = v4f_sel(v4f_abs(t) > 0.25f, h - t, t);
+        v4f u2 = u * u;
+        return u * (6.2831853f + u2 * (-41.341702f + u2 * (81.605249f
+                  + u2 * (-76.705860f + u2 * 42.058694f))));
+    }
+
+    v4f tri = 4.0f * v4f_abs(t) - 1.0f;
+
+    if (type == VOICE_SQUARE) {
+        v4f act = v4f_splat(v->active);
+        v4f sq = v4f_sel(tri < act, v4f_splat(-1), tri);
+        return v4f_sel(tri > act, v4f_splat(1), sq);
+    }
+
+    return tri;
 }
 
-void chtri_write(CTriChannel* ch, u8 addr, u8 val) {
-    if (addr == 0) {
-        risefall_trigger(&ch->rf);
+// accumulates x into the mix; with a right channel the voice is panned
+// into both planes
+static inline __attribute__((always_inline))
+void mix_add(const Voice* v, float* mix, float* mix_r, v4f x, uint32_t k) {
+    if (mix_r == NULL) {
+        v4f_store(mix, v4f_load(mix, k) + x, k);
+        return;
     }
-    else if (addr == 1) {
-        if (val >= NUM_FREQ)
-            val = NUM_FREQ - 1;
-        tri_change_freq(&ch->data, frequencies[val]);
+    v4f_store(mix, v4f_load(mix, k) + x * v->pan_l, k);
+    v4f_store(mix_r, v4f_load(mix_r, k) + x * v->pan_r, k);
+}
+
+static inline __attribute__((always_inline))
+void mix_add_q(const Voice* v, int32_t* mix, int32_t* mix_r, int32_t x) {
+    if (mix_r == NULL) {
+        *mix += x;
+        return;
     }
-    else if (addr >= 2 && addr <= 5) {
-        risefall_write(&ch->rf, addr - 2, val);
+    *mix += ((int64_t) x * v->pan_lq) >> 15;
+    *mix_r += ((int64_t) x * v->pan_rq) >> 15;
+}
+
+// oscillator, clamp, envelope ramp g + i * dg, echo and accumulation into
+// mix (and mix_r in stereo, else NULL), in a single pass over n samples.
+// `line` is the echo delay line at the current position (must not wrap
+// within n) or NULL
+static inline __attribute__((always_inline))
+void voice_kernel(Voice* v, VoiceType type, float* mix, float* mix_r, float* line, uint32_t n, float g, float dg) {
+    v4f gv    = { g, g + dg, g + 2 * dg, g + 3 * dg };
+    v4f gstep = v4f_splat(4 * dg);
+    v4f lo    = v4f_splat(v->fmin);
+    v4f hi    = v4f_splat(v->fmax);
+    v4f lv    = v4f_splat(v->echo.level);
+
+    for (uint32_t i = 0; i < n; i += 4) {
+        uint32_t k = n - i < 4 ? n - i : 4;
+
+        v4f x = voice_osc(v, type, k);
+        x = v4f_min(v4f_max(x, lo), hi);
+        x *= gv;
+        gv += gstep;
+
+        if (line != NULL) {
+            x += lv * v4f_load(line + i, k);
+            v4f_store(line + i, x, k);
+        }
+
+        mix_add(v, mix + i, mix_r ? mix_r + i : NULL, x, k);
+    }
+}
+
+// echo tail only; the dry signal is silent
+static void echo_kernel(const Voice* v, float* mix, float* mix_r, float* line, uint32_t n) {
+    v4f lv = v4f_splat(v->echo.level);
+
+    for (uint32_t i = 0; i < n; i += 4) {
+        uint32_t k = n - i < 4 ? n - i : 4;
+
+        v4f x = lv * v4f_load(line + i, k);
+        v4f_store(line + i, x, k);
+        mix_add(v, mix + i, mix_r ? mix_r + i : NULL, x, k);
     }
-    else if (addr == 6) {
-        ch->fmin = ((float) val) / 127 - 1;
+}
+
+// fixed point version of voice_kernel, one sample at a time
+static inline __attribute__((always_inline))
+void voice_kernel_q(Voice* v, VoiceType type, int32_t* mix, int32_t* mix_r, int32_t* line, uint32_t n, int32_t g, int32_t dg) {
+    int32_t lo = v->fmin_q;
+    int32_t hi = v->fmax_q;
+    int32_t lv = v->echo.level_q;
+
+    for (uint32_t i = 0; i < n; i ++) {
+        int32_t x;
+
+        if (type == VOICE_NOISE) {
+            uint32_t r = v->noise[0];
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+            v->noise[0] = r;
+            x = ((int32_t) r) >> 16;
+        }
+        else if (type == VOICE_SAMPLE) {
+            x = sample_next_q(&v->smp);
+        }
+        else if (type == VOICE_SINE) {
+            uint32_t idx = v->phase >> (32 - SINE_BITS);
+            int32_t f = (v->phase >> 8) & 0xFFFF;
+            int32_t s0 = sine_table_q[idx];
+            int32_t s1 = sine_table_q[idx + 1];
+            x = s0 + (((s1 - s0) * f) >> 16);
+        }
+        else {
+            // |phase| as [0, 2^31] -> triangle in [-32768, 32768]
+            int32_t t = v->phase;
+            uint32_t a = t < 0 ? -(uint32_t) t : (uint32_t) t;
+            x = (int32_t) (a >> 15) - 32768;
+
+            if (type == VOICE_SQUARE) {
+                if (x < v->active_q)
+                    x = -32768;
+                else if (x > v->active_q)
+                    x = 32767;
+            }
+        }
+        v->phase += v->step;
+
+        if (x < lo)
+            x = lo;
+        if (x > hi)
+            x = hi;
+
+        x = (x * (g >> 9)) >> 15;
+        g += dg;
+
+        if (line != NULL) {
+            x += (line[i] * lv) >> 4;
+            line[i] = x;
+        }
+
+        mix_add_q(v, mix + i, mix_r ? mix_r + i : NULL, x);
     }
-    else if (addr == 7) {
-        ch->fmax = ((float) val) / 127 - 1;
+}
+
+static void echo_kernel_q(const Voice* v, int32_t* mix, int32_t* mix_r, int32_t* line, uint32_t n) {
+    for (uint32_t i = 0; i < n; i ++) {
+        int32_t x = (line[i] * v->echo.level_q) >> 4;
+        line[i] = x;
+        mix_add_q(v, mix + i, mix_r ? mix_r + i : NULL, x);
     }
-    else if (addr == 8) {
-        // echo
+}
+
+static void voice_mix_q(Voice* v, int32_t* mix, int32_t* mix_r, int32_t* line, uint32_t n, int32_t g, int32_t dg) {
+    switch (v->type) {
+    case VOICE_NOISE:
+        voice_kernel_q(v, VOICE_NOISE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_SQUARE:
+        voice_kernel_q(v, VOICE_SQUARE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_TRIANGLE:
+        voice_kernel_q(v, VOICE_TRIANGLE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_SAMPLE:
+        voice_kernel_q(v, VOICE_SAMPLE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_SINE:
+        voice_kernel_q(v, VOICE_SINE, mix, mix_r, line, n, g, dg);
+        break;
+    default:
+        break;
     }
-    else if (addr == 9) {
-        // wave length
+}
+
+static void voice_mix(Voice* v, float* mix, float* mix_r, float* line, uint32_t n, float g, float dg) {
+    switch (v->type) {
+    case VOICE_NOISE:
+        voice_kernel(v, VOICE_NOISE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_SQUARE:
+        voice_kernel(v, VOICE_SQUARE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_TRIANGLE:
+        voice_kernel(v, VOICE_TRIANGLE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_SAMPLE:
+        voice_kernel(v, VOICE_SAMPLE, mix, mix_r, line, n, g, dg);
+        break;
+    case VOICE_SINE:
+        voice_kernel(v, VOICE_SINE, mix, mix_r, line, n, g, dg);
+        break;
+    default:
+        break;
     }
-    else {
-        assert(false);
+}
+
+// adds n samples of the voice to mix; mix is int32_t Q15 when fixed.
+// mix_r is the right plane in stereo, else NULL
+void voice_render(Voice* v, void* mix, void* mix_r, uint32_t n, bool fixed) {
+    Echo* e = &v->echo;
+
+    if (risefall_active(&v->rf))
+        e->tail = e->tail_len;
+    bool echo = e->delay != 0 && e->tail != 0;
+
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t left = n - i;
+        if (echo && left > e->delay - e->pos)
+            left = e->delay - e->pos;
+
+        bool dry = risefall_active(&v->rf);
+        uint32_t len;
+
+        if (fixed) {
+            int32_t g, dg;
+            len = risefall_segment_q(&v->rf, left, &g, &dg);
+            int32_t* line = echo ? e->buf_q + e->pos : NULL;
+
+            int32_t* r = mix_r ? (int32_t*) mix_r + i : NULL;
+
+            if (dry)
+                voice_mix_q(v, (int32_t*) mix + i, r, line, len, g, dg);
+            else if (echo)
+                echo_kernel_q(v, (int32_t*) mix + i, r, line, len);
+            else
+                break;
+        } else {
+            float g, dg;
+            len = risefall_segment(&v->rf, left, &g, &dg);
+            float* line = echo ? e->buf + e->pos : NULL;
+
+            float* r = mix_r ? (float*) mix_r + i : NULL;
+
+            if (dry)
+                voice_mix(v, (float*) mix + i, r, line, len, g, dg);
+            else if (echo)
+                echo_kernel(v, (float*) mix + i, r, line, len);
+            else
+                break;
+        }
+
+        i += len;
+        if (echo) {
+            e->pos += len;
+            if (e->pos == e->delay)
+                e->pos = 0;
+        }
     }
+
+    if (echo)
+        e->tail = e->tail > n ? e->tail - n : 0;
+
+    // a one-shot sample ends the beat when it runs out
+    if (v->type == VOICE_SAMPLE && v->smp.pcm == NULL)
+        risefall_reset_stage(&v->rf);
 }
 
 /* ========================================================================= */
 
+// written by the callback only, read from any thread
+
 typedef struct {
-    ma_device dev;
+    _Atomic u64 callbacks;
+    _Atomic u64 frames;
+    _Atomic u64 underruns;
+    _Atomic u64 overruns;
+    _Atomic u32 max_render_ns;
+    _Atomic u32 last_render_ns;
+    _Atomic u32 last_load;       // last render time / deadline in 1/255
+    _Atomic u32 active_voices;
+    _Atomic u64 hist[SOUND_HIST_BUCKETS];
+
+    // callback thread only
+    u64 last_start_ns;
+    u64 last_deadline_ns;
+} CallbackStats;
+
+static u64 stats_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void stats_reset(CallbackStats* st) {
+    atomic_init(&st->callbacks, 0);
+    atomic_init(&st->frames, 0);
+    atomic_init(&st->underruns, 0);
+    atomic_init(&st->overruns, 0);
+    atomic_init(&st->max_render_ns, 0);
+    atomic_init(&st->last_render_ns, 0);
+    atomic_init(&st->last_load, 0);
+    atomic_init(&st->active_voices, 0);
+    for (int i = 0; i < SOUND_HIST_BUCKETS; i ++)
+        atomic_init(&st->hist[i], 0);
+    st->last_start_ns = 0;
+    st->last_deadline_ns = 0;
+}
+
+// start: when the callback was entered; deadline: play time of its frames
+static void stats_record(CallbackStats* st, u64 start, u64 end, u64 deadline, u32 frames) {
+    u64 render = end - start;
+
+    // the previous period should have been followed up within its own play
+    // time; a much later callback means the device ran dry in between
+    if (st->last_start_ns != 0 && start - st->last_start_ns > 2 * st->last_deadline_ns)
+        atomic_fetch_add_explicit(&st->underruns, 1, memory_order_relaxed);
+    st->last_start_ns = start;
+    st->last_deadline_ns = deadline;
+
+    if (render > deadline)
+        atomic_fetch_add_explicit(&st->overruns, 1, memory_order_relaxed);
+
+    u32 ns = render > UINT32_MAX ? UINT32_MAX : render;
+    atomic_store_explicit(&st->last_render_ns, ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&st->max_render_ns, memory_order_relaxed))
+        atomic_store_explicit(&st->max_render_ns, ns, memory_order_relaxed);
+
+    u64 load = deadline ? render * 255 / deadline : 255;
+    atomic_store_explicit(&st->last_load, load > 255 ? 255 : load, memory_order_relaxed);
+
+    // bucket 0: < 1us, bucket i: [2^(i-1), 2^i) us
+    u32 us = ns / 1000;
+    int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    if (bucket >= SOUND_HIST_BUCKETS)
+        bucket = SOUND_HIST_BUCKETS - 1;
+    atomic_fetch_add_explicit(&st->hist[bucket], 1, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&st->frames, frames, memory_order_relaxed);
+    atomic_fetch_add_explicit(&st->callbacks, 1, memory_order_relaxed);
+}
+
+/* ========================================================================= */
+
+#define MASTER_UNITY 64
+
+typedef struct {
+    u8 gain;   // in 1/MASTER_UNITY
+    bool hard; // hard clip instead of the soft curve
+} Master;
+
+// pattern player; runs on the engine sample clock inside rendering
+
+#define SEQ_TICK_DEFAULT 1000 // engine samples (125 ms)
+#define SEQ_MAX_EVENTS   4096 // per wait; a loop without waits is stopped
+
+enum {
+    SEQ_END   = 0x00, //                   end of pattern
+    SEQ_WAIT  = 0x01, // ticks             0 waits 256 ticks
+    SEQ_NOTE  = 0x02, // voice, freq       set freq and trigger
+    SEQ_WRITE = 0x03, // addr lo, hi, val  any voice or master register
+};
+
+// the guest's register writes reach it through the shadow bank, so all of
+// this but the atomics belongs to the audio thread. a control write also
+// counts a restart in the bank, applied after the other registers
+
+#define SEQ_CONTROL 0x06
+#define SEQ_RESTART 0x07       // bank only; restarts requested
+
+typedef struct {
+    u16 base;
+    u8  bank;
+    u16 tick;              // engine samples per tick
+    u8  irq;               // raised at the end of the pattern; 0 none
+    u8  control;
+    bool loop;
+
+    u32 pos;               // offset of the next event from base
+    u32 wait;              // engine samples until the next event
+
+    _Atomic bool playing;
+    _Atomic u8  restarted; // last restart applied
+    _Atomic u32 at;        // pos for the guest
+
+    _Atomic u8 pending;    // interrupt for soundchip_irq
+} Sequencer;
+
+// guest writes go into a shadow bank on the cpu side. a commit copies it
+// into one of three slots and swaps the slot index with the audio thread,
+// which applies every register written since the bank it saw last, the
+// same value or not. neither side ever waits for the other
+
+#define BANK_ROWS   (SOUND_MAX_VOICES + 2) // one per voice, master, sequencer
+#define BANK_MASTER SOUND_MAX_VOICES
+#define BANK_SEQ    (SOUND_MAX_VOICES + 1)
+#define BANK_FRESH  4                      // slot index not picked up yet
 
-    CWhiteNoiseChannel noise0;
-    CSqrChannel        voice0;
-    CSqrChannel        voice1;
-    CTriChannel        voice2;
+typedef struct {
+    u8  regs[BANK_ROWS][VOICE_STRIDE];
+    u8  count[BANK_ROWS][VOICE_STRIDE];  // writes per register, wrapping
+} RegBank;
+
+typedef struct {
+    // cpu side
+    RegBank shadow;
+    bool deferred;          // hold writes until commit
+    u64 stale[3][2];        // per slot, rows that changed since it was filled
+    u32 back;
+
+    _Atomic u32 middle;
+    RegBank slot[3];
+
+    // audio side
+    u32 front;
+    u8 applied[BANK_ROWS][VOICE_STRIDE];   // counts of the bank applied last
+} Shadow;
+
+typedef struct {
+    ma_context ctx;
+    ma_device dev;
+    bool armed;      // soundchip_start was called; open on the next write
+    bool open;
+    PcmTap tap;      // NULL when off
+    pthread_mutex_t tap_lock;   // soundchip_stats against closing the tap
+    Resampler rs[2];    // one per channel
+    SoundChipConfig cfg;
+
+    GuestMem mem;
+    CallbackStats stats;
+    Master master;
+    Sequencer seq;
+    Shadow shadow;
+
+    uint32_t voices;
+    Voice*   voice;
 } SoundData;
 
-void soundchip_init(SoundChip* chip) {
+void soundchip_config_default(SoundChipConfig* cfg) {
+    cfg->voices        = SOUND_MAX_VOICES;
+    cfg->backend       = SOUND_BACKEND_DEVICE;
+    cfg->format        = SOUND_FORMAT_F32;
+    cfg->fixed         = false;
+    cfg->sample_rate   = 0;
+    cfg->period_frames = 0;
+    cfg->periods       = 0;
+    cfg->channels      = 1;
+    cfg->tap           = NULL;
+}
+
+void soundchip_init(SoundChip* chip, const SoundChipConfig* cfg) {
     *chip = malloc(sizeof(SoundData));
     SoundData* d = *chip;
 
-    chwhitenoise_init(&d->noise0);
-    chsqar_init(&d->voice0);
-    chsqar_init(&d->voice1);
-    chtri_init(&d->voice2);
+    sine_init();
+
+    if (cfg == NULL)
+        soundchip_config_default(&d->cfg);
+    else
+        d->cfg = *cfg;
+
+    if (d->cfg.voices == 0 || d->cfg.voices > SOUND_MAX_VOICES)
+        d->cfg.voices = SOUND_MAX_VOICES;
+    if (d->cfg.channels != 2)
+        d->cfg.channels = 1;
+
+    memset(&d->mem, 0, sizeof(d->mem));
+    stats_reset(&d->stats);
+
+    d->armed = false;
+    d->open = false;
+    d->tap = NULL;
+    pthread_mutex_init(&d->tap_lock, NULL);
+
+    d->master.gain = MASTER_UNITY;
+    d->master.hard = false;
+
+    memset(&d->seq, 0, sizeof(d->seq));
+    d->seq.tick = SEQ_TICK_DEFAULT;
+
+    memset(&d->shadow, 0, sizeof(d->shadow));
+    d->shadow.back = 0;
+    atomic_init(&d->shadow.middle, 1);
+    d->shadow.front = 2;
+
+    d->voices = d->cfg.voices;
+    d->voice = malloc(sizeof(Voice) * d->voices);
+
+    // the first four voices default to the classic layout
+    static const VoiceType classic[] = {
+        VOICE_NOISE, VOICE_SQUARE, VOICE_SQUARE, VOICE_TRIANGLE,
+    };
+    for (uint32_t i = 0; i < d->voices; i ++) {
+        VoiceType type = i < 4 ? classic[i] : VOICE_OFF;
+        voice_init(&d->voice[i], type, i);
+    }
 }
 
 float lerpf(float a, float b, float t) {
     return (1.0 - t) * a + t * b;
 }
 
-void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
-    SoundData* sd = pDevice->pUserData;
-    float* data = pOutput;
+// voices that are silent for the whole block are skipped
+static uint64_t active_mask(SoundData* sd) {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < sd->voices; i ++)
+        if (voice_sounding(&sd->voice[i]))
+            mask |= 1ull << i;
 
-    assert(frameCount == 150); // required for samples
+    atomic_store_explicit(&sd->stats.active_voices, __builtin_popcountll(mask), memory_order_relaxed);
+    return mask;
+}
 
-    static float temp[150];
+// voice and master registers; shared by guest writes and the sequencer
+static void chip_write(SoundData* sd, su12 addr, u8 val) {
+    if (addr < sd->voices * VOICE_STRIDE) {
+        voice_write(&sd->voice[addr / VOICE_STRIDE], &sd->mem, addr % VOICE_STRIDE, val);
+    }
+    else if (addr == SOUND_MASTER + 0x00) {
+        sd->master.gain = val;
+    }
+    else if (addr == SOUND_MASTER + 0x01) {
+        sd->master.hard = val & 1;
+    }
+}
 
-    chwhitenoise_frame(&sd->noise0, frameCount, data);
-    
-    chsqr_frame(&sd->voice0, frameCount, temp);
-    for (int i = 0; i < 150; i ++) {
-        data[i] += temp[i];
+/* ========================================================================= */
+
+static void shadow_write(Shadow* sh, u32 row, u8 reg, u8 val) {
+    // the audio side applies a register when its count moved; the
+    // restart also counts in its value, for seq_read
+    if (row == BANK_SEQ && reg == SEQ_CONTROL)
+        shadow_write(sh, row, SEQ_RESTART, sh->shadow.regs[row][SEQ_RESTART] + 1);
+
+    sh->shadow.regs[row][reg] = val;
+    sh->shadow.count[row][reg] ++;
+    for (int i = 0; i < 3; i ++)
+        sh->stale[i][row / 64] |= 1ull << (row % 64);
+}
+
+static void shadow_commit(Shadow* sh) {
+    RegBank* b = &sh->slot[sh->back];
+
+    for (u32 w = 0; w < 2; w ++) {
+        u64 m = sh->stale[sh->back][w];
+        sh->stale[sh->back][w] = 0;
+
+        while (m != 0) {
+            u32 r = w * 64 + __builtin_ctzll(m);
+            m &= m - 1;
+            memcpy(b->regs[r], sh->shadow.regs[r], VOICE_STRIDE);
+            memcpy(b->count[r], sh->shadow.count[r], VOICE_STRIDE);
+        }
     }
 
-    chsqr_frame(&sd->voice1, frameCount, temp);
-    for (int i = 0; i < 150; i ++) {
-        data[i] += temp[i];
+    u32 old = atomic_exchange_explicit(&sh->middle, sh->back | BANK_FRESH, memory_order_acq_rel);
+    sh->back = old & ~BANK_FRESH;
+}
+
+static void seq_write(SoundData* sd, u8 reg, u8 val);
+
+static void bank_write(SoundData* sd, u32 row, u8 reg, u8 val) {
+    if (row == BANK_SEQ)
+        seq_write(sd, reg, val);
+    else if (row == BANK_MASTER)
+        chip_write(sd, SOUND_MASTER + reg, val);
+    else
+        chip_write(sd, row * VOICE_STRIDE + reg, val);
+}
+
+// audio thread; picks up the newest bank and applies what was written,
+// once per register however often. the sequencer may have changed a
+// register since, so the value alone does not tell. the type goes first
+// since it stops the voice, the trigger or the restart last
+static void shadow_apply(SoundData* sd) {
+    Shadow* sh = &sd->shadow;
+
+    if (!(atomic_load_explicit(&sh->middle, memory_order_relaxed) & BANK_FRESH))
+        return;
+
+    u32 old = atomic_exchange_explicit(&sh->middle, sh->front, memory_order_acq_rel);
+    sh->front = old & ~BANK_FRESH;
+
+    const RegBank* b = &sh->slot[sh->front];
+
+    for (u32 r = 0; r < BANK_ROWS; r ++) {
+        if (memcmp(b->count[r], sh->applied[r], VOICE_STRIDE) == 0)
+            continue;
+
+        const u8 first = VOICE_REG_TYPE;
+        const u8 last = r == BANK_SEQ ? SEQ_RESTART : 0x00;
+
+        u32 changed = 0;
+        for (u32 reg = 0; reg < VOICE_STRIDE; reg ++)
+            if (b->count[r][reg] != sh->applied[r][reg])
+                changed |= 1u << reg;
+
+        if (changed & 1u << first)
+            bank_write(sd, r, first, b->regs[r][first]);
+        for (u32 reg = 0; reg < VOICE_STRIDE; reg ++)
+            if (reg != first && reg != last && (changed & 1u << reg))
+                bank_write(sd, r, reg, b->regs[r][reg]);
+        if (changed & 1u << last)
+            bank_write(sd, r, last, b->regs[r][last]);
+
+        memcpy(sh->applied[r], b->count[r], VOICE_STRIDE);
     }
+}
+
+/* ========================================================================= */
+
+// pattern bytes [pos, pos + len) or NULL past the end of the mapped bank
+static const u8* seq_fetch(SoundData* sd, u32 len) {
+    Sequencer* sq = &sd->seq;
+    const u8* host = sd->mem.host[sq->bank];
+    u32 at = sq->base + sq->pos;
 
-    chtri_frame(&sd->voice2, frameCount, temp);
-    for (int i = 0; i < 150; i ++) {
-        data[i] += temp[i];
+    if (host == NULL || at + len > sd->mem.size[sq->bank])
+        return NULL;
+    return host + at;
+}
+
+// runs one event; false when the pattern stopped
+static bool seq_event(SoundData* sd) {
+    Sequencer* sq = &sd->seq;
+
+    const u8* ev = seq_fetch(sd, 1);
+    u8 op = ev != NULL ? ev[0] : SEQ_END;
+
+    static const u8 size[] = {
+        [SEQ_END] = 1, [SEQ_WAIT] = 2, [SEQ_NOTE] = 3, [SEQ_WRITE] = 4,
+    };
+    if (op < sizeof(size) && op != SEQ_END)
+        ev = seq_fetch(sd, size[op]);
+    if (ev == NULL || op >= sizeof(size))
+        op = SEQ_END;
+
+    if (op == SEQ_END) {
+        if (sq->irq != 0)
+            atomic_store_explicit(&sq->pending, sq->irq, memory_order_release);
+        sq->pos = 0;
+        if (!sq->loop)
+            atomic_store_explicit(&sq->playing, false, memory_order_relaxed);
+        return sq->loop;
+    }
+
+    sq->pos += size[op];
+
+    if (op == SEQ_WAIT) {
+        u32 ticks = ev[1] ? ev[1] : 256;
+        sq->wait = ticks * sq->tick;
+    }
+    else if (op == SEQ_NOTE) {
+        su12 b = (ev[1] % sd->voices) * VOICE_STRIDE;
+        chip_write(sd, b + 0x01, ev[2]);
+        chip_write(sd, b + 0x00, 0);
+    }
+    else if (op == SEQ_WRITE) {
+        chip_write(sd, (ev[1] | ev[2] << 8) & 0xFFF, ev[3]);
+    }
+
+    return true;
+}
+
+// runs due events; returns how many of the next `left` samples can be
+// rendered before the sequencer needs to run again
+static uint32_t seq_advance(SoundData* sd, uint32_t left) {
+    Sequencer* sq = &sd->seq;
+
+    if (!atomic_load_explicit(&sq->playing, memory_order_relaxed))
+        return left;
+
+    for (uint32_t n = 0; sq->wait == 0; n ++) {
+        if (n == SEQ_MAX_EVENTS || !seq_event(sd)) {
+            atomic_store_explicit(&sq->playing, false, memory_order_relaxed);
+            return left;
+        }
+    }
+
+    atomic_store_explicit(&sq->at, sq->pos, memory_order_relaxed);
+
+    uint32_t len = sq->wait < left ? sq->wait : left;
+    sq->wait -= len;
+    return len;
+}
+
+// audio thread, from the bank
+static void seq_write(SoundData* sd, u8 reg, u8 val) {
+    Sequencer* sq = &sd->seq;
+
+    if (reg == 0x00) {
+        sq->base = (sq->base & 0xFF00) | val;
+    }
+    else if (reg == 0x01) {
+        sq->base = (sq->base & 0x00FF) | (val << 8);
+    }
+    else if (reg == 0x02) {
+        sq->bank = val & 0xF;
+    }
+    else if (reg == 0x03) {
+        sq->tick = (sq->tick & 0xFF00) | val;
+    }
+    else if (reg == 0x04) {
+        sq->tick = (sq->tick & 0x00FF) | (val << 8);
+    }
+    else if (reg == 0x05) {
+        sq->irq = val;
+    }
+    else if (reg == SEQ_CONTROL) {
+        sq->control = val;
     }
+    else if (reg == SEQ_RESTART) {
+        // between blocks, so no event is half way
+        if (sq->tick == 0)
+            sq->tick = 1;
+        sq->loop = sq->control & 2;
+        sq->pos = 0;
+        sq->wait = 0;
+        atomic_store_explicit(&sq->at, 0, memory_order_relaxed);
+        atomic_store_explicit(&sq->playing, sq->control & 1, memory_order_relaxed);
+        atomic_store_explicit(&sq->restarted, val, memory_order_release);
+    }
+}
+
+// cpu thread; a restart the audio thread has not applied yet reads as
+// written
+static u8 seq_read(SoundData* sd, u8 reg) {
+    Sequencer* sq = &sd->seq;
+    const u8* row = sd->shadow.shadow.regs[BANK_SEQ];
+    bool waiting = row[SEQ_RESTART] != atomic_load_explicit(&sq->restarted, memory_order_acquire);
+
+    if (reg == SEQ_CONTROL) {
+        bool playing = waiting ? row[SEQ_CONTROL] & 1 : atomic_load_explicit(&sq->playing, memory_order_relaxed);
+        return playing | (row[SEQ_CONTROL] & 2);
+    }
+
+    u32 at = waiting ? 0 : atomic_load_explicit(&sq->at, memory_order_relaxed);
+    if (reg == 0x07)
+        return at & 0xFF;
+    if (reg == 0x08)
+        return at >> 8;
+    return 0;
+}
+
+u8 soundchip_irq(SoundChip* chip) {
+    SoundData* sd = *chip;
+
+    return atomic_exchange_explicit(&sd->seq.pending, 0, memory_order_acquire);
+}
+
+/* ========================================================================= */
 
-    for (int i = 0; i < 150; i ++) {
-        float v = data[i];
-        if (v > 1)
-            data[i] = 1;
-        else if (v < -1)
-            data[i] = -1;
+// master bus: gain, then a cubic soft clip x - 4/27 x^3 that reaches +-1
+// with zero slope at x = +-1.5, or a plain hard clip. it runs as the last
+// pass over each block and writes the output format directly. it is not
+// fused into the voices: which voice adds last changes with idle voices
+// and sequencer splits, and the pass costs ~0.8 ns a sample whatever the
+// voice count
+
+static inline v4f master_curve(v4f x, v4f gain, bool hard) {
+    x *= gain;
+    if (hard)
+        return v4f_max(v4f_min(x, v4f_splat(1)), v4f_splat(-1));
+
+    x = v4f_max(v4f_min(x, v4f_splat(1.5f)), v4f_splat(-1.5f));
+    return x - (4.0f / 27) * x * x * x;
+}
+
+static void master_f32(const Master* m, const float* mix, float* out, uint32_t n) {
+    v4f gain = v4f_splat((float) m->gain / MASTER_UNITY);
+
+    for (uint32_t i = 0; i < n; i += 4) {
+        uint32_t k = n - i < 4 ? n - i : 4;
+        v4f_store(out + i, master_curve(v4f_load(mix + i, k), gain, m->hard), k);
     }
 }
 
+static void master_s16(const Master* m, const float* mix, int16_t* out, uint32_t n) {
+    v4f gain = v4f_splat((float) m->gain / MASTER_UNITY);
+
+    for (uint32_t i = 0; i < n; i += 4) {
+        uint32_t k = n - i < 4 ? n - i : 4;
+        v4f x = master_curve(v4f_load(mix + i, k), gain, m->hard) * 32767;
+        v4i q = __builtin_convertvector(x, v4i);
+        for (uint32_t j = 0; j < k; j ++)
+            out[i + j] = q[j];
+    }
+}
+
+// Q15 in and out; 4/27 is 9709 in Q16
+static void master_q(const Master* m, const int32_t* mix, int16_t* out, uint32_t n) {
+    for (uint32_t i = 0; i < n; i ++) {
+        int32_t x = mix[i] * m->gain / MASTER_UNITY;
+
+        if (m->hard) {
+            if (x > 32767)
+                x = 32767;
+            else if (x < -32768)
+                x = -32768;
+            out[i] = x;
+            continue;
+        }
+
+        if (x > 49152)
+            x = 49152;
+        else if (x < -49152)
+            x = -49152;
+
+        int64_t x3 = ((int64_t) x * x * x) >> 30;
+        int32_t y = x - (int32_t) ((x3 * 9709) >> 16);
+        out[i] = y > 32767 ? 32767 : y;
+    }
+}
+
+// all voices into one block; the block is split where sequencer events
+// fall so they land on the exact sample. mix is int32_t Q15 when fixed
+static void render_voices(SoundData* sd, void* mix, void* mix_r, bool fixed) {
+    shadow_apply(sd);
+
+    uint32_t at = 0;
+    while (at < ENGINE_BLOCK) {
+        uint32_t n = seq_advance(sd, ENGINE_BLOCK - at);
+
+        // float and int32_t samples have the same size
+        void* m = (int32_t*) mix + at;
+        void* r = mix_r != NULL ? (int32_t*) mix_r + at : NULL;
+
+        uint64_t mask = active_mask(sd);
+        while (mask != 0) {
+            int i = __builtin_ctzll(mask);
+            mask &= mask - 1;
+            voice_render(&sd->voice[i], m, r, n, fixed);
+        }
+
+        at += n;
+    }
+}
+
+// voices into an unclipped mix of one block at the engine rate;
+// mix_r is the right plane in stereo, else NULL
+static void render_mix(SoundData* sd, float* mix, float* mix_r) {
+    memset(mix, 0, ENGINE_BLOCK * sizeof(float));
+    if (mix_r != NULL)
+        memset(mix_r, 0, ENGINE_BLOCK * sizeof(float));
+
+    render_voices(sd, mix, mix_r, false);
+}
+
+// integer only; the output is bit-identical on every build
+static void render_block_q(SoundData* sd, int16_t* data, int16_t* data_r) {
+    int32_t mix[2][ENGINE_BLOCK];
+    memset(mix, 0, sizeof(mix));
+
+    render_voices(sd, mix[0], data_r != NULL ? mix[1] : NULL, true);
+
+    master_q(&sd->master, mix[0], data, ENGINE_BLOCK);
+    if (data_r != NULL)
+        master_q(&sd->master, mix[1], data_r, ENGINE_BLOCK);
+}
+
+// one engine block as float planes (data_r NULL in mono), in either mode
+static void render_block_f(SoundData* sd, float* data, float* data_r) {
+    if (!sd->cfg.fixed) {
+        float mix[2][ENGINE_BLOCK];
+        render_mix(sd, mix[0], data_r != NULL ? mix[1] : NULL);
+        master_f32(&sd->master, mix[0], data, ENGINE_BLOCK);
+        if (data_r != NULL)
+            master_f32(&sd->master, mix[1], data_r, ENGINE_BLOCK);
+        return;
+    }
+
+    int16_t tmp[2][ENGINE_BLOCK];
+    render_block_q(sd, tmp[0], data_r != NULL ? tmp[1] : NULL);
+    for (int i = 0; i < ENGINE_BLOCK; i ++)
+        data[i] = tmp[0][i] * (1.0f / 32768);
+    if (data_r != NULL)
+        for (int i = 0; i < ENGINE_BLOCK; i ++)
+            data_r[i] = tmp[1][i] * (1.0f / 32768);
+}
+
+// two planes into interleaved frames
+static void interleave_f32(float* out, const float* l, const float* r, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        v4f a = v4f_load(l + i, 4);
+        v4f b = v4f_load(r + i, 4);
+        v4f_store(out + 2 * i,     __builtin_shufflevector(a, b, 0, 4, 1, 5), 4);
+        v4f_store(out + 2 * i + 4, __builtin_shufflevector(a, b, 2, 6, 3, 7), 4);
+    }
+    for (; i < n; i ++) {
+        out[2 * i]     = l[i];
+        out[2 * i + 1] = r[i];
+    }
+}
+
+static void interleave_s16(int16_t* out, const int16_t* l, const int16_t* r, uint32_t n) {
+    for (uint32_t i = 0; i < n; i ++) {
+        out[2 * i]     = l[i];
+        out[2 * i + 1] = r[i];
+    }
+}
+
+void soundchip_render(SoundChip* chip, float* out, u32 blocks) {
+    SoundData* sd = *chip;
+
+    for (u32 i = 0; i < blocks; i ++) {
+        if (sd->cfg.channels == 1) {
+            render_block_f(sd, out + i * ENGINE_BLOCK, NULL);
+            continue;
+        }
+
+        float l[ENGINE_BLOCK], r[ENGINE_BLOCK];
+        render_block_f(sd, l, r);
+        interleave_f32(out + i * ENGINE_BLOCK * 2, l, r, ENGINE_BLOCK);
+    }
+}
+
+void soundchip_render_s16(SoundChip* chip, int16_t* out, u32 blocks) {
+    SoundData* sd = *chip;
+    bool stereo = sd->cfg.channels == 2;
+
+    for (u32 i = 0; i < blocks; i ++) {
+        int16_t* data = out + i * ENGINE_BLOCK * sd->cfg.channels;
+
+        int16_t planes[2][ENGINE_BLOCK];
+        int16_t* l = stereo ? planes[0] : data;
+        int16_t* r = stereo ? planes[1] : NULL;
+
+        if (sd->cfg.fixed) {
+            render_block_q(sd, l, r);
+        } else {
+            float mix[2][ENGINE_BLOCK];
+            render_mix(sd, mix[0], stereo ? mix[1] : NULL);
+            master_s16(&sd->master, mix[0], l, ENGINE_BLOCK);
+            if (stereo)
+                master_s16(&sd->master, mix[1], r, ENGINE_BLOCK);
+        }
+
+        if (stereo)
+            interleave_s16(data, l, r, ENGINE_BLOCK);
+    }
+}
+
+// resampler output to 16 bit, every `stride` samples; the master bus
+// already bounds the signal, only filter ringing is clamped here
+static void store_s16(int16_t* out, const float* in, uint32_t n, uint32_t stride) {
+    v4f lim = v4f_splat(32767);
+
+    for (uint32_t i = 0; i < n; i += 4) {
+        uint32_t k = n - i < 4 ? n - i : 4;
+        v4f x = v4f_load(in + i, k) * lim;
+        x = v4f_max(v4f_min(x, lim), -lim);
+        v4i q = __builtin_convertvector(x, v4i);
+        for (uint32_t j = 0; j < k; j ++)
+            out[(i + j) * stride] = q[j];
+    }
+}
+
+void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
+    SoundData* sd = pDevice->pUserData;
+    bool s16 = sd->cfg.format == SOUND_FORMAT_S16;
+    bool stereo = sd->cfg.channels == 2;
+
+    u64 start = stats_now_ns();
+
+    // the device may ask for any amount; engine blocks are rendered into
+    // the resampler fifos on demand. both channels are resampled as planes
+    // in lockstep. 16 bit and stereo output go through small float chunks
+    // that stay in cache
+    float chunk[2][256];
+    ma_uint32 done = 0;
+    while (done < frameCount) {
+        ma_uint32 want = frameCount - done;
+        float* dest = (float*) pOutput + done;
+        if (s16 || stereo) {
+            want = want < 256 ? want : 256;
+            dest = chunk[0];
+        }
+
+        ma_uint32 got = resampler_pull(&sd->rs[0], dest, want);
+        if (stereo)
+            resampler_pull(&sd->rs[1], chunk[1], got);
+
+        if (s16) {
+            int16_t* out = (int16_t*) pOutput + done * sd->cfg.channels;
+            store_s16(out, chunk[0], got, sd->cfg.channels);
+            if (stereo)
+                store_s16(out + 1, chunk[1], got, 2);
+        }
+        else if (stereo) {
+            interleave_f32((float*) pOutput + done * 2, chunk[0], chunk[1], got);
+        }
+        done += got;
+
+        if (got < want) {
+            float* l = resampler_push(&sd->rs[0], ENGINE_BLOCK);
+            float* r = stereo ? resampler_push(&sd->rs[1], ENGINE_BLOCK) : NULL;
+            render_block_f(sd, l, r);
+
+            if (sd->tap != NULL) {
+                int16_t pcm[ENGINE_BLOCK * 2];
+                store_s16(pcm, l, ENGINE_BLOCK, sd->cfg.channels);
+                if (stereo)
+                    store_s16(pcm + 1, r, ENGINE_BLOCK, 2);
+                pcmtap_push(&sd->tap, pcm, ENGINE_BLOCK * sd->cfg.channels * sizeof(int16_t));
+            }
+        }
+    }
+
+    u64 deadline = (u64) frameCount * 1000000000 / pDevice->sampleRate;
+    stats_record(&sd->stats, start, stats_now_ns(), deadline, frameCount);
+}
+
+static void device_open(SoundData* sd);
+
 void soundchip_write(SoundChip* chip, su12 addr, u8 val) {
     SoundData* sd = *chip;
 
-    if (addr >= 0x000 && addr <= 0x009) {
-        chwhitenoise_write(&sd->noise0, addr - 0x000, val);
+    if (sd->armed) {
+        sd->armed = false;
+        device_open(sd);
     }
-    else if (addr >= 0x00A && addr <= 0x014) {
-        chsqr_write(&sd->voice0, addr - 0x00A, val);
+
+    Shadow* sh = &sd->shadow;
+
+    if (addr == SOUND_BANK + 0x00) {
+        sh->deferred = val & 1;
+        return;
     }
-    else if (addr >= 0x015 && addr <= 0x01F) {
-        chsqr_write(&sd->voice1, addr - 0x015, val);
+    if (addr == SOUND_BANK + 0x01) {
+        shadow_commit(sh);
+        return;
     }
-    else if (addr >= 0x020 && addr <= 0x02A) {
-        chtri_write(&sd->voice2, addr - 0x020, val);
+
+    if (addr < sd->voices * VOICE_STRIDE)
+        shadow_write(sh, addr / VOICE_STRIDE, addr % VOICE_STRIDE, val);
+    else if (addr >= SOUND_MASTER && addr <= SOUND_MASTER + 0x01)
+        shadow_write(sh, BANK_MASTER, addr - SOUND_MASTER, val);
+    else if (addr >= SOUND_SEQ && addr <= SOUND_SEQ + SEQ_CONTROL)
+        shadow_write(sh, BANK_SEQ, addr - SOUND_SEQ, val);
+    else
+        return;
+
+    if (!sh->deferred)
+        shadow_commit(sh);
+}
+
+void soundchip_stats(SoundChip* chip, SoundChipStats* out) {
+    SoundData* sd = *chip;
+    CallbackStats* st = &sd->stats;
+
+    out->callbacks      = atomic_load_explicit(&st->callbacks, memory_order_relaxed);
+    out->frames         = atomic_load_explicit(&st->frames, memory_order_relaxed);
+    out->underruns      = atomic_load_explicit(&st->underruns, memory_order_relaxed);
+    out->overruns       = atomic_load_explicit(&st->overruns, memory_order_relaxed);
+    out->max_render_ns  = atomic_load_explicit(&st->max_render_ns, memory_order_relaxed);
+    out->last_render_ns = atomic_load_explicit(&st->last_render_ns, memory_order_relaxed);
+    out->active_voices  = atomic_load_explicit(&st->active_voices, memory_order_relaxed);
+    for (int i = 0; i < SOUND_HIST_BUCKETS; i ++)
+        out->hist[i] = atomic_load_explicit(&st->hist[i], memory_order_relaxed);
+
+    PcmTapStats tap = {0};
+    pthread_mutex_lock(&sd->tap_lock);
+    if (sd->tap != NULL)
+        pcmtap_stats(&sd->tap, &tap);
+    pthread_mutex_unlock(&sd->tap_lock);
+    out->tap_written = tap.written;
+    out->tap_dropped = tap.dropped;
+}
+
+static u8 stat_byte(u64 val, bool high) {
+    if (val > 0xFFFF)
+        val = 0xFFFF;
+    return high ? val >> 8 : val & 0xFF;
+}
+
+u8 soundchip_read(SoundChip* chip, su12 addr) {
+    SoundData* sd = *chip;
+    CallbackStats* st = &sd->stats;
+
+    if (addr == SOUND_BANK + 0x00)
+        return sd->shadow.deferred;
+    if (addr >= SOUND_SEQ && addr < SOUND_MASTER)
+        return seq_read(sd, addr - SOUND_SEQ);
+    if (addr < SOUND_STATUS)
+        return 0;
+
+    su12 reg = addr - SOUND_STATUS;
+    switch (reg & ~1) {
+    case 0x00:
+        return stat_byte(atomic_load_explicit(&st->underruns, memory_order_relaxed), reg & 1);
+    case 0x02:
+        return stat_byte(atomic_load_explicit(&st->overruns, memory_order_relaxed), reg & 1);
+    case 0x04:
+        return stat_byte(atomic_load_explicit(&st->max_render_ns, memory_order_relaxed) / 1000, reg & 1);
+    case 0x06:
+        return stat_byte(atomic_load_explicit(&st->last_render_ns, memory_order_relaxed) / 1000, reg & 1);
+    case 0x08:
+        if (reg == 0x08)
+            return atomic_load_explicit(&st->last_load, memory_order_relaxed);
+        return atomic_load_explicit(&st->active_voices, memory_order_relaxed);
+    default:
+        return 0;
     }
 }
 
-void soundchip_start(SoundChip* chip) {
-    SoundData* data = *chip;
+void soundchip_map(SoundChip* chip, su4 bank, const u8* host, u32 size) {
+    SoundData* sd = *chip;
+
+    sd->mem.host[bank] = host;
+    sd->mem.size[bank] = size;
+}
+
+// soundchip_stats may be looking at the tap from another thread
+static void tap_close(SoundData* sd) {
+    pthread_mutex_lock(&sd->tap_lock);
+    if (sd->tap != NULL)
+        pcmtap_close(&sd->tap);
+    pthread_mutex_unlock(&sd->tap_lock);
+}
+
+static void device_open(SoundData* data) {
+    const SoundChipConfig* cfg = &data->cfg;
+
+    // a dedicated context skips probing every platform backend
+    ma_context* ctx = NULL;
+    if (cfg->backend == SOUND_BACKEND_NULL) {
+        ma_backend null = ma_backend_null;
+        if (ma_context_init(&null, 1, NULL, &data->ctx) != MA_SUCCESS) {
+            printf("Failed to init null audio backend.\n");
+            return;
+        }
+        ctx = &data->ctx;
+    }
 
     ma_device_config deviceConfig;
 
     deviceConfig = ma_device_config_init(ma_device_type_playback);
-    deviceConfig.playback.format   = ma_format_f32;
-    deviceConfig.playback.channels = 1;
-    deviceConfig.sampleRate        = DEVICE_SAMPLE_RATE;
-    deviceConfig.dataCallback      = data_callback;
-    deviceConfig.pUserData         = data;
-
-    if (ma_device_init(NULL, &deviceConfig, &data->dev) != MA_SUCCESS) {
+    deviceConfig.playback.format      = cfg->format == SOUND_FORMAT_S16 ? ma_format_s16 : ma_format_f32;
+    deviceConfig.playback.channels    = cfg->channels;
+    deviceConfig.sampleRate           = cfg->sample_rate;
+    deviceConfig.periodSizeInFrames   = cfg->period_frames;
+    deviceConfig.periods              = cfg->periods;
+    deviceConfig.noFixedSizedCallback = true;
+    deviceConfig.dataCallback         = data_callback;
+    deviceConfig.pUserData            = data;
+
+    if (ma_device_init(ctx, &deviceConfig, &data->dev) != MA_SUCCESS) {
         printf("Failed to open playback device.\n");
+        if (ctx != NULL)
+            ma_context_uninit(ctx);
         return;
     }
 
-    printf("Device Name: %s\n", data->dev.playback.name);
+    printf("Device Name: %s (%u Hz)\n", data->dev.playback.name, data->dev.sampleRate);
+
+    for (u32 c = 0; c < cfg->channels; c ++)
+        resampler_init(&data->rs[c], ENGINE_SAMPLE_RATE, data->dev.sampleRate);
+
+    // before the device starts, so the callback sees it from the first block
+    pthread_mutex_lock(&data->tap_lock);
+    if (cfg->tap != NULL && !pcmtap_open(&data->tap, cfg->tap))
+        printf("Failed to start pcm tap to %s.\n", cfg->tap);
+    pthread_mutex_unlock(&data->tap_lock);
 
     if (ma_device_start(&data->dev) != MA_SUCCESS) {
         printf("Failed to start playback device.\n");
         ma_device_uninit(&data->dev);
+        if (ctx != NULL)
+            ma_context_uninit(ctx);
+        tap_close(data);
         return;
     }
+
+    data->open = true;
+}
+
+void soundchip_start(SoundChip* chip) {
+    SoundData* data = *chip;
+
+    if (!data->open)
+        data->armed = true;
 }
 
 void soundchip_stop(SoundChip* chip) {
     SoundData* data = *chip;
 
+    data->armed = false;
+    if (!data->open)
+        return;
+
     ma_device_uninit(&data->dev);
+    if (data->cfg.backend == SOUND_BACKEND_NULL)
+        ma_context_uninit(&data->ctx);
+    data->open = false;
+
+    // the callback is gone; flush what it left behind
+    tap_close(data);
 }
 
+void soundchip_free(SoundChip* chip) {
+    SoundData* data = *chip;
+
+    soundchip_stop(chip);
+    pthread_mutex_destroy(&data->tap_lock);
+    free(data->voice);
+    free(data);
+    *chip = NULL;
+}
+
+bool soundchip_playing(SoundChip* chip) {
+    SoundData* data = *chip;
+
+    return data->open;
+}
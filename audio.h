@@ -2,16 +2,103 @@
 
 typedef void* SoundChip;
 
+// everything is synthesized at the engine rate in blocks of ENGINE_BLOCK
+// samples (1 / 53.33 s) and resampled to whatever the device runs at
+#define ENGINE_SAMPLE_RATE  8000
+#define ENGINE_BLOCK        150
+
+#define SOUND_MAX_VOICES 64
+#define VOICE_STRIDE     0x20
+#define VOICE_REG_TYPE   0x1F
+#define SOUND_BANK       0xC00
+#define SOUND_SEQ        0xD00
+#define SOUND_MASTER     0xE00
+#define SOUND_STATUS     0xF00
+
+typedef enum {
+    SOUND_BACKEND_DEVICE, // first working platform backend
+    SOUND_BACKEND_NULL,   // no audio hardware; the callback still runs in
+                          // real time and its output is discarded
+} SoundBackend;
+
+typedef enum {
+    SOUND_FORMAT_F32,
+    SOUND_FORMAT_S16,     // converted by the chip, not the driver
+} SoundFormat;
+
+typedef struct {
+    u32 voices;         // size of the voice pool; 0 = SOUND_MAX_VOICES
+    SoundBackend backend;
+    SoundFormat format; // device sample format
+    u32 channels;       // 1 mono (default), 2 stereo with per-voice pan
+    const char* tap;    // copy of the output as raw s16 pcm at the engine rate
+                        // (interleaved in stereo) to a file, fifo or "unix:path";
+                        // NULL is off. see tap.h
+    bool fixed;         // integer synthesis; bit-identical output on every build
+
+    u32 sample_rate;    // device rate in Hz; 0 = device native
+    u32 period_frames;  // frames per device period; 0 = backend default
+    u32 periods;        // periods in the device buffer; 0 = backend default
+                        // latency ~= period_frames * periods / sample_rate
+} SoundChipConfig;
+
+void soundchip_config_default(SoundChipConfig* cfg);
+
 // setup
-void soundchip_init(SoundChip* chip);
+//  cfg may be NULL for defaults
+void soundchip_init(SoundChip* chip, const SoundChipConfig* cfg);
 
 // accessing
 //  4096 bytes = page
 void soundchip_write(SoundChip* chip, su12 addr, u8 val);
 
+// status and sequencer registers (see STATUS, SEQUENCER below);
+// everything else reads as 0
+u8 soundchip_read(SoundChip* chip, su12 addr);
+
+// interrupt raised by the sequencer since the last call; 0 if none.
+//  poll from the emulation loop and hand it to the cpu
+u8 soundchip_irq(SoundChip* chip);
+
+// lets sample voices read guest memory of `bank` in place
+//  host stays owned by the caller and must outlive the chip
+void soundchip_map(SoundChip* chip, su4 bank, const u8* host, u32 size);
+
+// rendering without a device (benchmarks, tests)
+//  out holds blocks * ENGINE_BLOCK frames at ENGINE_SAMPLE_RATE;
+//  stereo frames are interleaved left, right
+void soundchip_render(SoundChip* chip, float* out, u32 blocks);
+//  same as 16 bit pcm; with cfg.fixed this is the golden output
+void soundchip_render_s16(SoundChip* chip, int16_t* out, u32 blocks);
+
 // listening
+//  start only arms the chip: the device is opened on the first register
+//  write, so guests that never touch the sound page never pay for it
 void soundchip_start(SoundChip* chip);
 void soundchip_stop(SoundChip* chip);
+// stops the chip and releases it
+void soundchip_free(SoundChip* chip);
+// true once the device is open and running
+bool soundchip_playing(SoundChip* chip);
+
+// callback instrumentation; safe to call from any thread while playing
+#define SOUND_HIST_BUCKETS 16
+
+typedef struct {
+    u64 callbacks;
+    u64 frames;
+    u64 underruns;       // callbacks that came too late; the device ran dry
+    u64 overruns;        // callbacks that took longer than the audio they rendered
+    u32 max_render_ns;
+    u32 last_render_ns;
+    u32 active_voices;   // sounding voices in the last block
+    u64 hist[SOUND_HIST_BUCKETS]; // render time per callback;
+                                  // bucket 0: < 1 us, i: [2^(i-1), 2^i) us
+    u64 tap_written;     // pcm tap bytes delivered
+    u64 tap_dropped;     // pcm tap bytes lost while it fell behind
+} SoundChipStats;
+
+void soundchip_stats(SoundChip* chip, SoundChipStats* out);
 
 // RISE & FALL
 // ========================================================
@@ -22,6 +109,9 @@ void soundchip_stop(SoundChip* chip);
 // fall   1 byte (0-256)   ~53 needed to have 1 second fall
 //      = 4
 //
+// one unit of rise, length and fall is 1 / 53.33 s; the envelope itself
+// is evaluated per sample, so ramps are smooth
+//
 // |   |_________|   |
 // |  /|         |\  |
 // | / |         | \ |
@@ -34,36 +124,108 @@ void soundchip_stop(SoundChip* chip);
 //
 // samples are 128 bytes long
 // a sample lasts 1 / 53.33 seconds
-// (stretched to 150 samples at 8000hz sample rate)
+// (stretched to 150 samples at the 8000hz engine rate; the engine output
+//  is resampled to the native rate of the device)
+//
+// sample voices play signed 8 bit pcm straight from guest memory,
+// 128 bytes per 1 / 53.33 s at rate 32, linearly interpolated
+
+// VOICES
+// ========================================================
+//
+// every voice has the same register block; the type register
+// selects what it plays. registers a type does not use are ignored
+//
+// 0x00 trig      1 byte  virtual! plays one beat when addressed; cancels current beat
+// 0x01 freq      1 byte  not for noise
+// 0x02 rise&fall 4 byte
+// 0x06 low       1 byte  minimum allowed
+// 0x07 high      1 byte  maximum allowed
+// 0x08 echo      1 byte  hi nibble: delay of (n + 1) / 53.33 s; lo nibble: intensity; 0 is off
+// 0x09 wv length 1 byte  only for square
+// 0x0A base      2 byte  only for sample; guest address of the pcm data
+// 0x0C bank      1 byte  only for sample
+// 0x0D length    2 byte  only for sample; in bytes
+// 0x0F loop      2 byte  only for sample; offset to continue at after the end; >= length plays once
+// 0x11 rate      1 byte  only for sample; playback speed in 1/32; 32 is default
+// 0x12 pan       1 byte  only in stereo; 0 left, 128 center (default), 255 right
+// 0x13 reserved
+//  ...
+// 0x1F type      1 byte  0 off, 1 noise, 2 square, 3 triangle, 4 sample, 5 sine
+//              = 32 (VOICE_STRIDE)
 
-// NOISE CHANNELS
+// CHANNELS
 // ========================================================
 //
-// trig      1 byte  virtual! plays one beat when addressed; cancels current beat
-// rise&fall 4 byte
-// low       1 byte  minimum allowed
-// high      1 byte  maximum allowed
-// reserved  1 byte 
-//         = 8
+// voice n is at n * 0x20, for n < number of voices (up to 64)
+//
+// 0x000 - 0x01F   voice 0   noise by default
+// 0x020 - 0x03F   voice 1   square by default
+// 0x040 - 0x05F   voice 2   square by default
+// 0x060 - 0x07F   voice 3   triangle by default
+// 0x080 - 0x7FF   voice 4 - 63   off by default
+//
+// 0xC00 - 0xC01   bank
+// 0xD00 - 0xD08   sequencer
+// 0xE00 - 0xE01   master
+// 0xF00 - 0xF09   status    read only
 
-// MELODY CHANNELS
+// BANK
 // ========================================================
 //
-// sine, sqare, triangle
+// voice, master and sequencer writes land in a shadow bank first; a
+// commit hands the whole bank to the audio thread at once, so it never
+// plays a voice that is only half set up. changes take effect at the next
+// block; several triggers of a voice within one block play once
 //
-// trig      1 byte virtual! plays one beat when addressed; cancels current beat
-// freq      1 byte
-// rise&fall 4 byte
-// low       1 byte  minimum allowed
-// high      1 byte  maximum allowed
-// echo      1 byte  intensity of echo
-// wv length 1 byte  only for sqare
-//         = 10 
+// 0xC00 mode        1 byte  0 every write commits (default), 1 hold writes until commit
+// 0xC01 commit      1 byte  writing publishes the bank
 
-// CHANNELS
+// SEQUENCER
+// ========================================================
+//
+// plays a pattern from guest memory on its own. time runs on the engine
+// sample clock (8000 per second), so tempo does not depend on the host
+// and events land on the exact sample. it is not the cpu's clock: a
+// pattern only moves while the chip renders, and drifts against the
+// timer chip by however far the emulator runs ahead of the audio
+//
+// 0xD00 base        2 byte  pattern address in bank
+// 0xD02 bank        1 byte
+// 0xD03 tick        2 byte  tick length in engine samples; 1000 (125 ms) is default
+// 0xD05 int         1 byte  interrupt to trigger at the end of the pattern; nothing if 0
+// 0xD06 control     1 byte  bit 0 play, bit 1 loop; writing restarts from base
+//                           at the next block. bit 0 reads back as 0 once
+//                           the pattern stopped
+// 0xD07 position    2 byte  read only; offset of the next event
+//
+// a pattern is a byte stream of events:
+//
+// 0x00                      end; raises int, then stops or loops
+// 0x01 ticks                wait; 0 waits 256 ticks
+// 0x02 voice freq           set freq of voice and trigger it
+// 0x03 addr lo, hi, val     write any voice or master register
+//
+// unknown events and running past the mapped bank end the pattern. a
+// looping pattern without any wait is stopped
+
+// MASTER
 // ========================================================
 //
-// 0x000 - 0x009   noise   white noise 0
-// 0x00A - 0x014   voice   square wave 0
-// 0x015 - 0x01F   voice   square wave 1
-// 0x020 - 0x02A   voice   triangle wave 0
+// the sum of all voices goes through gain and a soft clip that bends
+// smoothly into +-1 (full scale is reached at 1.5 after gain)
+//
+// 0xE00 gain        1 byte  in 1/64; 64 is default
+// 0xE01 clip        1 byte  0 soft (default), 1 hard
+
+// STATUS
+// ========================================================
+//
+// read only; 2 byte values are little endian and saturate
+//
+// 0xF00 underruns   2 byte  callbacks that came too late
+// 0xF02 overruns    2 byte  callbacks that missed their deadline
+// 0xF04 max render  2 byte  longest callback in us
+// 0xF06 last render 2 byte  last callback in us
+// 0xF08 load        1 byte  last callback / deadline in 1/255
+// 0xF09 voices      1 byte  sounding voices
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audio.h"
+#include "resample.h"
+
+// headless micro benchmarks of the synthesis path
+//
+//   audio_bench [blocks] [device]
+//
+// every case renders `blocks` engine blocks per voice (default 1M).
+// startup is timed on the null backend; pass `device` to also open the
+// platform device
+
+#define NS_PER_BLOCK (1e9 * ENGINE_BLOCK / ENGINE_SAMPLE_RATE)
+
+static u8 guest[PAGE(1)];
+
+static double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// long beat; with `rise` the voice stays in its rise ramp
+static void setup_voice(SoundChip* chip, u32 n, u8 type, bool rise) {
+    su12 b = n * VOICE_STRIDE;
+
+    soundchip_write(chip, b + VOICE_REG_TYPE, type);
+    soundchip_write(chip, b + 0x01, 60 + n % 128);  // freq
+    soundchip_write(chip, b + 0x02, rise ? 255 : 0); // rise
+    soundchip_write(chip, b + 0x03, 200);            // vol
+    soundchip_write(chip, b + 0x04, 255);            // len
+    soundchip_write(chip, b + 0x05, 255);            // fall
+    soundchip_write(chip, b + 0x06, 0);              // low
+    soundchip_write(chip, b + 0x07, 255);            // high
+    soundchip_write(chip, b + 0x09, 128);            // wv length
+    soundchip_write(chip, b + 0x0B, 0x00);           // base hi
+    soundchip_write(chip, b + 0x0E, 0x10);           // length hi (4096)
+    soundchip_write(chip, b + 0x0F, 0);              // loop lo
+    soundchip_write(chip, b + 0x10, 0);              // loop hi
+}
+
+static void trigger_all(SoundChip* chip, u32 voices) {
+    for (u32 n = 0; n < voices; n ++)
+        soundchip_write(chip, n * VOICE_STRIDE, 0);
+}
+
+// returns ns per engine block; type 0 cycles through all voice types
+static double bench_ch(u32 voices, u8 type, bool rise, bool trigger, bool fixed, u32 channels, u32 blocks) {
+    SoundChipConfig cfg;
+    soundchip_config_default(&cfg);
+    cfg.voices = voices;
+    cfg.fixed = fixed;
+    cfg.channels = channels;
+
+    SoundChip chip;
+    soundchip_init(&chip, &cfg);
+    soundchip_map(&chip, 0, guest, sizeof(guest));
+
+    for (u32 n = 0; n < voices; n ++) {
+        setup_voice(&chip, n, type ? type : 1 + n % 5, rise);
+        soundchip_write(&chip, n * VOICE_STRIDE + 0x12, n * 37); // pan
+    }
+
+    static float out[ENGINE_BLOCK * 100 * 2];
+    static int16_t out_q[ENGINE_BLOCK * 100 * 2];
+
+    double total = 0;
+    for (u32 done = 0; done < blocks; ) {
+        // retrigger before the rise / hold runs out
+        if (trigger && done % 200 == 0)
+            trigger_all(&chip, voices);
+
+        // exactly `blocks`, so the time per block is not skewed
+        u32 n = blocks - done < 100 ? blocks - done : 100;
+        double start = now_ns();
+        if (fixed)
+            soundchip_render_s16(&chip, out_q, n);
+        else
+            soundchip_render(&chip, out, n);
+        total += now_ns() - start;
+        done += n;
+    }
+
+    soundchip_free(&chip);
+    return total / blocks;
+}
+
+static double bench(u32 voices, u8 type, bool rise, bool trigger, bool fixed, u32 blocks) {
+    return bench_ch(voices, type, rise, trigger, fixed, 1, blocks);
+}
+
+// init, lazy start and the first register write (which opens the device)
+static void report_startup(const char* name, SoundBackend backend) {
+    SoundChipConfig cfg;
+    soundchip_config_default(&cfg);
+    cfg.backend = backend;
+
+    double t0 = now_ns();
+    SoundChip chip;
+    soundchip_init(&chip, &cfg);
+    double t1 = now_ns();
+    soundchip_start(&chip);
+    double t2 = now_ns();
+    soundchip_write(&chip, 0x01, 60);
+    double t3 = now_ns();
+    bool playing = soundchip_playing(&chip);
+    soundchip_stop(&chip);
+    double t4 = now_ns();
+    soundchip_free(&chip);
+
+    printf("  %-18s init %8.3f ms  start %8.3f ms  first write %8.3f ms  stop %8.3f ms%s\n",
+           name, (t1 - t0) / 1e6, (t2 - t1) / 1e6, (t3 - t2) / 1e6, (t4 - t3) / 1e6,
+           playing ? "" : "  (no device)");
+}
+
+static void report_voice(const char* name, u8 type, bool rise, u32 blocks) {
+    double ns = bench(1, type, rise, true, false, blocks);
+    double ns_q = bench(1, type, rise, true, true, blocks);
+    printf("  %-18s %7.3f ns/sample  %7.3f ns/sample fixed\n",
+           name, ns / ENGINE_BLOCK, ns_q / ENGINE_BLOCK);
+}
+
+int main(int argc, char** argv) {
+    u32 blocks = 1000000;
+    if (argc > 1)
+        blocks = strtoul(argv[1], NULL, 10);
+    bool device = argc > 2 && strcmp(argv[2], "device") == 0;
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(guest); i ++)
+        guest[i] = rand();
+
+    printf("engine: %u Hz, %u samples per block (%.2f ms)\n",
+           ENGINE_SAMPLE_RATE, ENGINE_BLOCK, NS_PER_BLOCK / 1e6);
+    printf("blocks per case: %u\n\n", blocks);
+
+    printf("startup:\n");
+    report_startup("null backend", SOUND_BACKEND_NULL);
+    if (device)
+        report_startup("device", SOUND_BACKEND_DEVICE);
+
+    printf("\nper voice type (1 voice, hold):\n");
+    report_voice("noise",    1, false, blocks);
+    report_voice("square",   2, false, blocks);
+    report_voice("triangle", 3, false, blocks);
+    report_voice("sample",   4, false, blocks);
+    report_voice("sine",     5, false, blocks);
+
+    printf("\nenvelope (1 square voice, rise ramp):\n");
+    report_voice("square + ramp",  2, true, blocks);
+
+    printf("\nmixer:\n");
+    {
+        double ns = bench(SOUND_MAX_VOICES, 2, false, false, false, blocks);
+        printf("  %-18s %7.3f ns/sample\n", "64 idle voices", ns / ENGINE_BLOCK);
+    }
+
+    printf("\ndeadline (mixed voice types, share of one block):\n");
+    static const u32 counts[] = { 1, 8, 64 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(*counts); i ++) {
+        u32 voices = counts[i];
+        u32 b = blocks / voices;
+        if (b < 1000)
+            b = 1000;
+        double ns = bench(voices, 0, false, true, false, b);
+        printf("  %2u voices  %9.1f ns/block  %7.3f ns/sample/voice  %6.3f%% of deadline\n",
+               voices, ns, ns / ENGINE_BLOCK / voices, 100 * ns / NS_PER_BLOCK);
+    }
+
+    printf("\nstereo (panned, mixed voice types):\n");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(*counts); i ++) {
+        u32 voices = counts[i];
+        u32 b = blocks / voices;
+        if (b < 1000)
+            b = 1000;
+        double ns = bench_ch(voices, 0, false, true, false, 2, b);
+        double ns_q = bench_ch(voices, 0, false, true, true, 2, b);
+        printf("  %2u voices  %7.3f ns/sample/voice  %7.3f ns/sample/voice fixed\n",
+               voices, ns / ENGINE_BLOCK / voices, ns_q / ENGINE_BLOCK / voices);
+    }
+
+    printf("\nresampler (%u -> 48000 Hz):\n", ENGINE_SAMPLE_RATE);
+    {
+        static Resampler rs;
+        resampler_init(&rs, ENGINE_SAMPLE_RATE, 48000);
+
+        static float out[480];
+        u64 frames = (u64) blocks * ENGINE_BLOCK * 48000 / ENGINE_SAMPLE_RATE;
+        u64 produced = 0;
+
+        double start = now_ns();
+        while (produced < frames) {
+            u32 done = 0;
+            while (done < 480) {
+                done += resampler_pull(&rs, out + done, 480 - done);
+                if (done < 480) {
+                    float* in = resampler_push(&rs, ENGINE_BLOCK);
+                    for (u32 i = 0; i < ENGINE_BLOCK; i ++)
+                        in[i] = out[i];
+                }
+            }
+            produced += 480;
+        }
+        double ns = now_ns() - start;
+        printf("  %-18s %7.3f ns/output frame\n", "polyphase", ns / produced);
+    }
+
+    return 0;
+}
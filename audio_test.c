@@ -1,24 +1,132 @@
 #include "audio.h"
 #include <stdio.h>
+#include <string.h>
+
+// audio_test          plays a beat on every key press
+// audio_test golden   renders a fixed register script in fixed mode and
+//                     compares the output with the stored checksum
+
+// fnv-1a over the samples as little endian bytes
+#define GOLDEN_HASH   0xA468BABA1E9207F5ull
+#define GOLDEN_BLOCKS 400
+
+static u8 guest[PAGE(1)];
+
+static u64 hash_s16(u64 h, const int16_t* data, u32 n) {
+    for (u32 i = 0; i < n; i ++) {
+        u16 s = data[i];
+        h = (h ^ (s & 0xFF)) * 0x100000001B3ull;
+        h = (h ^ (s >> 8)) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+static void voice(SoundChip* chip, u32 n, u8 type, u8 freq, u8 echo, u8 pan) {
+    su12 b = n * VOICE_STRIDE;
+
+    soundchip_write(chip, b + VOICE_REG_TYPE, type);
+    soundchip_write(chip, b + 0x01, freq);
+    soundchip_write(chip, b + 0x02, 3);    // rise
+    soundchip_write(chip, b + 0x03, 70);   // vol
+    soundchip_write(chip, b + 0x04, 20);   // len
+    soundchip_write(chip, b + 0x05, 30);   // fall
+    soundchip_write(chip, b + 0x06, 10);   // low
+    soundchip_write(chip, b + 0x07, 240);  // high
+    soundchip_write(chip, b + 0x08, echo);
+    soundchip_write(chip, b + 0x09, 60);   // wv length
+    soundchip_write(chip, b + 0x12, pan);
+}
+
+static int golden(void) {
+    SoundChipConfig cfg;
+    soundchip_config_default(&cfg);
+    cfg.voices = 8;
+    cfg.channels = 2;
+    cfg.fixed = true;
+
+    SoundChip chip;
+    soundchip_init(&chip, &cfg);
+
+    // a looping saw for the sample voice, a pattern behind it
+    for (u32 i = 0; i < 256; i ++)
+        guest[i] = i * 3;
+    static const u8 pattern[] = {
+        0x02, 4, 120,               // note
+        0x01, 3,                    // wait
+        0x03, 0x28, 0x00, 0x52,     // voice 1 echo
+        0x02, 1, 90,
+        0x01, 5,
+        0x03, 0x00, 0x0E, 80,       // master gain
+        0x02, 3, 0,
+        0x01, 4,
+        0x00,
+    };
+    memcpy(guest + 0x200, pattern, sizeof(pattern));
+    soundchip_map(&chip, 0, guest, sizeof(guest));
+
+    voice(&chip, 0, 1, 0, 0x00, 128);     // noise
+    voice(&chip, 1, 2, 100, 0x36, 40);    // square with echo
+    voice(&chip, 2, 3, 140, 0x18, 200);   // triangle
+    voice(&chip, 3, 4, 0, 0x00, 128);     // sample
+    soundchip_write(&chip, 3 * VOICE_STRIDE + 0x0D, 0);   // length 256
+    soundchip_write(&chip, 3 * VOICE_STRIDE + 0x0E, 1);
+    soundchip_write(&chip, 3 * VOICE_STRIDE + 0x0F, 64);  // loop
+    soundchip_write(&chip, 3 * VOICE_STRIDE + 0x10, 0);
+    soundchip_write(&chip, 3 * VOICE_STRIDE + 0x11, 45);  // rate
+    voice(&chip, 4, 5, 150, 0x24, 0);     // sine
+    voice(&chip, 5, 2, 170, 0x00, 255);   // square
+    soundchip_write(&chip, SOUND_MASTER + 0x00, 112);
+
+    for (u32 n = 0; n < 6; n ++)
+        soundchip_write(&chip, n * VOICE_STRIDE, 0);
+
+    soundchip_write(&chip, SOUND_SEQ + 0x01, 0x02);  // base 0x200
+    soundchip_write(&chip, SOUND_SEQ + 0x03, 200);   // tick
+    soundchip_write(&chip, SOUND_SEQ + 0x04, 0);
+    soundchip_write(&chip, SOUND_SEQ + 0x06, 3);     // play, loop
+
+    static int16_t out[GOLDEN_BLOCKS * ENGINE_BLOCK * 2];
+    u64 h = 0xCBF29CE484222325ull;
+    for (u32 i = 0; i < GOLDEN_BLOCKS; i += 100) {
+        // halfway the type change must keep the programmed envelope
+        if (i == GOLDEN_BLOCKS / 2) {
+            soundchip_write(&chip, 5 * VOICE_STRIDE + VOICE_REG_TYPE, 3);
+            soundchip_write(&chip, 5 * VOICE_STRIDE, 0);
+        }
+        soundchip_render_s16(&chip, out, 100);
+        h = hash_s16(h, out, 100 * ENGINE_BLOCK * 2);
+    }
+    soundchip_free(&chip);
+
+    if (h != GOLDEN_HASH) {
+        printf("golden: %016llx, expected %016llx\n", (unsigned long long) h, GOLDEN_HASH);
+        return 1;
+    }
+    printf("golden: ok\n");
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "golden") == 0)
+        return golden();
 
-int main() {
     SoundChip chip;
-    soundchip_init(&chip);
+    soundchip_init(&chip, NULL);
 
     soundchip_start(&chip);
 
 #define NOISE_CH 0x000 
 
-    soundchip_write(&chip, NOISE_CH + 1, 2);   // rise
-    soundchip_write(&chip, NOISE_CH + 2, 255); // vol
-    soundchip_write(&chip, NOISE_CH + 3, 0);  // len
-    soundchip_write(&chip, NOISE_CH + 4, 3);  // fall
+    soundchip_write(&chip, NOISE_CH + 2, 2);   // rise
+    soundchip_write(&chip, NOISE_CH + 3, 255); // vol
+    soundchip_write(&chip, NOISE_CH + 4, 0);  // len
+    soundchip_write(&chip, NOISE_CH + 5, 3);  // fall
 
-    soundchip_write(&chip, NOISE_CH + 5, 0);   // low
-    soundchip_write(&chip, NOISE_CH + 6, 150); // high
+    soundchip_write(&chip, NOISE_CH + 6, 0);   // low
+    soundchip_write(&chip, NOISE_CH + 7, 150); // high
 
-// #define VOICE_CH 0x020  // voice2 = tri
-#define VOICE_CH 0x00A  // voice0 = square
+// #define VOICE_CH 0x060  // voice3 = tri
+#define VOICE_CH 0x020  // voice1 = square
 
     soundchip_write(&chip, VOICE_CH + 1, 180);  // freq
     soundchip_write(&chip, VOICE_CH + 2, 20);   // rise
@@ -27,7 +135,7 @@ int main() {
     soundchip_write(&chip, VOICE_CH + 5, 40);   // fall
     soundchip_write(&chip, VOICE_CH + 6, 0);    // low
     soundchip_write(&chip, VOICE_CH + 7, 255);  // high
-    soundchip_write(&chip, VOICE_CH + 8, 0);    // echo (ignored)
+    soundchip_write(&chip, VOICE_CH + 8, 0);    // echo (off)
     soundchip_write(&chip, VOICE_CH + 9, 80);   // wl (only for sqr channels
 
     while (1) {
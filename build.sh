@@ -1 +1,9 @@
-clang -lm asm.c audio.c timer.c emu.c cpu.c -o emu
+clang asm_hash_gen.c cpu.c -o asm_hash_gen && ./asm_hash_gen > asm_hash.h
+clang -lm asm.c obj.c audio.c resample.c tap.c timer.c emu.c cpu.c -o emu
+clang asm_cli.c asm.c obj.c cpu.c -o asm
+clang link_cli.c asm.c obj.c cpu.c -o asmlink
+clang -O2 -lm audio_bench.c audio.c resample.c tap.c -o audio_bench
+clang -O2 -lm audio_test.c audio.c resample.c tap.c -o audio_test && ./audio_test golden
+clang -O2 asm_bench.c asm.c cpu.c -o asm_bench
+clang asm_test.c dis.c asm.c obj.c cpu.c -o asm_test && ./asm_test
+clang -O2 dis_cli.c dis.c asm.c obj.c cpu.c -o dis
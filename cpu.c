@@ -26,63 +26,28 @@ const char* cpu_reg_names[REG_LEN] = {
 };
 
 const char* cpu_instr_names[INSTR_LEN] = {
-    [INSTR_nop]    = "nop",
-    [INSTR_mov]    = "mov",
-    [INSTR_imm_b]  = "imm.b",
-    [INSTR_imm_w]  = "imm.w",
-    [INSTR_lod_b]  = "lod.b",
-    [INSTR_lod_w]  = "lod.w",
-    [INSTR_sto_b]  = "sto.b",
-    [INSTR_sto_w]  = "sto.w",
-    [INSTR_addi_b] = "addi.b",
-    [INSTR_addi_w] = "addi.w",
-    [INSTR_add]    = "add",
-    [INSTR_subi_b] = "subi.b",
-    [INSTR_subi_w] = "subi.w",
-    [INSTR_sub]    = "sub",
-    [INSTR_clr]    = "clr",
-    [INSTR_sl4]    = "sl4",
-    [INSTR_sr4]    = "sr4",
-    [INSTR_sez]    = "sez",
-    [INSTR_clz]    = "clz",
-    [INSTR_inz]    = "inz",
-    [INSTR_not]    = "not",
-    [INSTR_and]    = "and",
-    [INSTR_andi_b] = "andi.b",
-    [INSTR_andi_w] = "andi.w",
-    [INSTR_orr]    = "orr",
-    [INSTR_shl]    = "shl",
-    [INSTR_shli_b] = "shli.b",
-    [INSTR_shr]    = "shr",
-    [INSTR_shri_b] = "shri.b",
-    [INSTR_xor]    = "xor",
-    [INSTR_sxt]    = "sxt",
-    [INSTR_btsi_b] = "btsi.b",
-    [INSTR_bts]    = "bts",
-    [INSTR_btti_b] = "btti.b",
-    [INSTR_btt]    = "btt",
-    [INSTR_tst]    = "tst",
-    [INSTR_tstm_b] = "tstm.b",
-    [INSTR_tstm_w] = "tstm.w",
-    [INSTR_ceq]    = "ceq",
-    [INSTR_clt]    = "clt",
-    [INSTR_cgt]    = "cgt",
-    [INSTR_psh_b]  = "psh.b",
-    [INSTR_pshi_b] = "pshi.b",
-    [INSTR_psh_w]  = "psh.w",
-    [INSTR_pshi_w] = "pshi.w",
-    [INSTR_pll_b]  = "pll.b",
-    [INSTR_pll_w]  = "pll.w",
-    [INSTR_jmp]    = "jmp",
-    [INSTR_jmz]    = "jmz",
-    [INSTR_jnz]    = "jnz",
-    [INSTR_cal]    = "cal",
-    [INSTR_ret]    = "ret",
-    [INSTR_int]    = "int",
-    [INSTR_rti]    = "rti",
-    [INSTR_jmf]    = "jmf",
+#define X(id, name, opcode, operands, first, flow) [opcode] = name,
+    CPU_ISA(X)
+#undef X
 };
 
+#define CPU_OPND(kind) OPND_##kind,
+#define CPU_COUNT(kind) + 1
+
+const CPU_Instr_Info cpu_instr_info[256] = {
+#define X(id, mnemonic, opcode, fmt, use, next) \
+    [opcode] = {                                  \
+        .name = mnemonic,                         \
+        .nops = 0 CPU_FMT_##fmt(CPU_COUNT),       \
+        .ops = { CPU_FMT_##fmt(CPU_OPND) },       \
+        .first = USE_##use,                       \
+        .flow = FLOW_##next,                      \
+    },
+    CPU_ISA(X)
+#undef X
+};
+
+
 void cpu_inter(CPU *cpu, CPU_Intr_Kind kind) {
     if (!cpu->regs[REG_INTl]) {
         cpu_reset(cpu);
@@ -322,6 +287,42 @@ locked:
     return true;
 }
 
+// what the decoder read; reg in order of appearance
+typedef struct {
+    u8 reg[CPU_MAX_OPS];
+    u8 nreg;
+    u16 val;        // the last immediate or register operand, as 16 bits
+    bigaddr addr;
+} CPU_Operands;
+
+static inline void cpu_fetch_REG(CPU* cpu, CPU_Operands* o, bool* bad) {
+    bool fail;
+    u8 reg = cpu_instr_byte(&fail, cpu);
+    o->reg[o->nreg ++] = reg;
+    o->val = cpu->regs[reg];
+    *bad |= fail;
+}
+
+static inline void cpu_fetch_BYTE(CPU* cpu, CPU_Operands* o, bool* bad) {
+    bool fail;
+    o->val = cpu_instr_byte(&fail, cpu);
+    *bad |= fail;
+}
+
+static inline void cpu_fetch_WORD(CPU* cpu, CPU_Operands* o, bool* bad) {
+    bool fail;
+    o->val = cpu_instr_word(&fail, cpu);
+    *bad |= fail;
+}
+
+static inline void cpu_fetch_ADDR(CPU* cpu, CPU_Operands* o, bool* bad) {
+    bool fail;
+    o->addr = cpu_instr_addr(&fail, cpu);
+    *bad |= fail;
+}
+
+#define CPU_FETCH(kind) cpu_fetch_##kind(cpu, &o, &bad);
+
 void cpu_step(CPU* cpu) {
     bool fail;
     
@@ -329,557 +330,179 @@ void cpu_step(CPU* cpu) {
     if (fail)
         return;
 
+    // every operand is read, even past a fault, so pc ends up past them
+    CPU_Operands o = {0};
+    bool bad = false;
     switch (opcode) {
-    case INSTR_nop: // nop
-        {
-
-        } break;
-
-    case INSTR_mov: // mov
-        {
-            u8 dest = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u8 src = cpu_instr_byte(&fail, cpu);
-            if (fail || pf)
-                return;
-
-            if (cpu_reg_locked(cpu, dest))
-                return;
-
-            cpu->regs[dest] = cpu->regs[src];
-        } break;
-
-    case INSTR_imm_b: // imm.b
-        {
-            u8 dest = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u8 val = cpu_instr_byte(&fail, cpu);
-            if (fail || pf)
-                return;
-
-            if (cpu_reg_locked(cpu, dest))
-               return;
-
-            cpu->regs[dest] = val;
-        } break;
+#define X(id, mnemonic, code, fmt, use, next) \
+    case INSTR_##id: CPU_FMT_##fmt(CPU_FETCH) break;
+    CPU_ISA(X)
+#undef X
+    default:
+        return;
+    }
+    if (bad)
+        return;
 
-    case INSTR_imm_w: // imm.w
-        {
-            u8 dest = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
+    CPU_Operand_Use use = cpu_instr_info[opcode].first;
+    if ((use == USE_OUT || use == USE_INOUT) && cpu_reg_locked(cpu, o.reg[0]))
+        return;
 
-            u16 val = cpu_instr_word(&fail, cpu);
+    su20* opr = &cpu->regs[o.reg[0]];
 
-            if (cpu_reg_locked(cpu, dest) || fail || pf)
-                return;
+    switch (opcode) {
+    case INSTR_mov:
+        *opr = cpu->regs[o.reg[1]];
+        break;
 
-            cpu->regs[dest] = val;
-        } break;
+    case INSTR_imm_b:
+    case INSTR_imm_w:
+        *opr = o.val;
+        break;
 
-    case INSTR_lod_b: // lod.b
+    case INSTR_lod_b:
         {
-            u8 dest = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            bigaddr addr = cpu_instr_addr(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, dest) || fail || pf)
-                return;
-
-            u8 val = readsafe(&fail, cpu, addr.addr, addr.bank);
+            u8 val = readsafe(&fail, cpu, o.addr.addr, o.addr.bank);
             if (fail)
                 return;
 
-            cpu->regs[dest] = val;
+            *opr = val;
         } break;
 
-    case INSTR_lod_w: // lod.w
+    case INSTR_lod_w:
         {
-            u8 dest = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            bigaddr addr = cpu_instr_addr(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, dest) || fail || pf)
-                return;
-
-            u8 low = readsafe(&fail, cpu, addr.addr, addr.bank);
+            u8 low = readsafe(&fail, cpu, o.addr.addr, o.addr.bank);
             if (fail)
                 return;
-            u8 high = readsafe(&fail, cpu, addr.addr + 1, addr.bank);
+            u8 high = readsafe(&fail, cpu, o.addr.addr + 1, o.addr.bank);
             if (fail)
                 return;
 
-            cpu->regs[dest] = MK16(low, high);
+            *opr = MK16(low, high);
         } break;
 
-    case INSTR_sto_b: // sto.b
-        {
-            bigaddr addr = cpu_instr_addr(&fail, cpu);
-            bool pf = fail;
-
-            u8 src = cpu_instr_byte(&fail, cpu);
-            if (fail || pf)
-                return;
-
-            u8 val = cpu->regs[src];
-
-            writesafe(&fail, cpu, addr.addr, addr.bank, val);
-        } break;
-
-    case INSTR_sto_w: // sto.w
-        {
-            bigaddr addr = cpu_instr_addr(&fail, cpu);
-            bool pf = fail;
-
-            u8 src = cpu_instr_byte(&fail, cpu);
-            if (fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-            u8 low = val & 0xFF;
-            u8 high = (val >> 8) & 0xFF;
-
-            writesafe(&fail, cpu, addr.addr, addr.bank, low);
-            if (fail)
-                return;
-
-            writesafe(&fail, cpu, addr.addr + 1, addr.bank, high);
-        } break;
-
-    case INSTR_addi_b: // [opr:  reg],    [val:   8b  imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u8 val = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            cpu->regs[opr] += val;
-        } break;
+    case INSTR_sto_b:
+        writesafe(&fail, cpu, o.addr.addr, o.addr.bank, o.val & 0xFF);
+        break;
 
-    case INSTR_addi_w: // [opr:  reg],    [val:   16b imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u16 val = cpu_instr_word(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val += val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_add: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 src = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val += val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_subi_b: // [opr:  reg],    [val:   8b  imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 val = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val -= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_subi_w: // [opr:  reg],    [val:   16b imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u16 val = cpu_instr_word(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val -= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_sub: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 src = cpu_instr_byte(&fail, cpu);
+    case INSTR_sto_w:
+        writesafe(&fail, cpu, o.addr.addr, o.addr.bank, o.val & 0xFF);
+        if (fail)
+            return;
 
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
+        writesafe(&fail, cpu, o.addr.addr + 1, o.addr.bank, (o.val >> 8) & 0xFF);
+        break;
 
-            u16 val = cpu->regs[src];
+    // the full register; the rest of the arithmetic wraps at 16 bits
+    case INSTR_addi_b:
+        *opr += o.val;
+        break;
 
-            u16 opr_val = cpu->regs[opr];
-            opr_val -= val;
-            cpu->regs[opr] = opr_val;
-        } break;
+    case INSTR_addi_w:
+    case INSTR_add:
+        *opr = (u16) (*opr + o.val);
+        break;
 
-    case INSTR_clr: // [dest: reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            if (fail || cpu_reg_locked(cpu, opr))
-                return;
-
-            cpu->regs[opr] = 0;
-        } break;
-
-    case INSTR_sl4: // [opr:  reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            if (fail || cpu_reg_locked(cpu, opr))
-                return;
+    case INSTR_subi_b:
+    case INSTR_subi_w:
+    case INSTR_sub:
+        *opr = (u16) (*opr - o.val);
+        break;
 
-            cpu->regs[opr] <<= 4;
-        } break;
+    case INSTR_clr:
+        *opr = 0;
+        break;
 
-    case INSTR_sr4: // [opr:  reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            if (fail || cpu_reg_locked(cpu, opr))
-                return;
+    case INSTR_sl4:
+        *opr <<= 4;
+        break;
 
-            cpu->regs[opr] >>= 4;
-        } break;
+    case INSTR_sr4:
+        *opr >>= 4;
+        break;
 
     case INSTR_sez:
-        {
-            CPU_Reg_Flag flags;
-            flags.byte = cpu->regs[REG_FL];
-
-            flags.zero = true;
-
-            cpu->regs[REG_FL] = flags.byte;
-        } break;
-
     case INSTR_clz:
-        {
-            CPU_Reg_Flag flags;
-            flags.byte = cpu->regs[REG_FL];
-
-            flags.zero = false;
-
-            cpu->regs[REG_FL] = flags.byte;
-        } break;
-
     case INSTR_inz:
         {
             CPU_Reg_Flag flags;
             flags.byte = cpu->regs[REG_FL];
 
-            flags.zero ^= 1;
+            if (opcode == INSTR_inz)
+                flags.zero ^= 1;
+            else
+                flags.zero = opcode == INSTR_sez;
 
             cpu->regs[REG_FL] = flags.byte;
         } break;
 
-    case INSTR_not: // [opr:  reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            if (fail || cpu_reg_locked(cpu, opr))
-                return;
-
-            cpu->regs[opr] = ~ cpu->regs[opr];
-        } break;
-
-    case INSTR_and: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 src = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val &= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_andi_b: // [opr:  reg],    [val:   8b  imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u8 val = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val &= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_andi_w: // [opr:  reg],    [val:   16b imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u16 val = cpu_instr_word(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val &= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_orr: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 src = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val |= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_shl: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 src = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val <<= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_shli_b: // [opr:  reg],    [val:   8b  imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
+    case INSTR_not:
+        *opr = ~ *opr;
+        break;
 
-            u8 val = cpu_instr_byte(&fail, cpu);
+    case INSTR_and:
+    case INSTR_andi_b:
+    case INSTR_andi_w:
+        *opr = (u16) (*opr & o.val);
+        break;
 
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
+    case INSTR_orr:
+        *opr = (u16) (*opr | o.val);
+        break;
 
-            u16 opr_val = cpu->regs[opr];
-            opr_val <<= val;
-            cpu->regs[opr] = opr_val;
-        } break;
+    case INSTR_shl:
+    case INSTR_shli_b:
+        *opr = (u16) ((u16) *opr << o.val);
+        break;
 
-    case INSTR_shr: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
+    case INSTR_shr:
+    case INSTR_shri_b:
+        *opr = (u16) ((u16) *opr >> o.val);
+        break;
 
-            u8 src = cpu_instr_byte(&fail, cpu);
+    case INSTR_xor:
+        *opr = (u16) (*opr ^ o.val);
+        break;
 
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val >>= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_shri_b: // [opr:  reg],    [val:   8b  imm]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-
-            u8 val = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
+    case INSTR_sxt:
+        fprintf(stderr, "sxt not implemented!\n");
+        break;
 
-            u16 opr_val = cpu->regs[opr];
-            opr_val >>= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_xor: // [opr:  reg],    [src:   reg]
-        {
-            CPU_Reg opr = cpu_instr_byte(&fail, cpu);
-            bool pf = fail;
-           
-            u8 src = cpu_instr_byte(&fail, cpu);
-
-            if (cpu_reg_locked(cpu, opr) || fail || pf)
-                return;
-
-            u16 val = cpu->regs[src];
-
-            u16 opr_val = cpu->regs[opr];
-            opr_val ^= val;
-            cpu->regs[opr] = opr_val;
-        } break;
-
-    case INSTR_sxt: // [dest: reg],    [src:   reg]
-        {
-            fprintf(stderr, "sxt not implemented!\n");
-        } break;
-
-    case INSTR_btsi_b: // [src:  reg],    [index: 8b  imm]
-        {
-
-        } break;
-
-    case INSTR_bts: // [src:  reg],    [index: reg]
-        {
-
-        } break;
-
-    case INSTR_btti_b: // [dst:  reg],    [index: 8b  imm]
-        {
-
-        } break;
-
-    case INSTR_btt: // [dst:  reg],    [index: reg]
-        {
-
-        } break;
-
-    case INSTR_tst: // [src:  reg]
-        {
-
-        } break;
-
-    case INSTR_tstm_b: // [src:  addr]
-        {
-
-        } break;
-
-    case INSTR_tstm_w: // [src:  addr]
-        {
+    case INSTR_jmp:
+        cpu->regs[REG_PC] = o.addr.addr;
+        cpu->regs[REG_PCb] = o.addr.bank;
+        break;
 
-        } break;
-
-    case INSTR_ceq: // [a:    reg],    [b:     reg]
-        {
-
-        } break;
-
-    case INSTR_clt: // [a:    reg],    [b:     reg]
-        {
-
-        } break;
-
-    case INSTR_cgt: // [a:    reg],    [b:     reg]
-        {
-
-        } break;
-
-    case INSTR_psh_b: // [val:  reg]
-        {
-
-        } break;
-
-    case INSTR_pshi_b: // [val:  i8  imm]
-        {
-
-        } break;
-
-    case INSTR_psh_w : // [val:  reg]
-        {
-
-        } break;
-
-    case INSTR_pshi_w: // [val:  i16 imm]
-        {
-
-        } break;
-
-    case INSTR_pll_b: // [dest: reg]
-        {
-
-        } break;
-
-    case INSTR_pll_w: // [dest: reg]
-        {
-
-        } break;
-
-    case INSTR_jmp: // [addr: addr]
-        {
-            bigaddr addr = cpu_instr_addr(&fail, cpu);
-            if (fail)
-                return;
-
-            cpu->regs[REG_PC] = addr.addr;
-            cpu->regs[REG_PCb] = addr.bank;
-        } break;
-
-    case INSTR_jmz: // [addr: addr]
-        {
-
-        } break;
-
-    case INSTR_jnz: // [addr: addr]
-        {
-
-        } break;
-
-    case INSTR_cal: // [addr: addr]
-        {
-
-        } break;
-
-    case INSTR_ret:
-        {
-
-        } break;
-
-    case INSTR_int: // [id:   8b  imm]
-        {
-
-        } break;
-
-    case INSTR_rti:
-        {
-
-        } break;
-
-    case INSTR_jmf: // [addr: addr],   [bank:  8b  imm]
-        {
+    // decoded, not yet implemented
+    default:
+        break;
+    }
+}
 
-        } break;
+u32 cpu_instr_size(const u8* code, u32 len) {
+    if (len == 0)
+        return 0;
+    const CPU_Instr_Info* info = &cpu_instr_info[code[0]];
+    if (info->name == NULL)
+        return 0;
+
+    u32 size = 1;
+    for (u32 i = 0; i < info->nops; i ++) {
+        switch (info->ops[i]) {
+        case OPND_REG:
+        case OPND_BYTE:
+            size += 1;
+            break;
+        case OPND_WORD:
+            size += 2;
+            break;
+        default:
+            if (size >= len)
+                return 0;
+            CPU_Instr_Addr_Header h = { .byte = code[size] };
+            size += h.type == SRCTY_REGISTER ? 2 : 3;
+            break;
+        }
     }
+    return size <= len ? size : 0;
 }
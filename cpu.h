@@ -106,66 +106,130 @@ typedef union {
     } __attribute__((packed));
 } __attribute__((packed)) CPU_Instr_Addr_Header;
 
+// the instruction set, once. the opcode enum, the names, the decoder in
+// cpu_step, the assembler's operand checks and the disassembler all
+// expand this table, so a new op is one line here plus what it does
+//
+//   X(id, name, opcode, operands, first, flow)
+//
+// operands: a CPU_FMT_ list below, in encoding order
+// first:    what the op does to its first register operand
+// flow:     NEXT falls through, BRANCH may jump, JUMP never falls through,
+//           CALL comes back with anything changed
+#define CPU_ISA(X) \
+    X(nop,    "nop",    0b00000000, NONE, NONE,  NEXT)   \
+    X(mov,    "mov",    0b00000001, RR,   OUT,   NEXT)   \
+    X(imm_b,  "imm.b",  0b00000010, RB,   OUT,   NEXT)   \
+    X(imm_w,  "imm.w",  0b00000011, RW,   OUT,   NEXT)   \
+    X(lod_b,  "lod.b",  0b00000100, RA,   OUT,   NEXT)   \
+    X(lod_w,  "lod.w",  0b00000101, RA,   OUT,   NEXT)   \
+    X(sto_b,  "sto.b",  0b00000110, AR,   IN,    NEXT)   \
+    X(sto_w,  "sto.w",  0b00000111, AR,   IN,    NEXT)   \
+    X(addi_b, "addi.b", 0b00001000, RB,   INOUT, NEXT)   \
+    X(addi_w, "addi.w", 0b00001001, RW,   INOUT, NEXT)   \
+    X(add,    "add",    0b00001010, RR,   INOUT, NEXT)   \
+    X(subi_b, "subi.b", 0b00001100, RB,   INOUT, NEXT)   \
+    X(subi_w, "subi.w", 0b00001101, RW,   INOUT, NEXT)   \
+    X(sub,    "sub",    0b00001110, RR,   INOUT, NEXT)   \
+    X(clr,    "clr",    0b00010000, R,    OUT,   NEXT)   \
+    X(sl4,    "sl4",    0b00010001, R,    INOUT, NEXT)   \
+    X(sr4,    "sr4",    0b00010010, R,    INOUT, NEXT)   \
+    X(sez,    "sez",    0b00010011, NONE, NONE,  NEXT)   \
+    X(clz,    "clz",    0b00010100, NONE, NONE,  NEXT)   \
+    X(inz,    "inz",    0b00010101, NONE, NONE,  NEXT)   \
+    X(not,    "not",    0b00100000, R,    INOUT, NEXT)   \
+    X(and,    "and",    0b00100001, RR,   INOUT, NEXT)   \
+    X(andi_b, "andi.b", 0b00100010, RB,   INOUT, NEXT)   \
+    X(andi_w, "andi.w", 0b00100011, RW,   INOUT, NEXT)   \
+    X(orr,    "orr",    0b00100100, RR,   INOUT, NEXT)   \
+    X(shl,    "shl",    0b00100111, RR,   INOUT, NEXT)   \
+    X(shli_b, "shli.b", 0b00101000, RB,   INOUT, NEXT)   \
+    X(shr,    "shr",    0b00101001, RR,   INOUT, NEXT)   \
+    X(shri_b, "shri.b", 0b00101010, RB,   INOUT, NEXT)   \
+    X(xor,    "xor",    0b00101011, RR,   INOUT, NEXT)   \
+    X(sxt,    "sxt",    0b00101101, RR,   OUT,   NEXT)   \
+    X(btsi_b, "btsi.b", 0b00110000, RB,   IN,    NEXT)   \
+    X(bts,    "bts",    0b00110001, RR,   IN,    NEXT)   \
+    X(btti_b, "btti.b", 0b00110010, RB,   INOUT, NEXT)   \
+    X(btt,    "btt",    0b00110011, RR,   INOUT, NEXT)   \
+    X(tst,    "tst",    0b01000000, R,    IN,    NEXT)   \
+    X(tstm_b, "tstm.b", 0b01000001, A,    NONE,  NEXT)   \
+    X(tstm_w, "tstm.w", 0b01000010, A,    NONE,  NEXT)   \
+    X(ceq,    "ceq",    0b01000011, RR,   IN,    NEXT)   \
+    X(clt,    "clt",    0b01000101, RR,   IN,    NEXT)   \
+    X(cgt,    "cgt",    0b01000111, RR,   IN,    NEXT)   \
+    X(psh_b,  "psh.b",  0b01010000, R,    IN,    NEXT)   \
+    X(pshi_b, "pshi.b", 0b01010001, B,    NONE,  NEXT)   \
+    X(psh_w,  "psh.w",  0b01010010, R,    IN,    NEXT)   \
+    X(pshi_w, "pshi.w", 0b01010011, W,    NONE,  NEXT)   \
+    X(pll_b,  "pll.b",  0b01010100, R,    OUT,   NEXT)   \
+    X(pll_w,  "pll.w",  0b01010101, R,    OUT,   NEXT)   \
+    X(jmp,    "jmp",    0b01100000, A,    NONE,  JUMP)   \
+    X(jmz,    "jmz",    0b01100001, A,    NONE,  BRANCH) \
+    X(jnz,    "jnz",    0b01100010, A,    NONE,  BRANCH) \
+    X(cal,    "cal",    0b01100011, A,    NONE,  CALL)   \
+    X(ret,    "ret",    0b01100100, NONE, NONE,  JUMP)   \
+    X(int,    "int",    0b01100101, B,    NONE,  CALL)   \
+    X(rti,    "rti",    0b01100110, NONE, NONE,  JUMP)   \
+    X(jmf,    "jmf",    0b01100111, AB,   NONE,  JUMP)
+
+// operand formats: REG a register byte, BYTE and WORD an 8 and a 16 bit
+// immediate, ADDR an address header followed by a register byte or a word
+#define CPU_FMT_NONE(O)
+#define CPU_FMT_R(O)    O(REG)
+#define CPU_FMT_RR(O)   O(REG) O(REG)
+#define CPU_FMT_RB(O)   O(REG) O(BYTE)
+#define CPU_FMT_RW(O)   O(REG) O(WORD)
+#define CPU_FMT_RA(O)   O(REG) O(ADDR)
+#define CPU_FMT_AR(O)   O(ADDR) O(REG)
+#define CPU_FMT_A(O)    O(ADDR)
+#define CPU_FMT_B(O)    O(BYTE)
+#define CPU_FMT_W(O)    O(WORD)
+#define CPU_FMT_AB(O)   O(ADDR) O(BYTE)
+
+#define CPU_MAX_OPS 2
+
 typedef enum {
-    INSTR_nop    = 0b00000000,
-    INSTR_mov    = 0b00000001, // [dest: reg],    [src:   reg]
-    INSTR_imm_b  = 0b00000010, // [dest: reg],    [val:   8b  imm]
-    INSTR_imm_w  = 0b00000011, // [dest: reg],    [val:   16b imm]
-    INSTR_lod_b  = 0b00000100, // [dest: reg],    [src:   addr]
-    INSTR_lod_w  = 0b00000101, // [dest: reg],    [src:   addr]
-    INSTR_sto_b  = 0b00000110, // [dest: addr],   [src:   reg]
-    INSTR_sto_w  = 0b00000111, // [dest: addr],   [src:   reg]
-    INSTR_addi_b = 0b00001000, // [opr:  reg],    [val:   8b  imm]
-    INSTR_addi_w = 0b00001001, // [opr:  reg],    [val:   16b imm]
-    INSTR_add    = 0b00001010, // [opr:  reg],    [src:   reg]
-    INSTR_subi_b = 0b00001100, // [opr:  reg],    [val:   8b  imm]
-    INSTR_subi_w = 0b00001101, // [opr:  reg],    [val:   16b imm]
-    INSTR_sub    = 0b00001110, // [opr:  reg],    [src:   reg]
-    INSTR_clr    = 0b00010000, // [dest: reg]
-    INSTR_sl4    = 0b00010001, // [opr:  reg]
-    INSTR_sr4    = 0b00010010, // [opr:  reg]
-    INSTR_sez    = 0b00010011,
-    INSTR_clz    = 0b00010100,
-    INSTR_inz    = 0b00010101,
-    INSTR_not    = 0b00100000, // [opr:  reg]
-    INSTR_and    = 0b00100001, // [opr:  reg],    [src:   reg]
-    INSTR_andi_b = 0b00100010, // [opr:  reg],    [val:   8b  imm]
-    INSTR_andi_w = 0b00100011, // [opr:  reg],    [val:   16b imm]
-    INSTR_orr    = 0b00100100, // [opr:  reg],    [src:   reg]
-    INSTR_shl    = 0b00100111, // [opr:  reg],    [src:   reg]
-    INSTR_shli_b = 0b00101000, // [opr:  reg],    [val:   8b  imm]
-    INSTR_shr    = 0b00101001, // [opr:  reg],    [src:   reg]
-    INSTR_shri_b = 0b00101010, // [opr:  reg],    [val:   8b  imm]
-    INSTR_xor    = 0b00101011, // [opr:  reg],    [src:   reg]
-    INSTR_sxt    = 0b00101101, // [dest: reg],    [src:   reg]
-    INSTR_btsi_b = 0b00110000, // [src:  reg],    [index: 8b  imm]
-    INSTR_bts    = 0b00110001, // [src:  reg],    [index: reg]
-    INSTR_btti_b = 0b00110010, // [dst:  reg],    [index: 8b  imm]
-    INSTR_btt    = 0b00110011, // [dst:  reg],    [index: reg]
-    INSTR_tst    = 0b01000000, // [src:  reg]
-    INSTR_tstm_b = 0b01000001, // [src:  addr]
-    INSTR_tstm_w = 0b01000010, // [src:  addr]
-    INSTR_ceq    = 0b01000011, // [a:    reg],    [b:     reg]
-    INSTR_clt    = 0b01000101, // [a:    reg],    [b:     reg]
-    INSTR_cgt    = 0b01000111, // [a:    reg],    [b:     reg]
-    INSTR_psh_b  = 0b01010000, // [val:  reg]
-    INSTR_pshi_b = 0b01010001, // [val:  i8  imm]
-    INSTR_psh_w  = 0b01010010, // [val:  reg]
-    INSTR_pshi_w = 0b01010011, // [val:  i16 imm]
-    INSTR_pll_b  = 0b01010100, // [dest: reg]
-    INSTR_pll_w  = 0b01010101, // [dest: reg]
-    INSTR_jmp    = 0b01100000, // [addr: addr]
-    INSTR_jmz    = 0b01100001, // [addr: addr]
-    INSTR_jnz    = 0b01100010, // [addr: addr]
-    INSTR_cal    = 0b01100011, // [addr: addr]
-    INSTR_ret    = 0b01100100,
-    INSTR_int    = 0b01100101, // [id:   8b  imm]
-    INSTR_rti    = 0b01100110,
-    INSTR_jmf    = 0b01100111, // [addr: addr],   [bank:  8b  imm]
+#define X(id, name, opcode, operands, first, flow) INSTR_##id = opcode,
+    CPU_ISA(X)
+#undef X
 
     INSTR_LEN    = 0b01101000,
 } CPU_Instr_Kind;
 
+typedef enum : u8 {
+    OPND_NONE,
+    OPND_REG,
+    OPND_BYTE,
+    OPND_WORD,
+    OPND_ADDR,
+} CPU_Operand_Kind;
+
+typedef enum : u8 {
+    USE_NONE,
+    USE_IN,
+    USE_OUT,
+    USE_INOUT,
+} CPU_Operand_Use;
+
+typedef enum : u8 {
+    FLOW_NEXT,
+    FLOW_BRANCH,
+    FLOW_JUMP,
+    FLOW_CALL,
+} CPU_Instr_Flow;
+
+typedef struct {
+    const char* name;   // NULL for no instruction
+    u8 nops;
+    CPU_Operand_Kind ops[CPU_MAX_OPS];
+    CPU_Operand_Use first;
+    CPU_Instr_Flow flow;
+} CPU_Instr_Info;
+
+// by opcode, all 256 of them
+extern const CPU_Instr_Info cpu_instr_info[256];
+
 extern const char* cpu_instr_names[INSTR_LEN];
 
 typedef struct {
@@ -187,4 +251,8 @@ CPU_Page_Entry cpu_page(CPU *cpu, u8 id);
 CPU_Page_Entry cpu_page_at(CPU *cpu, u16 addr, su4 bank);
 void cpu_step(CPU *cpu);
 
+// bytes the instruction at code takes, the source an address header picks
+// included; 0 for no instruction, or when len runs out before its end
+u32 cpu_instr_size(const u8* code, u32 len);
+
 #endif
@@ -0,0 +1,680 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dis.h"
+
+/* ============================================================
+ * text
+ * ============================================================ */
+
+// by hand rather than printf: this is the whole cost of a line. the
+// pieces are rendered once and copied as fixed 8 byte blocks; a line
+// always has room past its end for the overrun
+
+typedef struct {
+    char text[8];
+    u32 len;
+} DisWord;
+
+#define DIS_WORD(s) { s, sizeof(s) - 1 }
+
+// the op names with the space before the first operand
+static const DisWord mnemonics[256] = {
+#define X(id, mnemonic, opcode, fmt, use, next) [opcode] = DIS_WORD(mnemonic " "),
+    CPU_ISA(X)
+#undef X
+};
+
+static DisWord reg_words[256];  // names; ones without have no syntax, regN
+static DisWord dec_words[256];
+static char hex_pairs[256][2];
+static pthread_once_t words_once = PTHREAD_ONCE_INIT;
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static void words_init(void) {
+    for (u32 i = 0; i < 256; i ++) {
+        DisWord* w = &reg_words[i];
+        if (i < REG_LEN && cpu_reg_names[i] != NULL)
+            w->len = snprintf(w->text, sizeof(w->text), "%s", cpu_reg_names[i]);
+        else
+            w->len = snprintf(w->text, sizeof(w->text), "reg%u", i);
+        dec_words[i].len = snprintf(dec_words[i].text, sizeof(dec_words[i].text), "%u", i);
+        hex_pairs[i][0] = hex_digits[i >> 4];
+        hex_pairs[i][1] = hex_digits[i & 15];
+    }
+}
+
+static char* put_word(char* p, const DisWord* w) {
+    memcpy(p, w->text, sizeof(w->text));
+    return p + w->len;
+}
+
+// 2 or 4 digits
+static char* put_hex(char* p, u32 val, u32 digits) {
+    if (digits == 4) {
+        memcpy(p, hex_pairs[val >> 8 & 0xFF], 2);
+        p += 2;
+    }
+    memcpy(p, hex_pairs[val & 0xFF], 2);
+    return p + 2;
+}
+
+static char* put_dec(char* p, u32 val) {
+    if (val < 256)
+        return put_word(p, &dec_words[val]);
+    char tmp[10];
+    u32 n = 0;
+    do {
+        tmp[n ++] = '0' + val % 10;
+        val /= 10;
+    } while (val != 0);
+    while (n > 0)
+        *p ++ = tmp[-- n];
+    return p;
+}
+
+#define put_str(p, s) (memcpy((p), (s), sizeof(s) - 1), (p) + sizeof(s) - 1)
+
+static const DisWord rel_words[8] = {
+    [ADDRMD_ABSOLUTE] = DIS_WORD("["),
+    [ADDRMD_PC_REL]   = DIS_WORD("[pc + "),
+    [ADDRMD_SP_REL]   = DIS_WORD("[sp + "),
+    [ADDRMD_PT_REL]   = DIS_WORD("[pt + "),
+    [ADDRMD_IT_REL]   = DIS_WORD("[it + "),
+    [ADDRMD_INDEXED]  = DIS_WORD("["),
+    [6]               = DIS_WORD("[mode6 "),
+    [7]               = DIS_WORD("[mode7 "),
+};
+
+// the header and its source; returns the bytes they took
+static u32 put_addr(char** out, const u8* code) {
+    CPU_Instr_Addr_Header h = { .byte = code[0] };
+    char* p = put_word(*out, &rel_words[h.mode]);
+
+    if (h.mode == ADDRMD_ABSOLUTE && h.bank != 0) {
+        p = put_dec(p, h.bank);
+        *p ++ = ':';
+    }
+    else if (h.mode == ADDRMD_INDEXED) {
+        p = put_word(p, &reg_words[REG_R0 + h.bank]);
+        p = put_str(p, " + ");
+    }
+    else if ((h.mode == ADDRMD_PC_REL || h.mode == ADDRMD_SP_REL) && h.bank != 0) {
+        // any bank bit means down; asm writes 1
+        p[-2] = '-';
+    }
+
+    u32 size;
+    if (h.type == SRCTY_REGISTER) {
+        p = put_word(p, &reg_words[code[1]]);
+        size = 2;
+    }
+    else {
+        // w, so reassembling never relaxes it into a register
+        p = put_hex(put_str(p, "w 0x"), MK16(code[1], code[2]), 4);
+        size = 3;
+    }
+    *p ++ = ']';
+
+    *out = p;
+    return size;
+}
+
+// without the terminator; returns the end
+static char* put_instr(char* p, const u8* code, u32 size) {
+    const CPU_Instr_Info* info = &cpu_instr_info[code[0]];
+    if (size == 0)
+        return put_hex(put_str(p, ".byte 0x"), code[0], 2);
+
+    p = put_word(p, &mnemonics[code[0]]);
+    if (info->nops == 0)
+        return p - 1;
+
+    u32 at = 1;
+    for (u32 i = 0; i < info->nops; i ++) {
+        if (i > 0)
+            p = put_str(p, ", ");
+        switch (info->ops[i]) {
+        case OPND_REG:
+            p = put_word(p, &reg_words[code[at ++]]);
+            break;
+        case OPND_BYTE:
+            p = put_word(p, &dec_words[code[at ++]]);
+            break;
+        case OPND_WORD:
+            p = put_dec(p, MK16(code[at], code[at + 1]));
+            at += 2;
+            break;
+        default:
+            at += put_addr(&p, code + at);
+            break;
+        }
+    }
+    return p;
+}
+
+u32 dis_instr(const u8* code, u32 len, char* line) {
+    pthread_once(&words_once, words_init);
+    if (len == 0) {
+        *line = 0;
+        return 0;
+    }
+    u32 size = cpu_instr_size(code, len);
+    *put_instr(line, code, size) = 0;
+    return size;
+}
+
+#define DIS_MAX_SIZE 5  // opcode, address header, word
+#define DIS_BYTES_WIDTH (DIS_MAX_SIZE * 3 + 1)
+
+// one instruction, prefixed as flags say, without the newline; at most
+// DIS_LINE bytes. size gets what it took, 0 for a .byte
+static char* put_line(char* p, const u8* code, u32 left, su20 at, u32 flags, u32* size) {
+    *size = cpu_instr_size(code, left);
+
+    if (flags & DIS_ADDR) {
+        *p ++ = hex_digits[at >> 16 & 15];
+        *p ++ = ':';
+        p = put_str(put_hex(p, at & 0xFFFF, 4), "  ");
+    }
+    if (flags & DIS_BYTES) {
+        memset(p, ' ', DIS_BYTES_WIDTH);
+        u32 n = *size > 0 ? *size : 1;
+        for (u32 i = 0; i < n; i ++)
+            memcpy(p + i * 3, hex_pairs[code[i]], 2);
+        p += DIS_BYTES_WIDTH;
+    }
+
+    return put_instr(p, code, *size);
+}
+
+static void reserve(AsmBuf* buf, size_t more) {
+    if (buf->len + more <= buf->cap)
+        return;
+    size_t cap = buf->cap > 0 ? buf->cap * 2 : 4096;
+    while (cap < buf->len + more)
+        cap *= 2;
+    buf->data = realloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+/* ============================================================
+ * source
+ * ============================================================ */
+
+// where the source comment starts: past the prefixes and most operands
+static u32 comment_col(u32 flags) {
+    u32 col = 28;
+    if (flags & DIS_ADDR)
+        col += 8;
+    if (flags & DIS_BYTES)
+        col += DIS_BYTES_WIDTH + 1;
+    return col;
+}
+
+// what a comment or label line can add to DIS_LINE
+static size_t source_room(const ObjMap* map, const ObjMapLine* line, const ObjMapLabel* label) {
+    size_t room = 0;
+    if (line != NULL)
+        room += map->files[line->file].name_len;
+    if (label != NULL)
+        room += label->name_len;
+    return room + 16;
+}
+
+static char* put_name(char* p, const ObjMap* map, u32 name, u32 len) {
+    memcpy(p, obj_map_name(map, name), len);
+    return p + len;
+}
+
+// "  ; file:line label+off", padded out from start; either may be NULL
+static char* put_source(char* p, char* start, u32 flags, const ObjMap* map,
+                        const ObjMapLine* line, const ObjMapLabel* label, su20 addr) {
+    if (line == NULL && label == NULL)
+        return p;
+
+    char* col = start + comment_col(flags);
+    while (p < col)
+        *p ++ = ' ';
+    p = put_str(p, "  ;");
+
+    if (line != NULL) {
+        const ObjMapFile* f = &map->files[line->file];
+        *p ++ = ' ';
+        p = put_name(p, map, f->name, f->name_len);
+        *p ++ = ':';
+        p = put_dec(p, line->line);
+    }
+    if (label != NULL) {
+        *p ++ = ' ';
+        p = put_name(p, map, label->name, label->name_len);
+        if (label->addr != addr) {
+            *p ++ = '+';
+            p = put_dec(p, addr - label->addr);
+        }
+    }
+    return p;
+}
+
+/* ============================================================
+ * threads
+ * ============================================================ */
+
+// a thread's worth of work, so small inputs stay on the calling thread
+#define DIS_CHUNK_MIN (256 * 1024)  // code bytes
+#define DIS_TRACE_MIN (64 * 1024)   // records
+
+#define DIS_MAX_JOBS 64
+
+// no more than asked for, nor than there is work for
+static u32 job_count(u32 jobs, size_t work) {
+    if (jobs > DIS_MAX_JOBS)
+        jobs = DIS_MAX_JOBS;
+    if (jobs > work)
+        jobs = work;
+    return jobs > 1 ? jobs : 1;
+}
+
+// fn on each of n items, one thread each; the calling thread takes the
+// first, and any item that gets no thread
+static void run_jobs(void* (*fn)(void*), void* items, size_t stride, u32 n) {
+    pthread_t threads[DIS_MAX_JOBS];
+    bool started[DIS_MAX_JOBS] = {0};
+
+    for (u32 i = 1; i < n; i ++)
+        started[i] = pthread_create(&threads[i], NULL, fn, (u8*) items + i * stride) == 0;
+    fn(items);
+    for (u32 i = 1; i < n; i ++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn((u8*) items + i * stride);
+    }
+}
+
+typedef struct {
+    const void* src;    // code, or trace records
+    size_t from, to;
+    size_t len;         // of all the code; regions only
+    size_t last;        // regions: the last instruction that starts before to
+    su20 at;
+    u32 flags;
+    const ObjMap* map;
+    const DisMem* mem;  // traces only
+    AsmBuf out;
+} DisJob;
+
+// stitches the jobs' text onto out in order
+static void join(DisJob* jobs, u32 n, AsmBuf* out) {
+    size_t total = 0;
+    for (u32 i = 0; i < n; i ++)
+        total += jobs[i].out.len;
+    reserve(out, total);
+
+    for (u32 i = 0; i < n; i ++) {
+        memcpy(out->data + out->len, jobs[i].out.data, jobs[i].out.len);
+        out->len += jobs[i].out.len;
+        free(jobs[i].out.data);
+    }
+}
+
+/* ============================================================
+ * regions
+ * ============================================================ */
+
+// about 3 bytes an instruction and 40 characters a line
+#define DIS_TEXT_RATIO 16
+
+// the first entry of a sorted table at or past addr
+#define LOWER_BOUND(table, count, key, out) do {    \
+    u32 lo_ = 0, hi_ = (count);                     \
+    while (lo_ < hi_) {                             \
+        u32 mid_ = lo_ + (hi_ - lo_) / 2;           \
+        if ((table)[mid_].addr < (key))             \
+            lo_ = mid_ + 1;                         \
+        else                                        \
+            hi_ = mid_;                             \
+    }                                               \
+    (out) = lo_;                                    \
+} while (0)
+
+// labels get a line of their own and instructions their source line.
+// addresses only grow along a region, so two cursors walk the map's
+// tables alongside it; a search puts them back where the region wraps
+static void* region_range(void* arg) {
+    DisJob* job = arg;
+    const u8* code = job->src;
+    const ObjMap* map = job->map;
+    AsmBuf* out = &job->out;
+    u32 line = 0, label = 0;
+    su20 last = 0xFFFFFFFFu;    // none yet, so the first address seeks
+
+    reserve(out, (job->to - job->from) * DIS_TEXT_RATIO);
+    for (size_t pos = job->from; pos < job->to; ) {
+        su20 addr = (job->at + pos) & 0xFFFFF;
+        const ObjMapLine* source = NULL;
+
+        if (map != NULL) {
+            if (addr < last) {
+                LOWER_BOUND(map->lines, map->nlines, addr, line);
+                if (line > 0)
+                    line --;
+                LOWER_BOUND(map->labels, map->nlabels, addr, label);
+            }
+            last = addr;
+
+            while (line < map->nlines && map->lines[line].addr + map->lines[line].size <= addr)
+                line ++;
+            if (line < map->nlines && map->lines[line].addr <= addr)
+                source = &map->lines[line];
+
+            // a label inside an instruction has no line to go on
+            while (label < map->nlabels && map->labels[label].addr < addr)
+                label ++;
+            for (; label < map->nlabels && map->labels[label].addr == addr; label ++) {
+                const ObjMapLabel* l = &map->labels[label];
+                reserve(out, l->name_len + 2);
+                char* p = put_name((char*) out->data + out->len, map, l->name, l->name_len);
+                p = put_str(p, ":\n");
+                out->len = (u8*) p - out->data;
+            }
+        }
+
+        reserve(out, DIS_LINE + (source != NULL ? source_room(map, source, NULL) : 0));
+        size_t left = job->len - pos;
+        u32 size;
+        char* start = (char*) out->data + out->len;
+        char* end = put_line(start, code + pos, left < DIS_MAX_SIZE ? left : DIS_MAX_SIZE,
+                             addr, job->flags, &size);
+        end = put_source(end, start, job->flags, map, source, NULL, addr);
+        *end ++ = '\n';
+        out->len = (u8*) end - out->data;
+        pos += size > 0 ? size : 1;
+    }
+    return NULL;
+}
+
+// past the instruction at pos; a byte that is none is one. with more,
+// one the end cuts off stays at pos for the next call
+static size_t next_instr(const u8* code, size_t len, size_t pos, bool more) {
+    size_t left = len - pos;
+    u32 size = cpu_instr_size(code + pos, left < DIS_MAX_SIZE ? left : DIS_MAX_SIZE);
+    if (size > 0)
+        return pos + size;
+    return more && cpu_instr_info[code[pos]].name != NULL ? pos : pos + 1;
+}
+
+// walks the sizes from a guessed start, which need not be a boundary
+static void* region_sizes(void* arg) {
+    DisJob* job = arg;
+    bool more = job->flags & DIS_MORE;
+
+    size_t pos = job->from;
+    while (pos < job->to) {
+        size_t next = next_instr(job->src, job->len, pos, more);
+        if (next == pos || next >= job->to)
+            break;
+        pos = next;
+    }
+    job->last = pos;
+    return NULL;
+}
+
+// the first boundary that the walk from a, a real one, and the walk from
+// a guess b both reach; a few instructions past b, since the two fall
+// into step at the first start they share
+static size_t resync(const u8* code, size_t len, size_t a, size_t b, bool more) {
+    while (a != b) {
+        size_t* behind = a < b ? &a : &b;
+        size_t next = next_instr(code, len, *behind, more);
+        if (next == *behind)
+            break;
+        *behind = next;
+    }
+    return a;
+}
+
+size_t dis_region(const u8* code, size_t len, su20 at, const ObjMap* map, u32 flags, u32 jobs, AsmBuf* out) {
+    pthread_once(&words_once, words_init);
+    u32 n = job_count(jobs, len / DIS_CHUNK_MIN);
+    DisJob job[DIS_MAX_JOBS];
+    bool more = flags & DIS_MORE;
+
+    // split at even guesses and walk each share on its own thread; past
+    // where a walk met the real boundaries it stays on them, so only the
+    // few instructions around each guess are walked again in order
+    for (u32 i = 0; i < n; i ++)
+        job[i] = (DisJob) {
+            .src = code, .from = len / n * i, .to = i + 1 < n ? len / n * (i + 1) : len,
+            .len = len, .at = at, .flags = flags, .map = map,
+        };
+    run_jobs(region_sizes, job, sizeof(DisJob), n);
+
+    size_t pos = 0;
+    for (u32 i = 0; i < n; i ++) {
+        size_t from = pos;
+        size_t known = pos > job[i].last ? pos : job[i].last;
+        if (i + 1 < n) {
+            pos = resync(code, len, known, job[i + 1].from, more);
+        }
+        else {
+            pos = known;
+            while (pos < len) {
+                size_t next = next_instr(code, len, pos, more);
+                if (next == pos)
+                    break;
+                pos = next;
+            }
+        }
+        job[i].from = from;
+        job[i].to = pos;
+    }
+
+    run_jobs(region_range, job, sizeof(DisJob), n);
+    join(job, n, out);
+    return pos;
+}
+
+/* ============================================================
+ * traces
+ * ============================================================ */
+
+// what the cpu fetches at pc; the address wraps inside the bank
+static void fetch(const DisMem* mem, su20 pc, u8* code) {
+    const u8* bank = mem->banks[pc >> 16 & 15];
+    u16 addr = pc;
+
+    if (bank == NULL)
+        memset(code, 0, DIS_MAX_SIZE);
+    else if (addr <= 0x10000 - DIS_MAX_SIZE)
+        memcpy(code, bank + addr, DIS_MAX_SIZE);
+    else
+        for (u32 i = 0; i < DIS_MAX_SIZE; i ++)
+            code[i] = bank[(u16) (addr + i)];
+}
+
+// records jump about, so each looks its line and label up afresh
+static void* trace_range(void* arg) {
+    DisJob* job = arg;
+    const u32* pcs = job->src;
+    const ObjMap* map = job->map;
+    AsmBuf* out = &job->out;
+
+    reserve(out, (job->to - job->from) * (DIS_LINE / 2));
+    for (size_t i = job->from; i < job->to; i ++) {
+        su20 pc = pcs[i] & 0xFFFFF;
+        const ObjMapLine* line = NULL;
+        const ObjMapLabel* label = NULL;
+        if (map != NULL) {
+            line = obj_map_line(map, pc);
+            label = obj_map_label(map, pc);
+        }
+
+        reserve(out, DIS_LINE + (map != NULL ? source_room(map, line, label) : 0));
+        u8 code[DIS_MAX_SIZE];
+        fetch(job->mem, pc, code);
+        u32 size;
+        char* start = (char*) out->data + out->len;
+        char* end = put_line(start, code, DIS_MAX_SIZE, pc, job->flags, &size);
+        end = put_source(end, start, job->flags, map, line, label, pc);
+        *end ++ = '\n';
+        out->len = (u8*) end - out->data;
+    }
+    return NULL;
+}
+
+void dis_trace(const DisMem* mem, const ObjMap* map, const u32* pcs, size_t count, u32 flags, u32 jobs, AsmBuf* out) {
+    pthread_once(&words_once, words_init);
+    u32 n = job_count(jobs, count / DIS_TRACE_MIN);
+    DisJob job[DIS_MAX_JOBS];
+
+    // records stand alone, so any split will do
+    for (u32 i = 0; i < n; i ++)
+        job[i] = (DisJob) {
+            .src = pcs, .from = count / n * i, .to = i + 1 < n ? count / n * (i + 1) : count,
+            .flags = flags, .map = map, .mem = mem,
+        };
+
+    run_jobs(trace_range, job, sizeof(DisJob), n);
+    join(job, n, out);
+}
+
+/* ============================================================
+ * profile
+ * ============================================================ */
+
+void dis_count(const u32* pcs, size_t count, u64* counts) {
+    for (size_t i = 0; i < count; i ++)
+        counts[pcs[i] & 0xFFFFF] ++;
+}
+
+typedef struct {
+    u64 count;
+    su20 addr;              // of the line, or of the instruction without one
+    const ObjMapLine* line;
+} Hot;
+
+static int hot_cmp(const void* a, const void* b) {
+    const Hot* x = a;
+    const Hot* y = b;
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// a source file split into lines, read once for the whole report
+typedef struct {
+    char* text;
+    u32* starts;            // of each line, and one past the last
+    u32 nlines;
+    bool tried;
+} Source;
+
+static void source_load(Source* src, const char* name, u32 len) {
+    src->tried = true;
+    char path[4096];
+    snprintf(path, sizeof(path), "%.*s", (int) len, name);
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        return;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    src->text = size >= 0 ? malloc(size + 1) : NULL;
+    if (src->text == NULL || fread(src->text, 1, size, f) != (size_t) size) {
+        fclose(f);
+        free(src->text);
+        src->text = NULL;
+        return;
+    }
+    fclose(f);
+
+    u32 cap = 1024;
+    src->starts = malloc(cap * sizeof(u32));
+    src->starts[src->nlines ++] = 0;
+    for (long i = 0; i < size; i ++) {
+        if (src->text[i] != '\n')
+            continue;
+        if (src->nlines + 1 >= cap)
+            src->starts = realloc(src->starts, (cap *= 2) * sizeof(u32));
+        src->starts[src->nlines ++] = i + 1;
+    }
+    src->starts[src->nlines] = size;
+}
+
+// the source text of a line, trimmed, if the file is still there
+static void put_source_text(FILE* out, Source* sources, const ObjMap* map, const ObjMapLine* line) {
+    Source* src = &sources[line->file];
+    if (!src->tried) {
+        const ObjMapFile* f = &map->files[line->file];
+        source_load(src, obj_map_name(map, f->name), f->name_len);
+    }
+    if (src->text == NULL || line->line == 0 || line->line > src->nlines)
+        return;
+
+    const char* p = src->text + src->starts[line->line - 1];
+    const char* end = src->text + src->starts[line->line];
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p ++;
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+        end --;
+    fprintf(out, "  %.*s", (int) (end - p), p);
+}
+
+void dis_profile(const ObjMap* map, const u64* counts, FILE* out) {
+    u32 nlines = map != NULL ? map->nlines : 0;
+    u64* per_line = calloc(nlines + 1, sizeof(u64));
+    Hot* hot = NULL;
+    u32 nhot = 0, cap = 0;
+    u64 total = 0;
+
+    for (su20 pc = 0; pc < DIS_PCS; pc ++) {
+        if (counts[pc] == 0)
+            continue;
+        total += counts[pc];
+
+        const ObjMapLine* line = map != NULL ? obj_map_line(map, pc) : NULL;
+        if (line != NULL) {
+            per_line[line - map->lines] += counts[pc];
+            continue;
+        }
+        if (nhot == cap)
+            hot = realloc(hot, (cap = cap ? cap * 2 : 256) * sizeof(Hot));
+        hot[nhot ++] = (Hot) { counts[pc], pc, NULL };
+    }
+
+    for (u32 i = 0; i < nlines; i ++) {
+        if (per_line[i] == 0)
+            continue;
+        if (nhot == cap)
+            hot = realloc(hot, (cap = cap ? cap * 2 : 256) * sizeof(Hot));
+        hot[nhot ++] = (Hot) { per_line[i], map->lines[i].addr, &map->lines[i] };
+    }
+    qsort(hot, nhot, sizeof(Hot), hot_cmp);
+
+    Source* sources = calloc(map != NULL ? map->nfiles + 1 : 1, sizeof(Source));
+    fprintf(out, "%12s %7s  %s\n", "count", "%", "where");
+    for (u32 i = 0; i < nhot; i ++) {
+        char where[256];
+        if (map != NULL)
+            obj_map_where(map, hot[i].addr, where, sizeof(where));
+        else
+            snprintf(where, sizeof(where), "%X:%04X", hot[i].addr >> 16, hot[i].addr & 0xFFFF);
+
+        fprintf(out, "%12llu %6.2f%%  %s", (unsigned long long) hot[i].count,
+                100.0 * hot[i].count / total, where);
+        if (hot[i].line != NULL)
+            put_source_text(out, sources, map, hot[i].line);
+        fputc('\n', out);
+    }
+
+    for (u32 i = 0; map != NULL && i < map->nfiles; i ++) {
+        free(sources[i].text);
+        free(sources[i].starts);
+    }
+    free(sources);
+    free(hot);
+    free(per_line);
+}
@@ -0,0 +1,90 @@
+#ifndef DIS_H
+#define DIS_H
+
+#include "emu.h"
+#include "cpu.h"
+#include "asm.h"
+#include "obj.h"
+
+// disassembler, driven by the isa table in cpu.h
+//
+//   char line[DIS_LINE];
+//   u32 size = dis_instr(code, len, line);     // one instruction
+//
+//   AsmBuf text = {0};
+//   dis_region(code, len, MK20(0, PAGE(1)), NULL, DIS_ADDR | DIS_BYTES, jobs, &text);
+//
+// the text is what asm reads back into the same bytes, bar encodings it
+// has no syntax for (unnamed registers, stray bank bits), which still
+// read clearly. bytes that are no instruction come out as .byte
+//
+// regions are split at guesses, which the threads walk from and then
+// move to the instruction boundaries, and formatted on up to jobs
+// threads; the text does not depend on it
+//
+// built -O2, one core decodes about 25 MB/s of random bytes with
+// addresses and bytes and 45 MB/s without (26 and 9 bytes of text per
+// byte in); writing the text is where the time goes. hundreds of MB/s
+// needs jobs on several cores, which has not been measured
+//
+// TRACE
+// =====================================
+//
+// emu -T writes one little endian u32 per instruction it runs:
+// MK20(bank, pc) from before the step. dis_trace decodes each against a
+// memory image, so a trace reads as the instructions that ran
+//
+// SOURCE
+// =====================================
+//
+// with a source map (see obj.h) each line ends in `; file:line`, a trace
+// line in the label and offset too, and a region gets a `label:` line
+// where one starts. a NULL map leaves them out
+//
+// PROFILE
+// =====================================
+//
+//   u64* counts = calloc(DIS_PCS, sizeof(u64));
+//   dis_count(pcs, count, counts);     // as often as there are records
+//   dis_profile(&map, counts, stdout);
+//
+// the report adds up the instructions of each source line and lists the
+// lines hottest first, with their text when the source is still there
+
+#define DIS_LINE 96
+
+// line prefixes
+#define DIS_ADDR  1     // bank:addr
+#define DIS_BYTES 2     // the encoding in hex
+
+// more code follows this region: an instruction cut off at its end is
+// left for the next call instead of coming out as .byte
+#define DIS_MORE  4
+
+// the instruction at code as text, no newline; returns its size, or 0
+// if code holds no instruction in len bytes, with line a .byte for the
+// first one
+u32 dis_instr(const u8* code, u32 len, char* line);
+
+// len bytes that start at at, a 20 bit address; appended to out, a line
+// per instruction. returns the bytes it decoded, len unless DIS_MORE
+size_t dis_region(const u8* code, size_t len, su20 at, const ObjMap* map, u32 flags, u32 jobs, AsmBuf* out);
+
+// what the cpu would fetch: 16 banks, NULL for ones that read as 0
+typedef struct {
+    const u8* banks[16];
+} DisMem;
+
+// a line per trace record, decoded from mem
+void dis_trace(const DisMem* mem, const ObjMap* map, const u32* pcs, size_t count, u32 flags, u32 jobs, AsmBuf* out);
+
+// every 20 bit address
+#define DIS_PCS (1 << 20)
+
+// adds the records to counts, DIS_PCS of them
+void dis_count(const u32* pcs, size_t count, u64* counts);
+
+// map may be NULL; the report is then by address
+void dis_profile(const ObjMap* map, const u64* counts, FILE* out);
+
+#endif
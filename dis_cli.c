@@ -0,0 +1,294 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "obj.h"
+#include "dis.h"
+
+// command line disassembler
+//
+//   dis [-p] [-r] [-s] [-j jobs] [-a bank:addr] [-m map] [-t trace] [-o out] file
+//
+// file is an image from asm or asmlink, each segment at its address, or
+// a raw binary that runs at -a (default 0:4096, where the cpu starts).
+// with -t it decodes the trace emu -T wrote instead, against file, and
+// with -p as well it reports where the trace spent its time.
+// lines carry the address and the bytes unless -r, which leaves what
+// asm reads back. the source map next to an image, or -m, adds the
+// source lines and labels. -j sets the threads (default the online
+// cores); the output is the same. -s reports the throughput
+
+// cpu.c wants a bus; the disassembler never runs the cpu
+u8 mread(CPU* cpu, u16 addr, su4 bank) { return 0; }
+void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {}
+
+// input per call, so the text held stays bounded
+#define DIS_BATCH_BYTES (16 * 1024 * 1024)
+#define DIS_BATCH_RECORDS (1024 * 1024)
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-p] [-r] [-s] [-j jobs] [-a bank:addr] [-m map] [-t trace] [-o out] file\n", name);
+    fprintf(stderr, "  -p            profile the trace by source line\n");
+    fprintf(stderr, "  -r            text only, no addresses or bytes\n");
+    fprintf(stderr, "  -s            report the throughput\n");
+    fprintf(stderr, "  -j jobs       threads\n");
+    fprintf(stderr, "  -a bank:addr  where a raw binary runs\n");
+    fprintf(stderr, "  -m map        source map (default the image's)\n");
+    fprintf(stderr, "  -t trace      decode a trace from emu -T against file\n");
+    fprintf(stderr, "  -o out        output path\n");
+}
+
+static double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static const u8* map_file(const char* path, size_t* len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *len = st.st_size;
+    return map;
+}
+
+// text written so far, for -s
+static size_t written;
+
+static int flush(AsmBuf* text, FILE* out) {
+    int status = 0;
+    if (fwrite(text->data, 1, text->len, out) != text->len) {
+        perror("dis");
+        status = 1;
+    }
+    written += text->len;
+    text->len = 0;
+    return status;
+}
+
+// a run of code in batches, each cut at an instruction boundary
+static int region(const u8* code, size_t len, su20 at, const ObjMap* map, u32 flags, u32 jobs, FILE* out) {
+    AsmBuf text = {0};
+    int status = 0;
+
+    for (size_t pos = 0; pos < len && status == 0; ) {
+        size_t batch = len - pos;
+        u32 more = 0;
+        if (batch > DIS_BATCH_BYTES) {
+            batch = DIS_BATCH_BYTES;
+            more = DIS_MORE;
+        }
+        pos += dis_region(code + pos, batch, (at + pos) & 0xFFFFF, map, flags | more, jobs, &text);
+        status = flush(&text, out);
+    }
+
+    asm_buf_free(&text);
+    return status;
+}
+
+// decoded, or with counts tallied for a profile
+static int trace(const DisMem* mem, const ObjMap* map, const char* path, u64* counts,
+                 u32 flags, u32 jobs, FILE* out, size_t* in) {
+    size_t len;
+    const u8* records = map_file(path, &len);
+    if (records == NULL) {
+        fprintf(stderr, "%s: can not read the trace\n", path);
+        return 1;
+    }
+
+    const u32* pcs = (const u32*) records;
+    size_t count = len / sizeof(u32);
+    AsmBuf text = {0};
+    int status = 0;
+
+    for (size_t i = 0; i < count && status == 0; i += DIS_BATCH_RECORDS) {
+        size_t batch = count - i < DIS_BATCH_RECORDS ? count - i : DIS_BATCH_RECORDS;
+        if (counts != NULL) {
+            dis_count(pcs + i, batch, counts);
+            continue;
+        }
+        dis_trace(mem, map, pcs + i, batch, flags, jobs, &text);
+        status = flush(&text, out);
+    }
+
+    asm_buf_free(&text);
+    munmap((void*) records, len);
+    *in = count * sizeof(u32);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    u32 flags = DIS_ADDR | DIS_BYTES;
+    bool stats = false;
+    bool profile = false;
+    const char* map_path = NULL;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 jobs = cores > 1 ? cores : 1;
+    su4 bank = 0;
+    u16 addr = PAGE(1);
+    const char* trace_path = NULL;
+    const char* out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:j:m:o:prst:")) != -1) {
+        switch (opt) {
+        case 'a': {
+            char* end;
+            u32 b = strtoul(optarg, &end, 0);
+            u32 a = *end == ':' ? strtoul(end + 1, &end, 0) : 0x10000;
+            if (*end != 0 || b > 15 || a > 0xFFFF) {
+                fprintf(stderr, "%s: -a takes bank:addr\n", argv[0]);
+                return 1;
+            }
+            bank = b;
+            addr = a;
+            break;
+        }
+        case 'j':
+            jobs = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            map_path = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'p':
+            profile = true;
+            break;
+        case 'r':
+            flags = 0;
+            break;
+        case 's':
+            stats = true;
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc || (profile && trace_path == NULL)) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* file = argv[optind];
+
+    FILE* out = stdout;
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+        perror(out_path);
+        return 1;
+    }
+
+    // an image, or failing that a raw binary at -a
+    ObjImage img;
+    ObjSegment raw;
+    bool image = obj_image_open(&img, file) == 0;
+    if (!image) {
+        img = (ObjImage) { .nsegs = 1, .segs = &raw };
+        img.map = map_file(file, &img.len);
+        if (img.map == NULL) {
+            fprintf(stderr, "%s: can not read\n", file);
+            return 1;
+        }
+        raw = (ObjSegment) { bank, addr, img.len, 0 };
+    }
+
+    // an image's own map is optional; one asked for is not
+    ObjMap map;
+    bool mapped;
+    if (map_path != NULL) {
+        mapped = obj_map_open(&map, map_path) == 0;
+        if (!mapped) {
+            fprintf(stderr, "%s: not a source map\n", map_path);
+            return 1;
+        }
+    }
+    else {
+        char* path = obj_map_path(file);
+        mapped = image && obj_map_open(&map, path) == 0;
+        free(path);
+    }
+
+    double t0 = now_ns();
+    size_t in = 0;
+    int status = 0;
+
+    if (trace_path != NULL) {
+        // the banks as the image leaves them
+        DisMem mem = {0};
+        u8* banks[16] = {0};
+        for (u32 i = 0; i < img.nsegs; i ++) {
+            const ObjSegment* seg = &img.segs[i];
+            const u8* data = obj_image_data(&img, i);
+            for (u32 at = 0; at < seg->size; ) {
+                su20 pos = MK20(seg->bank, seg->addr) + at;
+                su4 b = pos >> 16 & 15;
+                u32 n = 0x10000 - (pos & 0xFFFF);
+                if (n > seg->size - at)
+                    n = seg->size - at;
+                if (banks[b] == NULL)
+                    mem.banks[b] = banks[b] = calloc(0x10000, 1);
+                memcpy(banks[b] + (pos & 0xFFFF), data + at, n);
+                at += n;
+            }
+        }
+
+        u64* counts = profile ? calloc(DIS_PCS, sizeof(u64)) : NULL;
+        status = trace(&mem, mapped ? &map : NULL, trace_path, counts, flags, jobs, out, &in);
+        if (status == 0 && profile)
+            dis_profile(mapped ? &map : NULL, counts, out);
+        free(counts);
+        for (u32 i = 0; i < 16; i ++)
+            free(banks[i]);
+    }
+    else {
+        for (u32 i = 0; i < img.nsegs && status == 0; i ++) {
+            const ObjSegment* seg = &img.segs[i];
+            if (img.nsegs > 1 || image)
+                fprintf(out, "; %X:%04X, %u bytes\n", seg->bank, seg->addr, seg->size);
+            status = region(obj_image_data(&img, i), seg->size, MK20(seg->bank, seg->addr),
+                            mapped ? &map : NULL, flags, jobs, out);
+            in += seg->size;
+        }
+    }
+
+    if (status == 0 && fflush(out) != 0) {
+        perror("dis");
+        status = 1;
+    }
+    double ms = (now_ns() - t0) / 1e6;
+
+    if (status == 0 && stats)
+        fprintf(stderr, "%.1f MB in, %.1f MB of text in %.1f ms: %.0f MB/s on %u jobs\n",
+                in / 1e6, written / 1e6, ms, in / 1e3 / ms, jobs);
+
+    if (mapped)
+        obj_map_close(&map);
+    if (image)
+        obj_image_close(&img);
+    else
+        munmap((void*) img.map, img.len);
+    if (out != stdout)
+        fclose(out);
+    return status;
+}
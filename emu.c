@@ -1,24 +1,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "cpu.h"
 #include "asm.h"
+#include "obj.h"
 #include "timer.h"
 #include "audio.h"
 
 #define SPLITERATE(str,split,p) for (char *p = strtok(str, split); p != NULL; p = strtok(NULL, split))
 
-const char * bit_rep[16] = {
-    [ 0] = "0000", [ 1] = "0001", [ 2] = "0010", [ 3] = "0011",
-    [ 4] = "0100", [ 5] = "0101", [ 6] = "0110", [ 7] = "0111",
-    [ 8] = "1000", [ 9] = "1001", [10] = "1010", [11] = "1011",
-    [12] = "1100", [13] = "1101", [14] = "1110", [15] = "1111",
-};
-
-void print_byte(u8 byte) {
-    printf("%s%s", bit_rep[byte >> 4], bit_rep[byte & 0x0F]);
-}
-
 CPU_Reg watched[] = {
     REG_PC,
     REG_R0,
@@ -37,43 +28,79 @@ void print_cpu(const CPU * cpu, int (*out)(const char *)) {
     }
 }
 
-static int assemble_file_into(const char *file, u8 *ptr) {
-    FILE* src = fopen(file, "r");
-
-    char* line = NULL;
-    size_t len = 0;
-    ssize_t read;
-
-    size_t line_id = 0;
-    int status = 0;
-
-    while ((read = getline(&line, &len, src)) != -1) {
-        printf("%s   ", line);
-        u8* old = ptr;
-        int s = assemble(line, &ptr);
-        status |= s;
-        if (s != 0) {
-            fprintf(stderr, "error in line %zu\n", line_id + 1);
-            puts("???");
-        } else {
-            while (old < ptr) {
-                print_byte(*old);
-                printf(" ");
-                old ++;
-            }
-            puts("");
-        }
-        line_id ++;
+static u8* mem;
+static SoundChip sc;
+static TimerChip tc;
+
+// the program's source map, for fault reports; empty without one
+static ObjMap source;
+
+// banks 1 - 15 are plain ram once a program puts something there
+static u8* banks[16];
+
+// where size bytes for bank:addr go; NULL outside ram
+static u8* ram_at(su4 bank, u32 addr, u32 size) {
+    if (bank == 0)
+        return addr + size <= PAGE(2) ? mem + addr : NULL;
+    if (banks[bank] == NULL)
+        banks[bank] = calloc(0x10000, 1);
+    return banks[bank] + addr;
+}
+
+static int ram_write(AsmSink* sink, su4 bank, u16 addr, const u8* data, u32 len) {
+    u8* dest = ram_at(bank, addr, len);
+    if (dest == NULL) {
+        fprintf(stderr, "%s: section at %u:%u is outside ram\n", (const char*) sink->ctx, bank, addr);
+        return 1;
     }
+    memcpy(dest, data, len);
+    return 0;
+}
 
-    fclose(src);
+static int assemble_file(const char *file, bool list) {
+    Asm as;
+    asm_init(&as, PAGE(1));
+
+    int status = asm_file(&as, file) || asm_link(&as);
+    if (status != 0) {
+        fprintf(stderr, "%s:%u: %s\n", file, as.error_line, as.error);
+    }
+    else {
+        AsmSink sink = { .write = ram_write, .ctx = (void*) file };
+        status = asm_emit_to(&as, &sink);
+    }
+
+    if (status == 0 && list) {
+        AsmBuf buf = {0};
+        asm_emit_buf(&as, &buf);
+        asm_list(&as, buf.data, stdout);
+        asm_buf_free(&buf);
+    }
+    if (status == 0)
+        obj_map_build(&source, &as, file);
 
+    asm_free(&as);
     return status;
 }
 
-static u8* mem;
-static SoundChip sc;
-static TimerChip tc;
+// an image from asm or asmlink
+static int load_image(const ObjImage* img, const char *file) {
+    for (u32 i = 0; i < img->nsegs; i ++) {
+        const ObjSegment* seg = &img->segs[i];
+        u8* dest = ram_at(seg->bank, seg->addr, seg->size);
+        if (dest == NULL) {
+            fprintf(stderr, "%s: segment at %u:%u is outside ram\n", file, seg->bank, seg->addr);
+            return 1;
+        }
+        memcpy(dest, obj_image_data(img, i), seg->size);
+    }
+
+    // the map is a nicety; an image runs without one
+    char* path = obj_map_path(file);
+    (void) obj_map_open(&source, path);
+    free(path);
+    return 0;
+}
 
 u8 mread(CPU* cpu, u16 addr, su4 bank) {
     if (bank == 0) { 
@@ -81,12 +108,15 @@ u8 mread(CPU* cpu, u16 addr, su4 bank) {
             return mem[addr];
         }
         else if (addr < PAGE(3)) {
-            return 0;
+            return soundchip_read(&sc, addr - PAGE(2));
         }
         else if (addr < PAGE(4)) {
             return 0;
         }
     }
+    else if (banks[bank] != NULL) {
+        return banks[bank][addr];
+    }
     return 0;
 }
 
@@ -102,16 +132,87 @@ void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {
             timerchip_write(&tc, addr - PAGE(3), val);
         }
     }
+    else if (banks[bank] != NULL) {
+        banks[bank][addr] = val;
+    }
+}
+
+static const char* fault_names[] = {
+    [E_NOINTH] = "no interrupt handler",
+    [E_PAGEAV] = "page access violation",
+};
+
+// a new exception, with where the instruction that raised it came from
+static void report_fault(u32 exc, su20 pc) {
+    const char* name = exc < sizeof(fault_names) / sizeof(*fault_names) ? fault_names[exc] : NULL;
+    fprintf(stderr, "fault: %s (%u) at %X:%04X", name != NULL ? name : "unknown", exc, pc >> 16 & 15, pc & 0xFFFF);
+
+    char where[256];
+    if (source.map != NULL && obj_map_where(&source, pc, where, sizeof(where)) > 0)
+        fprintf(stderr, ", %s", where);
+    fputc('\n', stderr);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-l] [-n] [-s steps] [-t dest] [-T trace] [file.asm | file.img]\n", name);
+    fprintf(stderr, "  -l        print the assembly listing\n");
+    fprintf(stderr, "  -n        headless: null audio backend\n");
+    fprintf(stderr, "  -s steps  stop after this many instructions\n");
+    fprintf(stderr, "  -t dest   copy audio as raw s16 pcm to a file, fifo or unix:path\n");
+    fprintf(stderr, "  -T trace  write where each instruction ran, for dis -t\n");
 }
 
-int main() {
+int main(int argc, char** argv) {
+    SoundChipConfig sound;
+    soundchip_config_default(&sound);
+
+    bool list = false;
+    u64 steps = 0;
+    FILE* trace = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "lns:t:T:")) != -1) {
+        switch (opt) {
+        case 'l':
+            list = true;
+            break;
+        case 'n':
+            sound.backend = SOUND_BACKEND_NULL;
+            break;
+        case 's':
+            steps = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            sound.tap = optarg;
+            break;
+        case 'T':
+            if ((trace = fopen(optarg, "wb")) == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const char* file = optind < argc ? argv[optind] : "test.asm";
+
     mem = malloc(sizeof(u8) * PAGE(2));
     if (mem == NULL)
         return 1;
 
     {
-        u8* ptr = mem + PAGE(1);
-        int status = assemble_file_into("test.asm", ptr);
+        ObjImage img;
+        int status;
+        if (obj_image_open(&img, file) == 0) {
+            status = load_image(&img, file);
+            obj_image_close(&img);
+        }
+        else {
+            status = assemble_file(file, list);
+        }
         if (status != 0)
             return status;
     }
@@ -120,18 +221,42 @@ int main() {
     cpu_reset(&cpu);
 
     timerchip_init(&tc, &cpu);
-    soundchip_init(&sc);
+    soundchip_init(&sc, &sound);
+    soundchip_map(&sc, 0, mem, PAGE(2));
+    // the device opens on the first write to the sound page
     soundchip_start(&sc);
 
-    while(true) {
+    for (u64 step = 0; steps == 0 || step < steps; step ++) {
         timerchip_tick(&tc);
+
+        u32 exc = cpu.regs[REG_EXC];
+
+        u8 irq = soundchip_irq(&sc);
+        if (irq != 0)
+            cpu_inter(&cpu, irq);
+
+        // the instruction about to run, in a handler if one was entered
+        u32 pc = MK20(cpu.regs[REG_PCb], cpu.regs[REG_PC]);
+
+        // one u32 per instruction: MK20(bank, pc) before it runs
+        if (trace != NULL)
+            fwrite(&pc, sizeof(pc), 1, trace);
+
         cpu_step(&cpu);
 
+        if (cpu.regs[REG_EXC] != exc && cpu.regs[REG_EXC] != 0)
+            report_fault(cpu.regs[REG_EXC], pc);
+
         print_cpu(&cpu, puts);
         puts("");
     }
 
     soundchip_stop(&sc);
+    obj_map_close(&source);
+    if (trace != NULL && fclose(trace) != 0) {
+        perror("trace");
+        return 1;
+    }
 
     return 0;
 }
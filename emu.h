@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+typedef uint64_t u64;
 typedef uint32_t u32;
 typedef uint32_t su20;
 typedef uint16_t u16;
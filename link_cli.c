@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "obj.h"
+
+// links objects from asm -c into an image, and its source map
+//
+//   asmlink [-o out] module.o[@bank:page] ...
+//
+// a module without a placement follows the previous one; the first
+// starts at bank 0, PAGE(1). the map names each module's source as asm
+// was given it
+
+// cpu.c wants a bus; the linker never runs the cpu
+u8 mread(CPU* cpu, u16 addr, su4 bank) { return 0; }
+void mwrite(CPU* cpu, u16 addr, su4 bank, u8 val) {}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-o out] module.o[@bank:page] ...\n", name);
+    fprintf(stderr, "  -o out   output image (default a.img)\n");
+}
+
+int main(int argc, char** argv) {
+    const char* out = "a.img";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o':
+            out = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    u32 count = argc - optind;
+    if (count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ObjInput* inputs = calloc(count, sizeof(ObjInput));
+    for (u32 i = 0; i < count; i ++) {
+        char* arg = argv[optind + i];
+        inputs[i].path = arg;
+
+        char* at = strrchr(arg, '@');
+        if (at == NULL)
+            continue;
+
+        *at = '\0';
+        char* end;
+        unsigned long bank = strtoul(at + 1, &end, 0);
+        unsigned long page = *end == ':' ? strtoul(end + 1, &end, 0) : 16;
+        if (*end != '\0' || bank > 15 || page > 15) {
+            fprintf(stderr, "%s: placement is @bank:page, both 0 - 15\n", arg);
+            free(inputs);
+            return 1;
+        }
+
+        inputs[i].placed = true;
+        inputs[i].bank = bank;
+        inputs[i].addr = PAGE(page);
+    }
+
+    int status = obj_link(inputs, count, out);
+    free(inputs);
+    return status;
+}
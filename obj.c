@@ -0,0 +1,922 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "obj.h"
+
+/* ============================================================
+ * files
+ * ============================================================ */
+
+static const u8* map_file(const char* path, size_t* len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *len = st.st_size;
+    return map;
+}
+
+static bool src_stat(const char* src, u64* mtime, u64* size) {
+    struct stat st;
+    if (stat(src, &st) != 0)
+        return false;
+    *mtime = (u64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    *size = st.st_size;
+    return true;
+}
+
+static u32 src_hash(const char* src) {
+    size_t len = 0;
+    const u8* map = map_file(src, &len);
+    if (map == NULL)
+        return asm_hash(0, "", 0);
+
+    u32 h = asm_hash(0, (const char*) map, len);
+    munmap((void*) map, len);
+    return h;
+}
+
+// written next to the destination and renamed over it, so a failed write
+// never leaves a half object that looks fresh
+static FILE* atomic_open(const char* path, char** tmp) {
+    size_t plen = strlen(path);
+    *tmp = malloc(plen + 5);
+    memcpy(*tmp, path, plen);
+    memcpy(*tmp + plen, ".tmp", 5);
+    return fopen(*tmp, "wb");
+}
+
+static int atomic_close(FILE* f, char* tmp, const char* path, bool ok) {
+    ok = f != NULL && ok;
+    if (f != NULL)
+        ok = fclose(f) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+
+    if (!ok) {
+        perror(path);
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : 1;
+}
+
+static int write_atomic(const char* path, const void* data, size_t len) {
+    char* tmp;
+    FILE* f = atomic_open(path, &tmp);
+    return atomic_close(f, tmp, path, f != NULL && fwrite(data, 1, len, f) == len);
+}
+
+/* ============================================================
+ * objects
+ * ============================================================ */
+
+static void put(AsmBuf* buf, const void* data, size_t len) {
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len)
+            cap *= 2;
+        buf->data = realloc(buf->data, cap);
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+int obj_write(const Asm* as, const char* src, const char* path) {
+    ObjHeader h = {
+        .magic = OBJ_MAGIC,
+        .version = OBJ_VERSION,
+        .nsects = as->nsects,
+        .options = as->optimize ? OBJ_OPT_OPTIMIZE : 0,
+    };
+    if (!src_stat(src, &h.src_mtime, &h.src_size)) {
+        perror(src);
+        return 1;
+    }
+    h.src_hash = as->src != NULL ? asm_hash(0, as->src, as->src_len) : src_hash(src);
+
+    AsmBuf names = {0};
+    AsmBuf syms = {0};
+
+    // one symbol per section start, then globals and imports
+    for (u32 i = 0; i < as->nsects; i ++) {
+        ObjSym sym = { names.len, as->sects[i].len, i, 0 };
+        put(&syms, &sym, sizeof(sym));
+        put(&names, as->sects[i].name, as->sects[i].len);
+    }
+
+    u32* index = malloc((as->nsyms + 1) * sizeof(u32));
+    u32 nsyms = as->nsects;
+
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        const AsmSym* s = &as->syms[i];
+        ObjSym sym = { names.len, s->len, OBJ_SECT_IMPORT, 0 };
+
+        if (s->kind != SYM_UNDEF) {
+            if (!s->global)
+                continue;
+
+            AsmValue v = asm_value(as, s);
+            if (v.base != ASM_ABS && !(v.base & ASM_SECT(0))) {
+                fprintf(stderr, "%s:%u: global %.*s is defined through an import\n",
+                        src, s->line, (int) s->len, s->name);
+                free(index);
+                asm_buf_free(&names);
+                asm_buf_free(&syms);
+                return 1;
+            }
+            sym.sect = v.base == ASM_ABS ? OBJ_SECT_ABS : v.base & ~ASM_SECT(0);
+            sym.value = v.val;
+        }
+
+        index[i] = nsyms ++;
+        put(&syms, &sym, sizeof(sym));
+        put(&names, s->name, s->len);
+    }
+
+    AsmBuf data = {0};
+    AsmBuf relocs = {0};
+    AsmRelocs out = {0};
+
+    for (u32 i = 0; i < as->nsects; i ++) {
+        u32 size = as->sects[i].size;
+        u8* bytes = calloc(size ? size : 1, 1);
+        out.len = 0;
+        asm_emit_sect(as, i, bytes, &out);
+        put(&data, bytes, size);
+        free(bytes);
+
+        for (u32 j = 0; j < out.len; j ++) {
+            const AsmReloc* r = &out.data[j];
+            ObjReloc rel = {
+                .sect = i,
+                .offset = r->offset,
+                .sym = r->base & ASM_SECT(0) ? r->base & ~ASM_SECT(0) : index[r->base - 1],
+                .addend = r->addend,
+                .kind = r->kind,
+            };
+            put(&relocs, &rel, sizeof(rel));
+        }
+    }
+    free(out.data);
+    free(index);
+
+    // for the source map: where each line's code lies, and every label
+    AsmBuf lines = {0};
+    AsmBuf labels = {0};
+    ObjLine* last = NULL;
+    for (u32 i = 0; i < as->count; i ++) {
+        const AsmInstr* in = &as->instrs[i];
+        if (in->size == 0)
+            continue;
+        if (last != NULL && last->sect == in->sect && last->line == in->line &&
+            last->offset + last->size == in->addr) {
+            last->size += in->size;
+            continue;
+        }
+        ObjLine line = { in->sect, in->addr, in->size, in->line };
+        put(&lines, &line, sizeof(line));
+        last = (ObjLine*) (lines.data + lines.len) - 1;
+    }
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        const AsmSym* s = &as->syms[i];
+        if (s->kind != SYM_LABEL)
+            continue;
+        ObjSym sym = { names.len, s->len, s->sect, asm_value(as, s).val };
+        put(&labels, &sym, sizeof(sym));
+        put(&names, s->name, s->len);
+    }
+    h.src = names.len;
+    h.src_len = strlen(src);
+    put(&names, src, h.src_len);
+
+    h.nsyms = nsyms;
+    h.nrelocs = relocs.len / sizeof(ObjReloc);
+    h.nlines = lines.len / sizeof(ObjLine);
+    h.nlabels = labels.len / sizeof(ObjSym);
+    h.strtab_len = names.len;
+
+    AsmBuf file = {0};
+    put(&file, &h, sizeof(h));
+    for (u32 i = 0; i < as->nsects; i ++) {
+        ObjSect sect = { ((const ObjSym*) syms.data)[i].name, as->sects[i].len, as->sects[i].size };
+        put(&file, &sect, sizeof(sect));
+    }
+    put(&file, data.data, data.len);
+    put(&file, (u8[3]) {0}, -data.len & 3);
+    put(&file, syms.data, syms.len);
+    put(&file, relocs.data, relocs.len);
+    put(&file, lines.data, lines.len);
+    put(&file, labels.data, labels.len);
+    put(&file, names.data, names.len);
+
+    int status = write_atomic(path, file.data, file.len);
+
+    asm_buf_free(&file);
+    asm_buf_free(&data);
+    asm_buf_free(&relocs);
+    asm_buf_free(&lines);
+    asm_buf_free(&labels);
+    asm_buf_free(&syms);
+    asm_buf_free(&names);
+    return status;
+}
+
+// size and mtime match: fresh without reading the source. a touched but
+// unchanged source is hashed once, and the object remembers the new mtime
+bool obj_fresh(const char* path, const char* src, u32 options) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return false;
+
+    ObjHeader h;
+    u64 mtime, size;
+    bool fresh = pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+                 h.magic == OBJ_MAGIC && h.version == OBJ_VERSION && h.options == options &&
+                 src_stat(src, &mtime, &size) && size == h.src_size;
+
+    if (fresh && mtime != h.src_mtime) {
+        fresh = src_hash(src) == h.src_hash;
+        if (fresh) {
+            h.src_mtime = mtime;
+            (void) pwrite(fd, &h, sizeof(h), 0);
+        }
+    }
+
+    close(fd);
+    return fresh;
+}
+
+/* ============================================================
+ * linking
+ * ============================================================ */
+
+typedef struct {
+    const char* path;
+    const u8* map;
+    size_t len;
+
+    const ObjHeader* h;
+    const ObjSect* sects;
+    const u8* data;
+    const ObjSym* syms;
+    const ObjReloc* relocs;
+    const ObjLine* lines;
+    const ObjSym* labels;
+    const char* names;
+
+    u32* offset;        // of each section's bytes in the file
+    su4 bank;
+    u32* addr;          // of each section once placed
+} Module;
+
+// every table inside the file, every name inside the string table
+static bool module_check(Module* m) {
+    if (m->len < sizeof(ObjHeader))
+        return false;
+
+    const ObjHeader* h = m->h = (const ObjHeader*) m->map;
+    if (h->magic != OBJ_MAGIC || h->version != OBJ_VERSION)
+        return false;
+
+    u64 at = sizeof(ObjHeader);
+    m->sects = (const ObjSect*) (m->map + at);
+    at += (u64) h->nsects * sizeof(ObjSect);
+    if (at > m->len)
+        return false;
+
+    u64 data = at;
+    for (u32 i = 0; i < h->nsects; i ++)
+        at += m->sects[i].size;
+    at = (at + 3) & ~(u64) 3;
+    m->data = m->map + data;
+
+    m->syms = (const ObjSym*) (m->map + at);
+    at += (u64) h->nsyms * sizeof(ObjSym);
+    m->relocs = (const ObjReloc*) (m->map + at);
+    at += (u64) h->nrelocs * sizeof(ObjReloc);
+    m->lines = (const ObjLine*) (m->map + at);
+    at += (u64) h->nlines * sizeof(ObjLine);
+    m->labels = (const ObjSym*) (m->map + at);
+    at += (u64) h->nlabels * sizeof(ObjSym);
+    m->names = (const char*) (m->map + at);
+    at += h->strtab_len;
+    if (at != m->len || h->nsyms < h->nsects || (u64) h->src + h->src_len > h->strtab_len)
+        return false;
+
+    for (u32 i = 0; i < h->nsyms; i ++) {
+        const ObjSym* s = &m->syms[i];
+        if ((u64) s->name + s->name_len > h->strtab_len)
+            return false;
+        if (s->sect >= h->nsects && s->sect != OBJ_SECT_ABS && s->sect != OBJ_SECT_IMPORT)
+            return false;
+    }
+
+    for (u32 i = 0; i < h->nlines; i ++) {
+        const ObjLine* l = &m->lines[i];
+        if (l->sect >= h->nsects || (u64) l->offset + l->size > m->sects[l->sect].size)
+            return false;
+    }
+
+    for (u32 i = 0; i < h->nlabels; i ++) {
+        const ObjSym* s = &m->labels[i];
+        if ((u64) s->name + s->name_len > h->strtab_len || s->sect >= h->nsects ||
+            (u32) s->value > m->sects[s->sect].size)
+            return false;
+    }
+
+    for (u32 i = 0; i < h->nrelocs; i ++) {
+        const ObjReloc* r = &m->relocs[i];
+        if (r->sect >= h->nsects || r->sym >= h->nsyms || r->kind > RELOC_BANK)
+            return false;
+        u32 width = r->kind == RELOC_16 ? 2 : 1;
+        if ((u64) r->offset + width > m->sects[r->sect].size)
+            return false;
+    }
+
+    m->offset = malloc((h->nsects + 1) * sizeof(u32));
+    m->addr = malloc((h->nsects + 1) * sizeof(u32));
+    u32 off = data;
+    for (u32 i = 0; i < h->nsects; i ++) {
+        m->offset[i] = off;
+        off += m->sects[i].size;
+    }
+    return true;
+}
+
+typedef struct {
+    u32 module;
+    u32 sym;
+} Global;
+
+typedef struct {
+    Module* mods;
+    Global* table;      // open addressing; module == 0 is empty
+    u32 bits;
+} Linker;
+
+static const char* sym_name(const Module* m, const ObjSym* s) {
+    return m->names + s->name;
+}
+
+// defined, non-section symbols of every module
+static int globals_add(Linker* l, u32 count) {
+    u32 total = 0;
+    for (u32 i = 0; i < count; i ++)
+        total += l->mods[i].h->nsyms;
+
+    l->bits = 4;
+    while ((1u << l->bits) < total * 2)
+        l->bits ++;
+    l->table = calloc(1u << l->bits, sizeof(Global));
+    u32 mask = (1u << l->bits) - 1;
+
+    for (u32 i = 0; i < count; i ++) {
+        const Module* m = &l->mods[i];
+        for (u32 j = m->h->nsects; j < m->h->nsyms; j ++) {
+            const ObjSym* s = &m->syms[j];
+            if (s->sect == OBJ_SECT_IMPORT)
+                continue;
+
+            const char* name = sym_name(m, s);
+            u32 at = asm_hash(0, name, s->name_len) & mask;
+            while (l->table[at].module != 0) {
+                const Global* g = &l->table[at];
+                const Module* o = &l->mods[g->module - 1];
+                const ObjSym* os = &o->syms[g->sym];
+                if (os->name_len == s->name_len && memcmp(sym_name(o, os), name, s->name_len) == 0) {
+                    fprintf(stderr, "%s: %.*s is also defined in %s\n",
+                            m->path, (int) s->name_len, name, o->path);
+                    return 1;
+                }
+                at = (at + 1) & mask;
+            }
+            l->table[at] = (Global) { i + 1, j };
+        }
+    }
+    return 0;
+}
+
+static const Global* globals_find(const Linker* l, const char* name, u32 len) {
+    u32 mask = (1u << l->bits) - 1;
+    u32 at = asm_hash(0, name, len) & mask;
+    while (l->table[at].module != 0) {
+        const Global* g = &l->table[at];
+        const Module* o = &l->mods[g->module - 1];
+        const ObjSym* os = &o->syms[g->sym];
+        if (os->name_len == len && memcmp(sym_name(o, os), name, len) == 0)
+            return g;
+        at = (at + 1) & mask;
+    }
+    return NULL;
+}
+
+// final address and bank of a defined symbol
+static void sym_target(const Module* m, const ObjSym* s, u32* addr, su4* bank) {
+    if (s->sect == OBJ_SECT_ABS) {
+        *addr = s->value;
+        *bank = 0;
+    }
+    else {
+        *addr = m->addr[s->sect] + s->value;
+        *bank = m->bank;
+    }
+}
+
+static int resolve(const Linker* l, const Module* m, u32 sym, u32* addr, su4* bank) {
+    const ObjSym* s = &m->syms[sym];
+    if (s->sect != OBJ_SECT_IMPORT) {
+        sym_target(m, s, addr, bank);
+        return 0;
+    }
+
+    const Global* g = globals_find(l, sym_name(m, s), s->name_len);
+    if (g == NULL) {
+        fprintf(stderr, "%s: undefined symbol %.*s\n", m->path, (int) s->name_len, sym_name(m, s));
+        return 1;
+    }
+    const Module* o = &l->mods[g->module - 1];
+    sym_target(o, &o->syms[g->sym], addr, bank);
+    return 0;
+}
+
+typedef struct {
+    u32 bank, addr, size;
+    u32 module, sect;
+} Placed;
+
+static int placed_cmp(const void* a, const void* b) {
+    const Placed* x = a;
+    const Placed* y = b;
+    if (x->bank != y->bank)
+        return x->bank < y->bank ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int link_map(const Module* mods, u32 count, const char* image);
+
+int obj_link(const ObjInput* inputs, u32 count, const char* path) {
+    Module* mods = calloc(count, sizeof(Module));
+    Linker l = { .mods = mods };
+    Placed* placed = NULL;
+    u8* image = NULL;
+    u32 nplaced = 0;
+    int status = 1;
+
+    // load and place
+    su4 bank = 0;
+    u32 addr = PAGE(1);
+    for (u32 i = 0; i < count; i ++) {
+        Module* m = &mods[i];
+        m->path = inputs[i].path;
+        m->map = map_file(m->path, &m->len);
+        if (m->map == NULL || !module_check(m)) {
+            fprintf(stderr, "%s: not an object\n", m->path);
+            goto out;
+        }
+
+        if (inputs[i].placed) {
+            bank = inputs[i].bank;
+            addr = inputs[i].addr;
+        }
+        m->bank = bank;
+        for (u32 j = 0; j < m->h->nsects; j ++) {
+            m->addr[j] = addr;
+            addr += m->sects[j].size;
+        }
+        if (addr > 0x10000) {
+            fprintf(stderr, "%s: runs past the end of bank %u\n", m->path, bank);
+            goto out;
+        }
+        nplaced += m->h->nsects;
+    }
+
+    // overlaps
+    placed = malloc((nplaced + 1) * sizeof(Placed));
+    nplaced = 0;
+    for (u32 i = 0; i < count; i ++) {
+        for (u32 j = 0; j < mods[i].h->nsects; j ++) {
+            if (mods[i].sects[j].size != 0)
+                placed[nplaced ++] = (Placed) { mods[i].bank, mods[i].addr[j], mods[i].sects[j].size, i, j };
+        }
+    }
+    qsort(placed, nplaced, sizeof(Placed), placed_cmp);
+    for (u32 i = 1; i < nplaced; i ++) {
+        const Placed* a = &placed[i - 1];
+        const Placed* b = &placed[i];
+        if (a->bank == b->bank && a->addr + a->size > b->addr) {
+            fprintf(stderr, "%s overlaps %s in bank %u at %u\n",
+                    mods[b->module].path, mods[a->module].path, b->bank, b->addr);
+            goto out;
+        }
+    }
+
+    if (globals_add(&l, count) != 0)
+        goto out;
+
+    // image: header, segment table, then the sections in address order
+    u32 data_len = 0;
+    for (u32 i = 0; i < nplaced; i ++)
+        data_len += placed[i].size;
+    size_t head = sizeof(ObjImageHeader) + nplaced * sizeof(ObjSegment);
+    image = malloc(head + data_len);
+
+    ObjImageHeader* ih = (ObjImageHeader*) image;
+    *ih = (ObjImageHeader) { IMG_MAGIC, IMG_VERSION, nplaced, 0 };
+    ObjSegment* segs = (ObjSegment*) (image + sizeof(ObjImageHeader));
+
+    u32 at = head;
+    for (u32 i = 0; i < nplaced; i ++) {
+        const Placed* p = &placed[i];
+        const Module* m = &mods[p->module];
+        segs[i] = (ObjSegment) { p->bank, p->addr, p->size, at };
+        memcpy(image + at, m->map + m->offset[p->sect], p->size);
+
+        for (u32 j = 0; j < m->h->nrelocs; j ++) {
+            const ObjReloc* r = &m->relocs[j];
+            if (r->sect != p->sect)
+                continue;
+
+            u32 target;
+            su4 target_bank;
+            if (resolve(&l, m, r->sym, &target, &target_bank) != 0)
+                goto out;
+            target += r->addend;
+
+            u8* dest = image + at + r->offset;
+            if (r->kind == RELOC_LO8) {
+                dest[0] = target & 0xFF;
+            }
+            else if (r->kind == RELOC_16) {
+                dest[0] = target & 0xFF;
+                dest[1] = (target >> 8) & 0xFF;
+            }
+            else {
+                dest[0] = (dest[0] & 0xF0) | target_bank;
+            }
+        }
+        at += p->size;
+    }
+
+    status = write_atomic(path, image, head + data_len);
+    if (status == 0)
+        status = link_map(mods, count, path);
+
+out:
+    for (u32 i = 0; i < count; i ++) {
+        if (mods[i].map != NULL)
+            munmap((void*) mods[i].map, mods[i].len);
+        free(mods[i].offset);
+        free(mods[i].addr);
+    }
+    free(mods);
+    free(l.table);
+    free(placed);
+    free(image);
+    return status;
+}
+
+/* ============================================================
+ * images
+ * ============================================================ */
+
+// the segments follow each other in the file as they do in the image,
+// so the bytes stream straight in after the table
+int obj_write_image(const Asm* as, const char* path) {
+    u32 head = sizeof(ObjImageHeader) + as->nsegs * sizeof(ObjSegment);
+    char* tmp;
+    FILE* f = atomic_open(path, &tmp);
+
+    ObjImageHeader h = { IMG_MAGIC, IMG_VERSION, as->nsegs, 0 };
+    bool ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1;
+    for (u32 i = 0; ok && i < as->nsegs; i ++) {
+        const AsmSeg* g = &as->segs[i];
+        ObjSegment seg = { g->bank, g->addr, g->size, head + g->offset };
+        ok = fwrite(&seg, sizeof(seg), 1, f) == 1;
+    }
+
+    AsmSink sink = asm_sink_file(f, 0);
+    ok = ok && asm_emit_to(as, &sink) == 0;
+    return atomic_close(f, tmp, path, ok);
+}
+
+int obj_image_open(ObjImage* img, const char* path) {
+    *img = (ObjImage) {0};
+    img->map = map_file(path, &img->len);
+    if (img->map == NULL)
+        return 1;
+
+    const ObjImageHeader* h = (const ObjImageHeader*) img->map;
+    bool ok = img->len >= sizeof(*h) && h->magic == IMG_MAGIC && h->version == IMG_VERSION &&
+              sizeof(*h) + (u64) h->nsegs * sizeof(ObjSegment) <= img->len;
+
+    img->nsegs = ok ? h->nsegs : 0;
+    img->segs = (const ObjSegment*) (img->map + sizeof(*h));
+    for (u32 i = 0; ok && i < img->nsegs; i ++) {
+        const ObjSegment* s = &img->segs[i];
+        ok = (u64) s->offset + s->size <= img->len && s->bank < 16 && (u64) s->addr + s->size <= 0x10000;
+    }
+
+    if (!ok) {
+        obj_image_close(img);
+        return 1;
+    }
+    return 0;
+}
+
+void obj_image_close(ObjImage* img) {
+    if (img->map != NULL)
+        munmap((void*) img->map, img->len);
+    *img = (ObjImage) {0};
+}
+
+/* ============================================================
+ * source maps
+ * ============================================================ */
+
+typedef struct {
+    AsmBuf files, lines, labels, names;
+} MapBuild;
+
+static void map_file_add(MapBuild* b, const char* name, u32 len) {
+    ObjMapFile f = { b->names.len, len };
+    put(&b->files, &f, sizeof(f));
+    put(&b->names, name, len);
+}
+
+static void map_line_add(MapBuild* b, su20 addr, u32 size, u32 file, u32 line) {
+    ObjMapLine l = { addr, size, file, line };
+    put(&b->lines, &l, sizeof(l));
+}
+
+static void map_label_add(MapBuild* b, su20 addr, const char* name, u32 len) {
+    ObjMapLabel l = { addr, b->names.len, len };
+    put(&b->labels, &l, sizeof(l));
+    put(&b->names, name, len);
+}
+
+static int map_line_cmp(const void* a, const void* b) {
+    const ObjMapLine* x = a;
+    const ObjMapLine* y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// ties keep the order the labels came in
+static int map_label_cmp(const void* a, const void* b) {
+    const ObjMapLabel* x = a;
+    const ObjMapLabel* y = b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+// sorted, with a line that goes on where the last left off merged into
+// it; frees the parts
+static void map_finish(MapBuild* b, AsmBuf* out) {
+    ObjMapLine* lines = (ObjMapLine*) b->lines.data;
+    u32 nlines = b->lines.len / sizeof(ObjMapLine);
+    qsort(lines, nlines, sizeof(ObjMapLine), map_line_cmp);
+
+    u32 n = 0;
+    for (u32 i = 0; i < nlines; i ++) {
+        ObjMapLine* last = n > 0 ? &lines[n - 1] : NULL;
+        if (last != NULL && last->file == lines[i].file && last->line == lines[i].line &&
+            last->addr + last->size == lines[i].addr && last->size + lines[i].size <= 0xFFFF)
+            last->size += lines[i].size;
+        else
+            lines[n ++] = lines[i];
+    }
+
+    u32 nlabels = b->labels.len / sizeof(ObjMapLabel);
+    qsort(b->labels.data, nlabels, sizeof(ObjMapLabel), map_label_cmp);
+
+    ObjMapHeader h = {
+        .magic = MAP_MAGIC,
+        .version = MAP_VERSION,
+        .nfiles = b->files.len / sizeof(ObjMapFile),
+        .nlines = n,
+        .nlabels = nlabels,
+        .strtab_len = b->names.len,
+    };
+    put(out, &h, sizeof(h));
+    put(out, b->files.data, b->files.len);
+    put(out, lines, n * sizeof(ObjMapLine));
+    put(out, b->labels.data, b->labels.len);
+    put(out, b->names.data, b->names.len);
+
+    asm_buf_free(&b->files);
+    asm_buf_free(&b->lines);
+    asm_buf_free(&b->labels);
+    asm_buf_free(&b->names);
+}
+
+static void map_from_asm(MapBuild* b, const Asm* as, const char* src) {
+    map_file_add(b, src, strlen(src));
+
+    for (u32 i = 0; i < as->count; i ++) {
+        const AsmInstr* in = &as->instrs[i];
+        const AsmSect* sect = &as->sects[in->sect];
+        if (in->size != 0)
+            map_line_add(b, MK20(sect->bank, sect->addr + in->addr), in->size, 0, in->line);
+    }
+
+    for (u32 i = 0; i < as->nsyms; i ++) {
+        const AsmSym* s = &as->syms[i];
+        if (s->kind != SYM_LABEL)
+            continue;
+        // the end of a section that fills its bank is no address
+        u32 addr = asm_value(as, s).val;
+        if (addr <= 0xFFFF)
+            map_label_add(b, MK20(as->sects[s->sect].bank, addr), s->name, s->len);
+    }
+}
+
+// the tables of the modules, where the linker placed them
+static int link_map(const Module* mods, u32 count, const char* image) {
+    MapBuild b = {0};
+    for (u32 i = 0; i < count; i ++) {
+        const Module* m = &mods[i];
+        map_file_add(&b, m->names + m->h->src, m->h->src_len);
+
+        for (u32 j = 0; j < m->h->nlines; j ++) {
+            const ObjLine* l = &m->lines[j];
+            map_line_add(&b, MK20(m->bank, m->addr[l->sect] + l->offset), l->size, i, l->line);
+        }
+        for (u32 j = 0; j < m->h->nlabels; j ++) {
+            const ObjSym* s = &m->labels[j];
+            u32 addr = m->addr[s->sect] + s->value;
+            if (addr <= 0xFFFF)
+                map_label_add(&b, MK20(m->bank, addr), sym_name(m, s), s->name_len);
+        }
+    }
+
+    AsmBuf file = {0};
+    map_finish(&b, &file);
+    char* path = obj_map_path(image);
+    int status = write_atomic(path, file.data, file.len);
+    if (status != 0)
+        perror(path);
+    free(path);
+    asm_buf_free(&file);
+    return status;
+}
+
+char* obj_map_path(const char* image) {
+    size_t len = strlen(image);
+    const char* dot = strrchr(image, '.');
+    if (dot != NULL && strchr(dot, '/') == NULL)
+        len = dot - image;
+
+    char* path = malloc(len + sizeof(".smap"));
+    memcpy(path, image, len);
+    strcpy(path + len, ".smap");
+    return path;
+}
+
+int obj_write_map(const Asm* as, const char* src, const char* path) {
+    MapBuild b = {0};
+    AsmBuf file = {0};
+    map_from_asm(&b, as, src);
+    map_finish(&b, &file);
+    int status = write_atomic(path, file.data, file.len);
+    asm_buf_free(&file);
+    return status;
+}
+
+// every table inside the data, every name and file inside its table
+static bool map_check(ObjMap* map) {
+    if (map->len < sizeof(ObjMapHeader))
+        return false;
+    const ObjMapHeader* h = (const ObjMapHeader*) map->map;
+    if (h->magic != MAP_MAGIC || h->version != MAP_VERSION)
+        return false;
+
+    u64 at = sizeof(ObjMapHeader);
+    map->files = (const ObjMapFile*) (map->map + at);
+    at += (u64) h->nfiles * sizeof(ObjMapFile);
+    map->lines = (const ObjMapLine*) (map->map + at);
+    at += (u64) h->nlines * sizeof(ObjMapLine);
+    map->labels = (const ObjMapLabel*) (map->map + at);
+    at += (u64) h->nlabels * sizeof(ObjMapLabel);
+    map->names = (const char*) (map->map + at);
+    at += h->strtab_len;
+    if (at != map->len)
+        return false;
+
+    map->nfiles = h->nfiles;
+    map->nlines = h->nlines;
+    map->nlabels = h->nlabels;
+
+    for (u32 i = 0; i < map->nfiles; i ++) {
+        if ((u64) map->files[i].name + map->files[i].name_len > h->strtab_len)
+            return false;
+    }
+    for (u32 i = 0; i < map->nlines; i ++) {
+        if (map->lines[i].file >= map->nfiles || (i > 0 && map->lines[i].addr < map->lines[i - 1].addr))
+            return false;
+    }
+    for (u32 i = 0; i < map->nlabels; i ++) {
+        if ((u64) map->labels[i].name + map->labels[i].name_len > h->strtab_len ||
+            (i > 0 && map->labels[i].addr < map->labels[i - 1].addr))
+            return false;
+    }
+    return true;
+}
+
+int obj_map_open(ObjMap* map, const char* path) {
+    *map = (ObjMap) {0};
+    map->map = map_file(path, &map->len);
+    if (map->map == NULL)
+        return 1;
+    if (!map_check(map)) {
+        obj_map_close(map);
+        return 1;
+    }
+    return 0;
+}
+
+void obj_map_build(ObjMap* map, const Asm* as, const char* src) {
+    MapBuild b = {0};
+    AsmBuf file = {0};
+    map_from_asm(&b, as, src);
+    map_finish(&b, &file);
+
+    *map = (ObjMap) { .map = file.data, .len = file.len, .owned = true };
+    map_check(map);
+}
+
+void obj_map_close(ObjMap* map) {
+    if (map->owned)
+        free((void*) map->map);
+    else if (map->map != NULL)
+        munmap((void*) map->map, map->len);
+    *map = (ObjMap) {0};
+}
+
+// how many entries of a table sorted by addr start at or below addr
+#define UPPER_BOUND(table, count, key, out) do {    \
+    u32 lo_ = 0, hi_ = (count);                     \
+    while (lo_ < hi_) {                             \
+        u32 mid_ = lo_ + (hi_ - lo_) / 2;           \
+        if ((table)[mid_].addr <= (key))            \
+            lo_ = mid_ + 1;                         \
+        else                                        \
+            hi_ = mid_;                             \
+    }                                               \
+    (out) = lo_;                                    \
+} while (0)
+
+const ObjMapLine* obj_map_line(const ObjMap* map, su20 addr) {
+    u32 n;
+    UPPER_BOUND(map->lines, map->nlines, addr, n);
+    if (n == 0)
+        return NULL;
+    const ObjMapLine* l = &map->lines[n - 1];
+    return addr < l->addr + l->size ? l : NULL;
+}
+
+const ObjMapLabel* obj_map_label(const ObjMap* map, su20 addr) {
+    u32 n;
+    UPPER_BOUND(map->labels, map->nlabels, addr, n);
+    if (n == 0)
+        return NULL;
+    const ObjMapLabel* l = &map->labels[n - 1];
+    return l->addr >> 16 == addr >> 16 ? l : NULL;
+}
+
+size_t obj_map_where(const ObjMap* map, su20 addr, char* buf, size_t cap) {
+    const ObjMapLine* line = obj_map_line(map, addr);
+    const ObjMapLabel* label = obj_map_label(map, addr);
+    int len = 0;
+
+    if (line != NULL) {
+        const ObjMapFile* f = &map->files[line->file];
+        len = snprintf(buf, cap, "%.*s:%u", (int) f->name_len, obj_map_name(map, f->name), line->line);
+    }
+    else {
+        len = snprintf(buf, cap, "%X:%04X", addr >> 16 & 15, addr & 0xFFFF);
+    }
+
+    if (label != NULL && (size_t) len < cap) {
+        const char* name = obj_map_name(map, label->name);
+        if (label->addr == addr)
+            len += snprintf(buf + len, cap - len, " %.*s", (int) label->name_len, name);
+        else
+            len += snprintf(buf + len, cap - len, " %.*s+%u", (int) label->name_len, name, addr - label->addr);
+    }
+    return (size_t) len < cap ? (size_t) len : cap - 1;
+}
@@ -0,0 +1,223 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include "emu.h"
+#include "asm.h"
+
+// relocatable objects, the linker, and the images and source maps it writes
+//
+//   asm -c a.asm                     a.o; skipped while a.asm is unchanged
+//   asmlink -o prog.img a.o b.o@1:2  b goes to bank 1, page 2
+//
+// modules without a placement follow the previous one; the first starts
+// at bank 0, PAGE(1), where the cpu starts. everything is little endian
+//
+// OBJECT
+// =====================================
+//
+// ObjHeader
+// ObjSect    x nsects
+// section bytes, back to back in section order, padded to 4
+// ObjSym     x nsyms
+// ObjReloc   x nrelocs
+// ObjLine    x nlines
+// ObjSym     x nlabels
+// names      strtab_len bytes, not terminated
+//
+// the first nsects symbols stand for the section starts; relocations
+// against a section go through them. the rest are globals and imports.
+// the lines and labels, locals included, only feed the source map
+//
+// IMAGE
+// =====================================
+//
+// ObjImageHeader
+// ObjSegment x nsegs
+// segment bytes at their offsets
+//
+// SOURCE MAP
+// =====================================
+//
+// asm and asmlink write one next to each image (prog.img -> prog.smap)
+// so addresses read as file:line and label + offset
+//
+// ObjMapHeader
+// ObjMapFile  x nfiles
+// ObjMapLine  x nlines    by address, none overlapping
+// ObjMapLabel x nlabels   by address
+// names       strtab_len bytes, not terminated
+//
+//   ObjMap map;
+//   if (obj_map_open(&map, "prog.smap") == 0) {
+//       const ObjMapLine* l = obj_map_line(&map, MK20(bank, pc));
+//       ...
+//       obj_map_close(&map);
+//   }
+//
+// lookups are binary searches over the sorted tables, so a profile or a
+// trace symbolizes in log time per address
+
+#define OBJ_MAGIC   0x4A424F45u // "EOBJ"
+#define IMG_MAGIC   0x474D4945u // "EIMG"
+#define MAP_MAGIC   0x50414D45u // "EMAP"
+#define OBJ_VERSION 2
+#define IMG_VERSION 1
+#define MAP_VERSION 1
+
+#define OBJ_SECT_ABS    0xFFFFFFFFu
+#define OBJ_SECT_IMPORT 0xFFFFFFFEu
+
+#define OBJ_OPT_OPTIMIZE 1u     // assembled with -O
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u64 src_mtime;      // ns; the source this was assembled from
+    u64 src_size;
+    u32 src_hash;
+    u32 nsects;
+    u32 nsyms;
+    u32 nrelocs;
+    u32 strtab_len;
+    u32 nlines;
+    u32 nlabels;
+    u32 src, src_len;   // the source's name, in the string table
+    u32 options;        // OBJ_OPT_*; an object built otherwise is not fresh
+} ObjHeader;
+
+typedef struct {
+    u32 name, name_len;
+    u32 size;
+} ObjSect;
+
+typedef struct {
+    u32 name, name_len;
+    u32 sect;           // index, OBJ_SECT_ABS or OBJ_SECT_IMPORT
+    int32_t value;      // offset in the section, or the value
+} ObjSym;
+
+typedef struct {
+    u32 sect;
+    u32 offset;
+    u32 sym;
+    int32_t addend;
+    u32 kind;           // AsmRelocKind
+} ObjReloc;
+
+// size bytes of code from one source line
+typedef struct {
+    u32 sect;
+    u32 offset;
+    u32 size;
+    u32 line;
+} ObjLine;
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 nsegs;
+    u32 reserved;
+} ObjImageHeader;
+
+typedef struct {
+    u32 bank;
+    u32 addr;
+    u32 size;
+    u32 offset;         // of the bytes in the file
+} ObjSegment;
+
+// as was assembled with reloc set; src is the source path
+int obj_write(const Asm* as, const char* src, const char* path);
+
+// whether path was assembled from src as it is now, with options
+bool obj_fresh(const char* path, const char* src, u32 options);
+
+typedef struct {
+    const char* path;
+    bool placed;        // else right after the previous module
+    su4 bank;
+    u16 addr;
+} ObjInput;
+
+// writes the image and its source map; errors go to stderr
+int obj_link(const ObjInput* inputs, u32 count, const char* path);
+
+// a flat module, linked, as an image with its segments
+int obj_write_image(const Asm* as, const char* path);
+
+typedef struct {
+    const u8* map;
+    size_t len;
+    u32 nsegs;
+    const ObjSegment* segs;
+} ObjImage;
+
+int obj_image_open(ObjImage* img, const char* path);
+void obj_image_close(ObjImage* img);
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 nfiles;
+    u32 nlines;
+    u32 nlabels;
+    u32 strtab_len;
+} ObjMapHeader;
+
+typedef struct {
+    u32 name, name_len;
+} ObjMapFile;
+
+typedef struct {
+    su20 addr;          // MK20(bank, addr)
+    u16 size;
+    u16 file;
+    u32 line;           // 1 based
+} ObjMapLine;
+
+typedef struct {
+    su20 addr;
+    u32 name, name_len;
+} ObjMapLabel;
+
+typedef struct {
+    const u8* map;
+    size_t len;
+    const ObjMapFile* files;
+    const ObjMapLine* lines;
+    const ObjMapLabel* labels;
+    const char* names;
+    u32 nfiles, nlines, nlabels;
+    bool owned;         // built in memory rather than mapped
+} ObjMap;
+
+// image.ext -> image.smap; to be freed
+char* obj_map_path(const char* image);
+
+// of a flat module, linked; src is the source path
+int obj_write_map(const Asm* as, const char* src, const char* path);
+
+int obj_map_open(ObjMap* map, const char* path);
+// the same, straight from a flat module
+void obj_map_build(ObjMap* map, const Asm* as, const char* src);
+void obj_map_close(ObjMap* map);
+
+// the line holding addr, or NULL
+const ObjMapLine* obj_map_line(const ObjMap* map, su20 addr);
+
+// the last label at or below addr in its bank, or NULL
+const ObjMapLabel* obj_map_label(const ObjMap* map, su20 addr);
+
+static inline const char* obj_map_name(const ObjMap* map, u32 name) {
+    return map->names + name;
+}
+
+// "file:line label+off" for addr, or as much of it as the map knows,
+// into buf; returns the length
+size_t obj_map_where(const ObjMap* map, su20 addr, char* buf, size_t cap);
+
+static inline const u8* obj_image_data(const ObjImage* img, u32 seg) {
+    return img->map + img->segs[seg].offset;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "resample.h"
+
+static double blackman(double x) {
+    // x in [-1, 1]
+    return 0.42 + 0.5 * cos(M_PI * x) + 0.08 * cos(2 * M_PI * x);
+}
+
+void resampler_init(Resampler* rs, u32 in_rate, u32 out_rate) {
+    rs->pos = 0;
+    rs->step = (((u64) in_rate) << 32) / out_rate;
+    rs->len = 0;
+
+    // cut below the lower of both nyquist frequencies
+    double cutoff = 0.9;
+    if (out_rate < in_rate)
+        cutoff *= (double) out_rate / in_rate;
+
+    const double half = RS_TAPS / 2;
+    for (int p = 0; p <= RS_PHASES; p ++) {
+        double frac = (double) p / RS_PHASES;
+        double sum = 0;
+        double row[RS_TAPS];
+
+        for (int t = 0; t < RS_TAPS; t ++) {
+            double d = t - (half - 1) - frac;
+            double x = M_PI * cutoff * d;
+            double sinc = d == 0 ? 1 : sin(x) / x;
+            double w = fabs(d) >= half ? 0 : blackman(d / half);
+            row[t] = sinc * w;
+            sum += row[t];
+        }
+
+        // unity gain at dc
+        for (int t = 0; t < RS_TAPS; t ++)
+            rs->coef[p][t] = row[t] / sum;
+    }
+}
+
+float* resampler_push(Resampler* rs, u32 count) {
+    u32 idx = rs->pos >> 32;
+    if (idx > 0) {
+        memmove(rs->fifo, rs->fifo + idx, (rs->len - idx) * sizeof(float));
+        rs->len -= idx;
+        rs->pos -= ((u64) idx) << 32;
+    }
+
+    assert(rs->len + count <= RS_FIFO);
+
+    float* dest = rs->fifo + rs->len;
+    rs->len += count;
+    return dest;
+}
+
+static inline rs_v4f load4(const float* p) {
+    rs_v4f v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+u32 resampler_pull(Resampler* rs, float* out, u32 frames) {
+    u32 done = 0;
+
+    while (done < frames) {
+        u32 idx = rs->pos >> 32;
+        if (idx + RS_TAPS > rs->len)
+            break;
+
+        u32 frac = (u32) rs->pos;
+        u32 phase = frac >> 25;                        // top 7 bits -> row
+        float t = (frac & 0x1FFFFFF) * (1.0f / 33554432.0f);
+
+        const rs_v4f* c0 = (const rs_v4f*) rs->coef[phase];
+        const rs_v4f* c1 = (const rs_v4f*) rs->coef[phase + 1];
+        const float* in = rs->fifo + idx;
+
+        rs_v4f acc = {0};
+        for (int k = 0; k < RS_TAPS / 4; k ++) {
+            rs_v4f c = c0[k] + (c1[k] - c0[k]) * t;
+            acc += c * load4(in + k * 4);
+        }
+
+        out[done ++] = acc[0] + acc[1] + acc[2] + acc[3];
+        rs->pos += rs->step;
+    }
+
+    return done;
+}
@@ -0,0 +1,36 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "emu.h"
+
+// polyphase windowed-sinc resampler
+//
+// input is pushed at the engine rate into a small FIFO and pulled out at
+// the device rate. the filter bank has RS_PHASES rows of RS_TAPS taps;
+// the output is interpolated linearly between two neighbouring rows.
+
+#define RS_TAPS   16
+#define RS_PHASES 128
+#define RS_FIFO   512
+
+typedef float rs_v4f __attribute__((vector_size(16)));
+
+typedef struct {
+    u64 pos;   // 32.32 read position in fifo
+    u64 step;  // 32.32 input samples per output sample
+    u32 len;   // valid samples in fifo
+
+    float coef[RS_PHASES + 1][RS_TAPS] __attribute__((aligned(16)));
+    float fifo[RS_FIFO];
+} Resampler;
+
+void resampler_init(Resampler* rs, u32 in_rate, u32 out_rate);
+
+// returns space for `count` more input samples (count <= RS_FIFO - RS_TAPS)
+float* resampler_push(Resampler* rs, u32 count);
+
+// writes up to `frames` output samples; returns the number written.
+// stops early when the fifo runs dry; push more input and call again
+u32 resampler_pull(Resampler* rs, float* out, u32 frames);
+
+#endif
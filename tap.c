@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "tap.h"
+
+#define TAP_POLL_NS  10000000   // drain interval; batches ~80 blocks per write
+#define TAP_RETRY_NS 1000000000 // reopen interval after an error
+
+typedef struct {
+    u8 ring[TAP_RING];
+    _Atomic u64 head;     // bytes pushed, written by the producer
+    _Atomic u64 tail;     // bytes drained, written by the drain thread
+    _Atomic u64 written;
+    _Atomic u64 dropped;
+    _Atomic bool running;
+
+    // drain thread only
+    char* dest;
+    int fd;
+    bool opened;          // truncate files on the first open only
+    pthread_t thread;
+} TapData;
+
+static u64 now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_ns(u64 ns) {
+    struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+    nanosleep(&ts, NULL);
+}
+
+// non blocking, so a full pipe or socket shows up as EAGAIN instead of
+// stalling the drain thread
+static int dest_open(TapData* t) {
+    if (strncmp(t->dest, "unix:", 5) == 0) {
+        struct sockaddr_un sa = { .sun_family = AF_UNIX };
+        strncpy(sa.sun_path, t->dest + 5, sizeof(sa.sun_path) - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0) {
+            close(fd);
+            return -1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+    // a fifo without a reader fails with ENXIO and is retried later
+    int flags = O_WRONLY | O_CREAT | O_NONBLOCK | (t->opened ? O_APPEND : O_TRUNC);
+    int fd = open(t->dest, flags, 0644);
+    if (fd >= 0)
+        t->opened = true;
+    return fd;
+}
+
+static void* drain(void* arg) {
+    TapData* t = arg;
+    u64 retry = 0;
+
+    // a reader going away turns into EPIPE here instead of killing the
+    // process; SIGPIPE goes to the writing thread only
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    while (true) {
+        bool running = atomic_load_explicit(&t->running, memory_order_acquire);
+        u64 head = atomic_load_explicit(&t->head, memory_order_acquire);
+        u64 tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+        u64 len = head - tail;
+
+        if (t->fd < 0 && now_ns() >= retry) {
+            t->fd = dest_open(t);
+            if (t->fd < 0)
+                retry = now_ns() + TAP_RETRY_NS;
+        }
+
+        if (len == 0 || t->fd < 0) {
+            // nowhere to go; old audio is useless once a reader shows up
+            if (len != 0) {
+                atomic_fetch_add_explicit(&t->dropped, len, memory_order_relaxed);
+                atomic_store_explicit(&t->tail, head, memory_order_release);
+            }
+            if (!running)
+                break;
+            sleep_ns(TAP_POLL_NS);
+            continue;
+        }
+
+        u32 at = tail & (TAP_RING - 1);
+        u64 first = len < TAP_RING - at ? len : TAP_RING - at;
+
+        struct iovec iov[2] = {
+            { t->ring + at, first },
+            { t->ring, len - first },
+        };
+        ssize_t done = writev(t->fd, iov, len > first ? 2 : 1);
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close(t->fd);
+                t->fd = -1;
+                retry = now_ns() + TAP_RETRY_NS;
+            }
+            else if (!running) {
+                break;
+            }
+            sleep_ns(TAP_POLL_NS);
+            continue;
+        }
+
+        atomic_fetch_add_explicit(&t->written, done, memory_order_relaxed);
+        atomic_store_explicit(&t->tail, tail + done, memory_order_release);
+
+        if ((u64) done == len) {
+            if (!running)
+                break;
+            sleep_ns(TAP_POLL_NS);
+        }
+    }
+
+    return NULL;
+}
+
+bool pcmtap_open(PcmTap* tap, const char* dest) {
+    TapData* t = malloc(sizeof(TapData));
+    if (t == NULL)
+        return false;
+
+    atomic_init(&t->head, 0);
+    atomic_init(&t->tail, 0);
+    atomic_init(&t->written, 0);
+    atomic_init(&t->dropped, 0);
+    atomic_init(&t->running, true);
+
+    t->dest = strdup(dest);
+    t->fd = -1;
+    t->opened = false;
+
+    if (t->dest == NULL || pthread_create(&t->thread, NULL, drain, t) != 0) {
+        free(t->dest);
+        free(t);
+        return false;
+    }
+
+    *tap = t;
+    return true;
+}
+
+// drains what is left, then stops the thread
+void pcmtap_close(PcmTap* tap) {
+    TapData* t = *tap;
+
+    atomic_store_explicit(&t->running, false, memory_order_release);
+    pthread_join(t->thread, NULL);
+
+    if (t->fd >= 0)
+        close(t->fd);
+    free(t->dest);
+    free(t);
+    *tap = NULL;
+}
+
+void pcmtap_push(PcmTap* tap, const void* data, u32 bytes) {
+    TapData* t = *tap;
+
+    u64 head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    u64 tail = atomic_load_explicit(&t->tail, memory_order_acquire);
+
+    // whole pushes only, so frames stay aligned
+    if (TAP_RING - (head - tail) < bytes) {
+        atomic_fetch_add_explicit(&t->dropped, bytes, memory_order_relaxed);
+        return;
+    }
+
+    u32 at = head & (TAP_RING - 1);
+    u32 first = bytes < TAP_RING - at ? bytes : TAP_RING - at;
+    memcpy(t->ring + at, data, first);
+    memcpy(t->ring, (const u8*) data + first, bytes - first);
+
+    atomic_store_explicit(&t->head, head + bytes, memory_order_release);
+}
+
+void pcmtap_stats(PcmTap* tap, PcmTapStats* out) {
+    TapData* t = *tap;
+
+    out->written = atomic_load_explicit(&t->written, memory_order_relaxed);
+    out->dropped = atomic_load_explicit(&t->dropped, memory_order_relaxed);
+}
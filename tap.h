@@ -0,0 +1,34 @@
+#ifndef TAP_H
+#define TAP_H
+
+#include "emu.h"
+
+// pcm tap
+//
+// copies audio out of the callback into a lock-free ring; a drain thread
+// writes the ring to a file, fifo or unix socket as raw pcm. the producer
+// never blocks: when the ring is full the samples are dropped and counted.
+//
+// dest is a path (file or fifo, opened by the drain thread so a fifo
+// without a reader does not hold anything up) or "unix:path" for a
+// stream socket. the drain thread reopens it after errors
+
+#define TAP_RING (1 << 17) // bytes; power of two
+
+typedef void* PcmTap;
+
+typedef struct {
+    u64 written;  // bytes handed to the destination
+    u64 dropped;  // bytes lost to a full ring or a missing destination
+} PcmTapStats;
+
+bool pcmtap_open(PcmTap* tap, const char* dest);
+void pcmtap_close(PcmTap* tap);
+
+// producer side; one thread only
+void pcmtap_push(PcmTap* tap, const void* data, u32 bytes);
+
+// safe from any thread
+void pcmtap_stats(PcmTap* tap, PcmTapStats* out);
+
+#endif
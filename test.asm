@@ -1,60 +1,58 @@
-; sound chip is 8192
-; voice0 is 8202
+.equ SOUND, 8192
+.equ VOICE1, SOUND + 32
+.equ TIMER, 12288
+.equ CH4, TIMER + 8
+.equ WAIT4, TIMER + 20
 
 ; rise
-imm.b r0, b 20
-sto.b [8204], r0
+imm r0, 20
+sto.b [VOICE1 + 2], r0
 
 ; vol
-imm.b r0, b 100
-sto.b [8205], r0
+imm r0, 100
+sto.b [VOICE1 + 3], r0
 
 ; len
-imm.b r0, b 1
-sto.b [8206], r0
+imm r0, 1
+sto.b [VOICE1 + 4], r0
 
-; fall 
-imm.b r0, b 40
-sto.b [8207], r0
+; fall
+imm r0, 40
+sto.b [VOICE1 + 5], r0
 
-; low 
-imm.b r0, b 0
-sto.b [8208], r0
+; low
+imm r0, 0
+sto.b [VOICE1 + 6], r0
 
-; high 
-imm.b r0, b 255
-sto.b [8209], r0
+; high
+imm r0, 255
+sto.b [VOICE1 + 7], r0
 
-; echo (ignored)
-imm.b r0, b 0
-sto.b [8210], r0
+; echo (off)
+imm r0, 0
+sto.b [VOICE1 + 8], r0
 
 ; wavelen
-imm.b r0, b 80
-sto.b [8211], r0
+imm r0, 80
+sto.b [VOICE1 + 9], r0
 
 
-imm.b r1, b 120
-   ;  loop
+imm r1, 120
 
+loop:
 ; freq
-sto.b [8203], r1
+sto.b [VOICE1 + 1], r1
 
 ; trigger
-sto.b [8202], r0
+sto.b [VOICE1], r0
 
 ; 2 seconds
-imm.b r0, b 200
-; tc is 12288
-; ch4
-sto.b [12296], r0
-; wait 0 is 12304
-sto.b [12308]
-sto.b [12296], r0
-; wait 0 is 12304
-sto.b [12308]
+imm r0, 200
+sto.b [CH4], r0
+sto.b [WAIT4]
+sto.b [CH4], r0
+sto.b [WAIT4]
 
 addi.b r1, b 1
 
-jmp [pc - 38]
-
+jmp [loop]